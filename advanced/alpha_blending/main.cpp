@@ -4,11 +4,17 @@
 #define GLFW_INCLUDE_GLU  // GLUライブラリを使用するのに必要
 #include <GLFW/glfw3.h>
 
+#include <glutils/fixed_timestep.h>
+
 static int WIN_WIDTH   = 500;                 // ウィンドウの幅
 static int WIN_HEIGHT  = 500;                 // ウィンドウの高さ
 static const char *WIN_TITLE = "OpenGL Course";     // ウィンドウのタイトル
 
 static float theta = 0.0f;
+static float prevTheta = 0.0f;
+
+// アニメーションは描画の速さによらず, 1秒に60回の一定の間隔で進める
+FixedTimestep timestep(1.0 / 60.0);
 
 static const float positions[8][3] = {
     { -1.0f, -1.0f, -1.0f },
@@ -64,7 +70,8 @@ void paintGL() {
               0.0f, 0.0f, 0.0f,     // 見ている先
               0.0f, 1.0f, 0.0f);    // 視界の上方向
 
-    glRotatef(theta, 0.0f, 1.0f, 0.0f);  // y軸中心にthetaだけ回転
+    const float renderTheta = timestep.lerp(prevTheta, theta);
+    glRotatef(renderTheta, 0.0f, 1.0f, 0.0f);  // y軸中心に補間した角度だけ回転
 
     // アルファブレンドの有効化
     glEnable(GL_BLEND);
@@ -109,6 +116,7 @@ void resizeGL(GLFWwindow *window, int width, int height) {
 
 // アニメーションのためのアップデート
 void animate() {
+    prevTheta = theta;
     theta += 1.0f;  // 1度だけ回転
 }
 
@@ -138,13 +146,17 @@ int main(int argc, char **argv) {
     initializeGL();
 
     // メインループ
+    timestep.reset(glfwGetTime());
     while (glfwWindowShouldClose(window) == GL_FALSE) {
+        // アニメーション (経過時間に応じて0回以上進める)
+        const int steps = timestep.advance(glfwGetTime());
+        for (int i = 0; i < steps; i++) {
+            animate();
+        }
+
         // 描画
         paintGL();
 
-        // アニメーション
-        animate();
-
         // 描画用バッファの切り替え
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -7,9 +7,12 @@ in vec3 f_lightPosCameraSpace;
 out vec4 out_color;
 
 // マテリアルのデータ
-uniform vec3 u_diffColor;
-uniform vec3 u_specColor;
-uniform vec3 u_ambiColor;
+layout(std140) uniform MaterialBlock {
+    vec3 u_ambiColor;
+    vec3 u_diffColor;
+    vec3 u_specColor;
+    float u_shininess;
+};
 uniform float u_alpha = 0.05;
 
 float PI3.14159265358979;
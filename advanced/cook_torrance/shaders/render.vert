@@ -9,20 +9,23 @@ out vec3 f_positionCameraSpace;
 out vec3 f_normalCameraSpace;
 out vec3 f_lightPosCameraSpace;
 
-// 光源の情報
-uniform vec3 u_lightPos;
+// フレームごとのカメラと光源の情報
+layout(std140) uniform FrameBlock {
+    mat4 u_viewMat;
+    mat4 u_projMat;
+    vec4 u_lightPos;   // ワールド座標
+};
 
-// 各種変換行列
-uniform mat4 u_mvMat;
-uniform mat4 u_mvpMat;
+// 物体ごとの変換行列 (法線の変換行列はカメラ座標系への変換)
+uniform mat4 u_modelMat;
 uniform mat4 u_normMat;
-uniform mat4 u_lightMat;
 
 void main() {
-    gl_Position = u_mvpMat * vec4(in_position, 1.0);
+    vec4 positionCameraSpace = u_viewMat * u_modelMat * vec4(in_position, 1.0);
+    gl_Position = u_projMat * positionCameraSpace;
 
     // カメラ座標系への変換
-    f_positionCameraSpace = (u_mvMat * vec4(in_position, 1.0)).xyz;
+    f_positionCameraSpace = positionCameraSpace.xyz;
     f_normalCameraSpace = (u_normMat * vec4(in_normal, 0.0)).xyz;
-    f_lightPosCameraSpace = (u_lightMat * vec4(u_lightPos, 1.0)).xyz;
+    f_lightPosCameraSpace = (u_viewMat * u_lightPos).xyz;
 }
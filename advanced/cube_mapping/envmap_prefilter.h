@@ -0,0 +1,472 @@
+#ifndef _ENVMAP_PREFILTER_H_
+#define _ENVMAP_PREFILTER_H_
+
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <glutils/job_system.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ENVMAP_PREFILTER_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+// RGBAの4成分をまとめて扱うための型 (SSEが使える場合は1命令で計算する)
+struct Float4 {
+#ifdef ENVMAP_PREFILTER_USE_SSE
+    Float4()
+        : v(_mm_setzero_ps()) {
+    }
+
+    explicit Float4(__m128 v_)
+        : v(v_) {
+    }
+
+    static Float4 load(const float *p) {
+        return Float4(_mm_loadu_ps(p));
+    }
+
+    void store(float *p) const {
+        _mm_storeu_ps(p, v);
+    }
+
+    void madd(const Float4 &a, float w) {
+        v = _mm_add_ps(v, _mm_mul_ps(a.v, _mm_set1_ps(w)));
+    }
+
+    Float4 operator*(float s) const {
+        return Float4(_mm_mul_ps(v, _mm_set1_ps(s)));
+    }
+
+    __m128 v;
+#else
+    Float4() {
+        v[0] = v[1] = v[2] = v[3] = 0.0f;
+    }
+
+    static Float4 load(const float *p) {
+        Float4 r;
+        std::memcpy(r.v, p, sizeof(float) * 4);
+        return r;
+    }
+
+    void store(float *p) const {
+        std::memcpy(p, v, sizeof(float) * 4);
+    }
+
+    void madd(const Float4 &a, float w) {
+        for (int c = 0; c < 4; c++) v[c] += a.v[c] * w;
+    }
+
+    Float4 operator*(float s) const {
+        Float4 r;
+        for (int c = 0; c < 4; c++) r.v[c] = v[c] * s;
+        return r;
+    }
+
+    float v[4];
+#endif
+};
+
+// キューブマップからGGXで前処理した鏡面反射用のミップマップと
+// 拡散反射用の放射照度 (2次までの球面調和関数, 9係数) を計算するクラス
+// 面の番号は GL_TEXTURE_CUBE_MAP_POSITIVE_X からの差 (+X, -X, +Y, -Y, +Z, -Z)
+class EnvmapPrefilter {
+public:
+    EnvmapPrefilter()
+        : size_(0)
+        , numLevels_(0)
+        , sampleCount_(0)
+        , numSourceMips_(0)
+        , jobs_(NULL) {
+        std::memset(shCoeffs_, 0, sizeof(shCoeffs_));
+    }
+
+    // faces: 6枚の size x size の面 (RGBA, float)
+    // jobsを渡すと行ごとの計算を並列に行う (NULLなら呼び出し元のスレッドだけで計算する)
+    void compute(const std::vector<float> *faces, int size, int numLevels, int sampleCount = 64,
+                 JobSystem *jobs = NULL) {
+        jobs_ = jobs;
+        size_ = size;
+        numLevels_ = std::max(1, numLevels);
+        sampleCount_ = sampleCount;
+
+        buildSourceMips(faces);
+        computeSH();
+
+        levels_.assign(numLevels_ * 6, std::vector<float>());
+        for (int f = 0; f < 6; f++) {
+            levels_[f] = faces[f];
+        }
+
+        for (int level = 1; level < numLevels_; level++) {
+            prefilterLevel(level);
+        }
+
+        sourceMips_.clear();
+        jobs_ = NULL;
+    }
+
+    // 計算結果をファイルに保存する
+    bool save(const std::string &filename, uint64_t key) const {
+        FILE *fp = fopen(filename.c_str(), "wb");
+        if (fp == NULL) {
+            return false;
+        }
+
+        const uint32_t header[4] = { MAGIC, (uint32_t)size_, (uint32_t)numLevels_, (uint32_t)sampleCount_ };
+        bool success = fwrite(header, sizeof(header), 1, fp) == 1 &&
+                       fwrite(&key, sizeof(key), 1, fp) == 1 &&
+                       fwrite(shCoeffs_, sizeof(shCoeffs_), 1, fp) == 1;
+        for (int i = 0; i < (int)levels_.size() && success; i++) {
+            success = fwrite(levels_[i].data(), sizeof(float), levels_[i].size(), fp) == levels_[i].size();
+        }
+
+        fclose(fp);
+        return success;
+    }
+
+    // キャッシュが存在し, キーが一致する場合のみ読み込む
+    bool load(const std::string &filename, uint64_t key) {
+        FILE *fp = fopen(filename.c_str(), "rb");
+        if (fp == NULL) {
+            return false;
+        }
+
+        uint32_t header[4];
+        uint64_t fileKey;
+        if (fread(header, sizeof(header), 1, fp) != 1 || fread(&fileKey, sizeof(fileKey), 1, fp) != 1 ||
+            header[0] != MAGIC || fileKey != key) {
+            fclose(fp);
+            return false;
+        }
+
+        size_ = header[1];
+        numLevels_ = header[2];
+        sampleCount_ = header[3];
+
+        bool success = fread(shCoeffs_, sizeof(shCoeffs_), 1, fp) == 1;
+        levels_.assign(numLevels_ * 6, std::vector<float>());
+        for (int i = 0; i < (int)levels_.size() && success; i++) {
+            const int sz = levelSize(i / 6);
+            levels_[i].resize((size_t)sz * sz * 4);
+            success = fread(levels_[i].data(), sizeof(float), levels_[i].size(), fp) == levels_[i].size();
+        }
+
+        fclose(fp);
+        return success;
+    }
+
+    // 入力データと計算条件から作るキャッシュのキー (FNV-1a)
+    static uint64_t cacheKey(const std::vector<float> *faces, int size, int numLevels, int sampleCount) {
+        uint64_t hash = 14695981039346656037ULL;
+        const int params[4] = { (int)MAGIC, size, numLevels, sampleCount };
+        hash = fnv1a(hash, params, sizeof(params));
+        for (int f = 0; f < 6; f++) {
+            hash = fnv1a(hash, faces[f].data(), sizeof(float) * faces[f].size());
+        }
+        return hash;
+    }
+
+    int numLevels() const {
+        return numLevels_;
+    }
+
+    int levelSize(int level) const {
+        return std::max(1, size_ >> level);
+    }
+
+    const float *face(int level, int face) const {
+        return levels_[level * 6 + face].data();
+    }
+
+    // 放射照度の係数 (RGB x 9). E(n) = sum_i c_i * Y_i(n)
+    const float *shCoeffs() const {
+        return shCoeffs_;
+    }
+
+private:
+    static const uint32_t MAGIC = 0x50564e45;  // "ENVP"
+
+    static uint64_t fnv1a(uint64_t hash, const void *data, size_t bytes) {
+        const unsigned char *p = (const unsigned char *)data;
+        for (size_t i = 0; i < bytes; i++) {
+            hash ^= p[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    // 行ごとの処理 func(行番号) をジョブシステムで並列に行う (1行の計算が重いので1行ずつ分ける)
+    template <typename Func>
+    void forEachRow(int numRows, const Func &func) {
+        if (jobs_ == NULL) {
+            for (int row = 0; row < numRows; row++) {
+                func(row);
+            }
+            return;
+        }
+
+        jobs_->parallelFor(numRows, 1, [&func](int begin, int end) {
+            for (int row = begin; row < end; row++) {
+                func(row);
+            }
+        });
+    }
+
+    static glm::vec3 faceDirection(int face, float s, float t) {
+        switch (face) {
+        case 0: return glm::vec3(1.0f, -t, -s);
+        case 1: return glm::vec3(-1.0f, -t, s);
+        case 2: return glm::vec3(s, 1.0f, t);
+        case 3: return glm::vec3(s, -1.0f, -t);
+        case 4: return glm::vec3(s, -t, 1.0f);
+        default: return glm::vec3(-s, -t, -1.0f);
+        }
+    }
+
+    static void directionToFace(const glm::vec3 &d, int *face, float *s, float *t) {
+        const float ax = std::abs(d.x);
+        const float ay = std::abs(d.y);
+        const float az = std::abs(d.z);
+        if (ax >= ay && ax >= az) {
+            *face = d.x > 0.0f ? 0 : 1;
+            *s = (d.x > 0.0f ? -d.z : d.z) / ax;
+            *t = -d.y / ax;
+        } else if (ay >= az) {
+            *face = d.y > 0.0f ? 2 : 3;
+            *s = d.x / ay;
+            *t = (d.y > 0.0f ? d.z : -d.z) / ay;
+        } else {
+            *face = d.z > 0.0f ? 4 : 5;
+            *s = (d.z > 0.0f ? d.x : -d.x) / az;
+            *t = -d.y / az;
+        }
+    }
+
+    // 2x2画素の平均で縮小した入力のミップマップを作る
+    void buildSourceMips(const std::vector<float> *faces) {
+        numSourceMips_ = 1;
+        while ((size_ >> numSourceMips_) >= 1) {
+            numSourceMips_++;
+        }
+
+        sourceMips_.assign(numSourceMips_ * 6, std::vector<float>());
+        for (int f = 0; f < 6; f++) {
+            sourceMips_[f] = faces[f];
+        }
+
+        for (int m = 1; m < numSourceMips_; m++) {
+            const int src = levelSize(m - 1);
+            const int dst = levelSize(m);
+            for (int f = 0; f < 6; f++) {
+                const float *in = sourceMips_[(m - 1) * 6 + f].data();
+                std::vector<float> &out = sourceMips_[m * 6 + f];
+                out.resize((size_t)dst * dst * 4);
+                for (int y = 0; y < dst; y++) {
+                    for (int x = 0; x < dst; x++) {
+                        const int x0 = std::min(2 * x, src - 1), x1 = std::min(2 * x + 1, src - 1);
+                        const int y0 = std::min(2 * y, src - 1), y1 = std::min(2 * y + 1, src - 1);
+                        Float4 sum;
+                        sum.madd(Float4::load(&in[(y0 * src + x0) * 4]), 0.25f);
+                        sum.madd(Float4::load(&in[(y0 * src + x1) * 4]), 0.25f);
+                        sum.madd(Float4::load(&in[(y1 * src + x0) * 4]), 0.25f);
+                        sum.madd(Float4::load(&in[(y1 * src + x1) * 4]), 0.25f);
+                        sum.store(&out[(y * dst + x) * 4]);
+                    }
+                }
+            }
+        }
+    }
+
+    Float4 sampleBilinear(const glm::vec3 &dir, int mip) const {
+        int face;
+        float s, t;
+        directionToFace(dir, &face, &s, &t);
+
+        const int sz = levelSize(mip);
+        const float *texels = sourceMips_[mip * 6 + face].data();
+        const float u = std::min(std::max((s + 1.0f) * 0.5f * sz - 0.5f, 0.0f), (float)(sz - 1));
+        const float v = std::min(std::max((t + 1.0f) * 0.5f * sz - 0.5f, 0.0f), (float)(sz - 1));
+        const int x0 = (int)u, y0 = (int)v;
+        const int x1 = std::min(x0 + 1, sz - 1), y1 = std::min(y0 + 1, sz - 1);
+        const float fx = u - x0, fy = v - y0;
+
+        Float4 r;
+        r.madd(Float4::load(&texels[(y0 * sz + x0) * 4]), (1.0f - fx) * (1.0f - fy));
+        r.madd(Float4::load(&texels[(y0 * sz + x1) * 4]), fx * (1.0f - fy));
+        r.madd(Float4::load(&texels[(y1 * sz + x0) * 4]), (1.0f - fx) * fy);
+        r.madd(Float4::load(&texels[(y1 * sz + x1) * 4]), fx * fy);
+        return r;
+    }
+
+    Float4 sampleTrilinear(const glm::vec3 &dir, float mip) const {
+        const int m0 = (int)mip;
+        const int m1 = std::min(m0 + 1, numSourceMips_ - 1);
+        const float t = mip - m0;
+
+        Float4 r;
+        r.madd(sampleBilinear(dir, m0), 1.0f - t);
+        if (t > 0.0f) {
+            r.madd(sampleBilinear(dir, m1), t);
+        }
+        return r;
+    }
+
+    // GGX分布に従う重点的サンプリングで1つのミップレベルを計算する
+    void prefilterLevel(int level) {
+        struct Sample {
+            glm::vec3 L;  // 接空間での入射方向
+            float weight;
+            float mip;
+        };
+
+        const float roughness = (float)level / (float)(numLevels_ - 1);
+        const float alpha = roughness * roughness;
+        const float a2 = alpha * alpha;
+        const float PI = 3.14159265358979f;
+        const float texelSolidAngle = 4.0f * PI / (6.0f * size_ * size_);
+
+        // サンプル方向は法線に依存しないので事前に計算しておく (V = N = R を仮定)
+        std::vector<Sample> samples;
+        float weightSum = 0.0f;
+        for (int i = 0; i < sampleCount_; i++) {
+            const float u1 = (float)i / (float)sampleCount_;
+            const float u2 = radicalInverse(i);
+
+            const float phi = 2.0f * PI * u1;
+            const float cosTheta = std::sqrt((1.0f - u2) / (1.0f + (a2 - 1.0f) * u2));
+            const float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+            const glm::vec3 H(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+            const glm::vec3 L = 2.0f * cosTheta * H - glm::vec3(0.0f, 0.0f, 1.0f);
+            if (L.z <= 0.0f) {
+                continue;
+            }
+
+            // 確率密度から1サンプルが受け持つ立体角を求め, 参照するミップレベルを決める
+            const float t = cosTheta * cosTheta * (a2 - 1.0f) + 1.0f;
+            const float D = a2 / (PI * t * t);
+            const float pdf = D * 0.25f;
+            const float sampleSolidAngle = 1.0f / (sampleCount_ * pdf + 1.0e-6f);
+            const float mip = 0.5f * std::log2(sampleSolidAngle / texelSolidAngle);
+
+            Sample sample;
+            sample.L = L;
+            sample.weight = L.z;
+            sample.mip = std::min(std::max(mip, 0.0f), (float)(numSourceMips_ - 1));
+            samples.push_back(sample);
+            weightSum += L.z;
+        }
+
+        const int sz = levelSize(level);
+        for (int f = 0; f < 6; f++) {
+            levels_[level * 6 + f].resize((size_t)sz * sz * 4);
+        }
+
+        forEachRow(6 * sz, [&](int row) {
+            const int f = row / sz;
+            const int y = row % sz;
+            float *out = levels_[level * 6 + f].data();
+            for (int x = 0; x < sz; x++) {
+                const float s = 2.0f * (x + 0.5f) / sz - 1.0f;
+                const float t = 2.0f * (y + 0.5f) / sz - 1.0f;
+                const glm::vec3 N = glm::normalize(faceDirection(f, s, t));
+                const glm::vec3 up = std::abs(N.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+                const glm::vec3 T = glm::normalize(glm::cross(up, N));
+                const glm::vec3 B = glm::cross(N, T);
+
+                Float4 sum;
+                for (size_t i = 0; i < samples.size(); i++) {
+                    const Sample &smp = samples[i];
+                    const glm::vec3 L = T * smp.L.x + B * smp.L.y + N * smp.L.z;
+                    sum.madd(sampleTrilinear(L, smp.mip), smp.weight);
+                }
+
+                (sum * (1.0f / weightSum)).store(&out[(y * sz + x) * 4]);
+            }
+        });
+    }
+
+    // 入力のキューブマップを球面調和関数に射影し, 放射照度の係数に変換する
+    void computeSH() {
+        // 行ごとに部分和を取ってから足す (スレッドの数や割り当てによらず同じ結果になる)
+        const int numRows = 6 * size_;
+        std::vector<float> partial(numRows * 27, 0.0f);
+
+        forEachRow(numRows, [&](int row) {
+            const int f = row / size_;
+            const int y = row % size_;
+            const float *texels = sourceMips_[f].data();
+            float *acc = &partial[row * 27];
+            for (int x = 0; x < size_; x++) {
+                const float s = 2.0f * (x + 0.5f) / size_ - 1.0f;
+                const float t = 2.0f * (y + 0.5f) / size_ - 1.0f;
+                const glm::vec3 d = faceDirection(f, s, t);
+                const float len2 = glm::dot(d, d);
+
+                // 1画素が占める立体角
+                const float dw = (4.0f / (size_ * size_)) / (len2 * std::sqrt(len2));
+                const glm::vec3 n = d / std::sqrt(len2);
+
+                float Y[9];
+                evalSH(n, Y);
+                for (int i = 0; i < 9; i++) {
+                    for (int c = 0; c < 3; c++) {
+                        acc[i * 3 + c] += texels[(y * size_ + x) * 4 + c] * Y[i] * dw;
+                    }
+                }
+            }
+        });
+
+        // Ramamoorthi and Hanrahan 2001 によるコサインローブとの畳み込み
+        const float PI = 3.14159265358979f;
+        const float A[9] = { PI,
+                             2.0f * PI / 3.0f, 2.0f * PI / 3.0f, 2.0f * PI / 3.0f,
+                             PI / 4.0f, PI / 4.0f, PI / 4.0f, PI / 4.0f, PI / 4.0f };
+        for (int i = 0; i < 27; i++) {
+            shCoeffs_[i] = 0.0f;
+            for (int row = 0; row < numRows; row++) {
+                shCoeffs_[i] += partial[row * 27 + i];
+            }
+            shCoeffs_[i] *= A[i / 3];
+        }
+    }
+
+    static void evalSH(const glm::vec3 &n, float Y[9]) {
+        Y[0] = 0.282095f;
+        Y[1] = 0.488603f * n.y;
+        Y[2] = 0.488603f * n.z;
+        Y[3] = 0.488603f * n.x;
+        Y[4] = 1.092548f * n.x * n.y;
+        Y[5] = 1.092548f * n.y * n.z;
+        Y[6] = 0.315392f * (3.0f * n.z * n.z - 1.0f);
+        Y[7] = 1.092548f * n.x * n.z;
+        Y[8] = 0.546274f * (n.x * n.x - n.y * n.y);
+    }
+
+    // Hammersley点列のための基数2の逆順
+    static float radicalInverse(uint32_t bits) {
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        return (float)bits * 2.3283064365386963e-10f;
+    }
+
+    int size_, numLevels_, sampleCount_;
+    int numSourceMips_;
+    std::vector<std::vector<float>> levels_;
+    std::vector<std::vector<float>> sourceMips_;
+    JobSystem *jobs_;   // compute() の間だけ使う
+    float shCoeffs_[27];
+};
+
+#endif  // _ENVMAP_PREFILTER_H_
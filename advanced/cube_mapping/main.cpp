@@ -1,9 +1,16 @@
 #include <cmath>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <vector>
+#include <chrono>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
 
 #define GLAD_GL_IMPLEMENTATION
 #include <glad/gl.h>
@@ -24,6 +31,11 @@
 
 // ディレクトリの設定ファイル
 #include "common.h"
+#include "envmap_prefilter.h"
+#include <glutils/shader_builder.h>
+#include <glutils/shader_program.h>
+#include <glutils/fixed_timestep.h>
+#include <glutils/job_system.h>
 
 static int WIN_WIDTH   = 500;                       // ウィンドウの幅
 static int WIN_HEIGHT  = 500;                       // ウィンドウの高さ
@@ -44,6 +56,11 @@ static const std::string BIG_CUBE_FILE = std::string(DATA_DIRECTORY) + "cube.obj
 // キューブマップのテクスチャ
 static const std::string CUBEMAP_FILE = std::string(DATA_DIRECTORY) + "stpeters_cross.hdr";
 
+// 前処理した環境マップのキャッシュ
+static const std::string PREFILTER_CACHE_FILE = CUBEMAP_FILE + ".prefiltered";
+static const int PREFILTER_LEVELS = 6;
+static const int PREFILTER_SAMPLES = 128;
+
 // 頂点番号配列の大きさ
 static size_t objectIboSize = 0;
 static size_t bkgIboSize = 0;
@@ -68,14 +85,30 @@ GLuint indexBufferId;
 // シェーダを参照する番号
 GLuint renderProgId;
 GLuint bkgProgId;
+ShaderProgram renderProgram;
+ShaderProgram bkgProgram;
 
 // 立方体の回転角度
 static float theta = 0.0f;
+static float prevTheta = 0.0f;
+
+// アニメーションは描画の速さによらず, 1秒に60回の一定の間隔で進める
+FixedTimestep timestep(1.0 / 60.0);
 
 // シェーディングのための情報
 static const glm::vec3 lightPos = glm::vec3(5.0f, 5.0f, 5.0f);
 GLuint textureId;
 
+// キューブマップの面の切り出しと前処理で共有するワーカスレッド
+JobSystem jobs;
+
+// 材質 (粗さに応じたミップレベルの鏡面反射と, 球面調和関数による拡散反射)
+static const float roughness = 0.25f;
+static const glm::vec3 diffColor = glm::vec3(0.3f, 0.3f, 0.3f);
+static const glm::vec3 specColor = glm::vec3(0.7f, 0.7f, 0.7f);
+static float maxLevel = 0.0f;
+static glm::vec3 shCoeffs[9];
+
 // VAOの作成
 GLuint prepareVAO(const std::string &objFile, size_t *iboSize) {
     // モデルのロード
@@ -159,107 +192,61 @@ void initVAO() {
     bkgVaoId = prepareVAO(BIG_CUBE_FILE, &bkgIboSize);
 }
 
-GLuint compileShader(const std::string &filename, GLuint type) {
-    // シェーダの作成
-    GLuint shaderId = glCreateShader(type);
-    
-    // ファイルの読み込み
-    std::ifstream reader;
-    size_t codeSize;
-    std::string code;
-
-    // ファイルを開く
-    reader.open(filename.c_str(), std::ios::in);
-    if (!reader.is_open()) {
-        // ファイルを開けなかったらエラーを出して終了
-        fprintf(stderr, "Failed to load vertex shader: %s\n", filename.c_str());
-        exit(1);
-    }
+// シェーダの初期化
+void initShaders() {
+    // 2つのプログラムをまとめて (並列に) ビルドする
+    ShaderProgramBatch batch(glfwGetProcAddress);
+    const int renderShader = batch.add(RENDER_VSHADER_FILE, RENDER_FSHADER_FILE);
+    const int bkgShader = batch.add(BKG_VSHADER_FILE, BKG_FSHADER_FILE);
+    batch.build();
+
+    renderProgId = batch.program(renderShader);
+    bkgProgId = batch.program(bkgShader);
+
+    // Uniform変数の位置を列挙しておく
+    renderProgram.reflect(renderProgId);
+    bkgProgram.reflect(bkgProgId);
+}
 
-    // ファイルをすべて読んで変数に格納 (やや難)
-    reader.seekg(0, std::ios::end);             // ファイル読み取り位置を終端に移動 
-    codeSize = reader.tellg();                  // 現在の箇所(=終端)の位置がファイルサイズ
-    code.resize(codeSize);                      // コードを格納する変数の大きさを設定
-    reader.seekg(0);                            // ファイルの読み取り位置を戦闘に移動
-    reader.read(&code[0], codeSize);            // 先頭からファイルサイズ分を読んでコードの変数に格納
-
-    // ファイルを閉じる
-    reader.close();
-
-    // コードのコンパイル
-    GLint compileStatus;
-    const char *codeChars = code.c_str();
-    glShaderSource(shaderId, 1, &codeChars, NULL);
-    glCompileShader(shaderId);
-    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
-
-    if (compileStatus == GL_FALSE) {
-        // コンパイルが失敗したらエラーメッセージとソースコードを表示して終了
-        fprintf(stderr, "Failed to compile vertex shader!\n");
-
-        GLint logLength;
-        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &logLength);
-        if (logLength > 0) {
-            GLsizei length;
-            std::string errMsg;
-            errMsg.resize(logLength);
-            glGetShaderInfoLog(shaderId, logLength, &length, &errMsg[0]);
-
-            fprintf(stderr, "[ ERROR] %s\n", errMsg.c_str());
-            fprintf(stderr, "%s\n", code.c_str());
-        }
-        exit(1);
+// 1行分の画素を左右反転してコピーする (1画素 = RGBAの4つのfloat)
+void copyRowReversed(float *dst, const float *src, int width) {
+    for (int x = 0; x < width; x++) {
+#ifdef USE_SSE2
+        // 1画素がちょうど128ビットなので1回の読み書きで済む
+        _mm_storeu_ps(dst + x * 4, _mm_loadu_ps(src + (width - x - 1) * 4));
+#else
+        std::memcpy(dst + x * 4, src + (width - x - 1) * 4, sizeof(float) * 4);
+#endif
     }
-
-    return shaderId;
 }
 
-// シェーダのビルド
-GLuint buildShader(const std::string &vShaderFile, const std::string &fShaderFile) {
-    // シェーダの作成
-    GLuint vertShaderId = compileShader(vShaderFile, GL_VERTEX_SHADER);
-    GLuint fragShaderId = compileShader(fShaderFile, GL_FRAGMENT_SHADER);
-
-    // シェーダプログラムのリンク
-    GLuint programId = glCreateProgram();
-    glAttachShader(programId, vertShaderId);
-    glAttachShader(programId, fragShaderId);
-
-    GLint linkState;
-    glLinkProgram(programId);
-    glGetProgramiv(programId, GL_LINK_STATUS, &linkState);
-    if (linkState == GL_FALSE) {
-        // リンクに失敗したらエラーメッセージを表示して終了
-        fprintf(stderr, "Failed to link shaders!\n");
-
-        GLint logLength;
-        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &logLength);
-        if (logLength > 0) {
-            GLsizei length;
-            std::string errMsg;
-            errMsg.resize(logLength);
-            glGetProgramInfoLog(programId, logLength, &length, &errMsg[0]);
-
-            fprintf(stderr, "[ ERROR ] %s\n", errMsg.c_str());
+// 十字型に展開された画像から1つの面を切り出す
+// (startX, startY) が面の最初の画素で、deltaX, deltaY が走査の向き (+1 / -1)
+void extractCubeFace(float *face, const float *pixels, int texWidth,
+                     int faceWidth, int faceHeight, int startX, int startY, int deltaX, int deltaY) {
+    // 各行で最も左にある画素のx座標
+    const int left = deltaX > 0 ? startX : startX - (faceWidth - 1);
+    const size_t rowFloats = (size_t)faceWidth * 4;
+
+    for (int y = 0; y < faceHeight; y++) {
+        const int py = startY + y * deltaY;
+        const float *src = pixels + ((size_t)py * texWidth + left) * 4;
+        float *dst = face + (size_t)y * rowFloats;
+        if (deltaX > 0) {
+            // 画素が連続しているので行ごとまとめてコピー
+            std::memcpy(dst, src, rowFloats * sizeof(float));
+        } else {
+            copyRowReversed(dst, src, faceWidth);
         }
-        exit(1);
     }
-    glUseProgram(0);
-
-    return programId;
-}
-
-// シェーダの初期化
-void initShaders() {
-    renderProgId = buildShader(RENDER_VSHADER_FILE, RENDER_FSHADER_FILE);
-    bkgProgId = buildShader(BKG_VSHADER_FILE, BKG_FSHADER_FILE);
 }
 
 void initTexture() {
     // テクスチャの設定
     int texWidth, texHeight, channels;
-    unsigned char *bytes = stbi_load(CUBEMAP_FILE.c_str(), &texWidth, &texHeight, &channels, STBI_rgb_alpha);
-    if (!bytes) {
+    // HDR画像はガンマ補正や [0, 1] へのクランプをせず, 線形の放射輝度のまま読み込む
+    float *pixels = stbi_loadf(CUBEMAP_FILE.c_str(), &texWidth, &texHeight, &channels, STBI_rgb_alpha);
+    if (!pixels) {
         fprintf(stderr, "Failed to load image file: %s\n", CUBEMAP_FILE.c_str());
         exit(1);
     }
@@ -270,8 +257,6 @@ void initTexture() {
     glGenTextures(1, &textureId);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureId);
 
-    unsigned char *faceBytes = new unsigned char[faceWidth * faceHeight * 4];
-
     const int startX[6] = { faceWidth, 0, faceWidth, 2 * faceWidth, faceWidth, 2 * faceWidth - 1 };
     const int startY[6] = { 0, faceHeight, faceHeight, faceHeight, 2 * faceHeight, 4 * faceHeight - 1 };
     const int deltaX[6] = { 1, 1, 1, 1, 1, -1 };
@@ -280,20 +265,54 @@ void initTexture() {
                                 GL_TEXTURE_CUBE_MAP_POSITIVE_Z, GL_TEXTURE_CUBE_MAP_POSITIVE_X,
                                 GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z };
 
+    // 6つの面の切り出しを並列に行う (面の番号はGL_TEXTURE_CUBE_MAP_POSITIVE_Xからの差)
+    std::vector<float> faces[6];
     for (int i = 0; i < 6; i++) {
-        for (int y = 0; y < faceHeight; y++) {
-            for (int x = 0; x < faceWidth; x++) {
-                const int px = startX[i] + x * deltaX[i];
-                const int py = startY[i] + y * deltaY[i];
-                for (int c = 0; c < 4; c++) {
-                    faceBytes[(y * faceWidth + x) * 4 + c] = bytes[(py * texWidth + px) * 4 + c];
-                }
-            }
-        }        
-        glTexImage2D(targetFace[i], 0, GL_RGBA, faceWidth, faceHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, faceBytes);
+        faces[targetFace[i] - GL_TEXTURE_CUBE_MAP_POSITIVE_X].resize((size_t)faceWidth * faceHeight * 4);
+    }
+
+    jobs.parallelFor(6, 1, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            extractCubeFace(faces[targetFace[i] - GL_TEXTURE_CUBE_MAP_POSITIVE_X].data(), pixels, texWidth,
+                            faceWidth, faceHeight, startX[i], startY[i], deltaX[i], deltaY[i]);
+        }
+    });
+
+    // GGXで前処理したミップマップと放射照度の係数を計算する (キャッシュがあれば読み込む)
+    EnvmapPrefilter prefilter;
+    const uint64_t cacheKey = EnvmapPrefilter::cacheKey(faces, faceWidth, PREFILTER_LEVELS, PREFILTER_SAMPLES);
+    if (prefilter.load(PREFILTER_CACHE_FILE, cacheKey)) {
+        printf("Load prefiltered environment map: %s\n", PREFILTER_CACHE_FILE.c_str());
+    } else {
+        const auto start = std::chrono::steady_clock::now();
+        prefilter.compute(faces, faceWidth, PREFILTER_LEVELS, PREFILTER_SAMPLES, &jobs);
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Prefilter environment map: %.3f sec\n", elapsed);
+
+        if (!prefilter.save(PREFILTER_CACHE_FILE, cacheKey)) {
+            fprintf(stderr, "Failed to save prefiltered environment map: %s\n", PREFILTER_CACHE_FILE.c_str());
+        }
+    }
+
+    // テクスチャの転送はOpenGLのコンテキストを持つスレッドで行う
+    for (int level = 0; level < prefilter.numLevels(); level++) {
+        const int size = prefilter.levelSize(level);
+        for (int f = 0; f < 6; f++) {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, level, GL_RGBA16F, size, size, 0, GL_RGBA, GL_FLOAT,
+                         prefilter.face(level, f));
+        }
     }
 
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    maxLevel = (float)(prefilter.numLevels() - 1);
+    for (int i = 0; i < 9; i++) {
+        shCoeffs[i] = glm::vec3(prefilter.shCoeffs()[i * 3 + 0],
+                                prefilter.shCoeffs()[i * 3 + 1],
+                                prefilter.shCoeffs()[i * 3 + 2]);
+    }
+
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, prefilter.numLevels() - 1);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -301,8 +320,7 @@ void initTexture() {
 
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 
-    stbi_image_free(bytes);    
-    delete[] faceBytes;
+    stbi_image_free(pixels);
 }
 
 // OpenGLの初期化関数
@@ -310,6 +328,9 @@ void initializeGL() {
     // 深度テストの有効化
     glEnable(GL_DEPTH_TEST);
 
+    // キューブマップの面の境界をまたいだ補間を有効化
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
     // 背景色の設定 (黒)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
@@ -337,7 +358,8 @@ void paintGL() {
                                     glm::vec3(0.0f, 0.0f, 0.0f),   // 見ている先
                                     glm::vec3(0.0f, 1.0f, 0.0f));  // 視界の上方向
 
-    glm::mat4 modelMat = glm::rotate(theta, glm::vec3(0.0f, 1.0f, 0.0f)); 
+    const float renderTheta = timestep.lerp(prevTheta, theta);
+    glm::mat4 modelMat = glm::rotate(renderTheta, glm::vec3(0.0f, 1.0f, 0.0f)); 
 
     glm::mat4 mvMat = viewMat * modelMat;
     glm::mat4 mvpMat = projMat * viewMat * modelMat;
@@ -349,14 +371,11 @@ void paintGL() {
         glBindVertexArray(bkgVaoId);
         glUseProgram(bkgProgId);
         
-        GLuint uid;
-        uid = glGetUniformLocation(bkgProgId, "u_lightMat");
-        glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(lightMat));
+        bkgProgram.set("u_lightMat", lightMat);
 
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_CUBE_MAP, textureId);
-        uid = glGetUniformLocation(bkgProgId, "u_texture");
-        glUniform1i(uid, 0);
+        bkgProgram.set("u_texture", 0);
 
         glDrawElements(GL_TRIANGLES, bkgIboSize, GL_UNSIGNED_INT, 0);
 
@@ -376,19 +395,21 @@ void paintGL() {
         glUseProgram(renderProgId);
 
         // Uniform変数の転送
-        GLuint uid;
-        uid = glGetUniformLocation(renderProgId, "u_modelMat");
-        glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvMat));
-        uid = glGetUniformLocation(renderProgId, "u_mvpMat");
-        glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvpMat));
-        uid = glGetUniformLocation(renderProgId, "u_cameraPos");
-        glUniform3fv(uid, 1, glm::value_ptr(cameraPos));
+        renderProgram.set("u_modelMat", mvMat);
+        renderProgram.set("u_mvpMat", mvpMat);
+        renderProgram.set("u_cameraPos", cameraPos);
+
+        // 材質と環境光の転送
+        renderProgram.set("u_roughness", roughness);
+        renderProgram.set("u_maxLevel", maxLevel);
+        renderProgram.set("u_diffColor", diffColor);
+        renderProgram.set("u_specColor", specColor);
+        renderProgram.setArray("u_shCoeffs", &shCoeffs[0], 9);
 
         // テクスチャの有効化とシェーダへの転送
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_CUBE_MAP, textureId);
-        uid = glGetUniformLocation(renderProgId, "u_texture");
-        glUniform1i(uid, 0);
+        renderProgram.set("u_texture", 0);
 
         // 三角形の描画
         glDrawElements(GL_TRIANGLES, objectIboSize, GL_UNSIGNED_INT, 0);
@@ -423,6 +444,7 @@ void resizeGL(GLFWwindow *window, int width, int height) {
 
 // アニメーションのためのアップデート
 void animate() {
+    prevTheta = theta;
     theta += 2.0f * PI / 360.0f;  // 10分の1回転
 }
 
@@ -476,13 +498,17 @@ int main(int argc, char **argv) {
     initializeGL();
 
     // メインループ
+    timestep.reset(glfwGetTime());
     while (glfwWindowShouldClose(window) == GL_FALSE) {
+        // アニメーション (経過時間に応じて0回以上進める)
+        const int steps = timestep.advance(glfwGetTime());
+        for (int i = 0; i < steps; i++) {
+            animate();
+        }
+
         // 描画
         paintGL();
 
-        // アニメーション
-        animate();
-
         // 描画用バッファの切り替え
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -6,7 +6,13 @@ out vec4 out_color;
 
 uniform samplerCube u_texture;
 
+// 環境マップは線形のHDR放射輝度なので, トーンマッピングとガンマ補正をしてから出力する
+vec3 toDisplay(vec3 radiance) {
+    vec3 ldr = radiance / (1.0 + radiance);
+    return pow(ldr, vec3(1.0 / 2.2));
+}
+
 void main(void) {
     vec3 V = normalize(f_positionOnCube);
-    out_color = texture(u_texture, V);
+    out_color = vec4(toDisplay(textureLod(u_texture, V, 0.0).rgb), 1.0);
 }
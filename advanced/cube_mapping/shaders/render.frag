@@ -8,9 +8,44 @@ out vec4 out_color;
 
 uniform samplerCube u_texture;
 
+// マテリアルのデータ
+uniform vec3 u_diffColor;
+uniform vec3 u_specColor;
+uniform float u_roughness;
+
+// 前処理した環境マップの最大ミップレベル
+uniform float u_maxLevel;
+
+// 放射照度の球面調和関数の係数
+uniform vec3 u_shCoeffs[9];
+
+const float PI = 3.14159265358979;
+
+vec3 irradianceSH(vec3 n) {
+    return u_shCoeffs[0] * 0.282095
+         + u_shCoeffs[1] * 0.488603 * n.y
+         + u_shCoeffs[2] * 0.488603 * n.z
+         + u_shCoeffs[3] * 0.488603 * n.x
+         + u_shCoeffs[4] * 1.092548 * n.x * n.y
+         + u_shCoeffs[5] * 1.092548 * n.y * n.z
+         + u_shCoeffs[6] * 0.315392 * (3.0 * n.z * n.z - 1.0)
+         + u_shCoeffs[7] * 1.092548 * n.x * n.z
+         + u_shCoeffs[8] * 0.546274 * (n.x * n.x - n.y * n.y);
+}
+
+// 環境マップは線形のHDR放射輝度なので, トーンマッピングとガンマ補正をしてから出力する
+vec3 toDisplay(vec3 radiance) {
+    vec3 ldr = radiance / (1.0 + radiance);
+    return pow(ldr, vec3(1.0 / 2.2));
+}
+
 void main() {
     vec3 V = normalize(f_cameraPosWorldSpace - f_positionWorldSpace);
     vec3 N = normalize(f_normalWorldSpace);
     vec3 R = -V + 2.0 * N * dot(V, N);
-    out_color = texture(u_texture, R);
+
+    // 粗さに対応するミップレベルを1回参照するだけで光沢反射が得られる
+    vec3 specular = textureLod(u_texture, R, u_roughness * u_maxLevel).rgb;
+    vec3 diffuse = max(irradianceSH(N), vec3(0.0)) / PI;
+    out_color = vec4(toDisplay(u_diffColor * diffuse + u_specColor * specular), 1.0);
 }
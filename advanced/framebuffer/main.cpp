@@ -22,6 +22,9 @@
 
 // ディレクトリの設定ファイル
 #include "common.h"
+#include <glutils/shader_builder.h>
+#include <glutils/shader_program.h>
+#include <glutils/fixed_timestep.h>
 
 static int WIN_WIDTH   = 500;                       // ウィンドウの幅
 static int WIN_HEIGHT  = 500;                       // ウィンドウの高さ
@@ -97,11 +100,16 @@ struct PlaneVao {
 
 // シェーダを参照する番号
 GLuint programId;
+ShaderProgram program;
 
 // 立法体の回転角度
 static float theta = 0.0f;
+static float prevTheta = 0.0f;
 static float phi = 0.0f;
 
+// アニメーションは描画の速さによらず, 1秒に60回の一定の間隔で進める
+FixedTimestep timestep(1.0 / 60.0);
+
 // VAOの初期化
 void initVAO() {
     // 針のVAO
@@ -236,107 +244,11 @@ void initVAO() {
     }
 }
 
-GLuint compileShader(const std::string &filename, GLuint type) {
-    // シェーダの作成
-    GLuint shaderId = glCreateShader(type);
-    
-    // ファイルの読み込み
-    std::ifstream reader;
-    size_t codeSize;
-    std::string code;
-
-    // ファイルを開く
-    reader.open(filename.c_str(), std::ios::in);
-    if (!reader.is_open()) {
-        // ファイルを開けなかったらエラーを出して終了
-        fprintf(stderr, "Failed to load a shader: %s\n", VERT_SHADER_FILE.c_str());
-        exit(1);
-    }
-
-    // ファイルをすべて読んで変数に格納 (やや難)
-    reader.seekg(0, std::ios::end);             // ファイル読み取り位置を終端に移動 
-    codeSize = reader.tellg();                  // 現在の箇所(=終端)の位置がファイルサイズ
-    code.resize(codeSize);                      // コードを格納する変数の大きさを設定
-    reader.seekg(0);                            // ファイルの読み取り位置を先頭に移動
-    reader.read(&code[0], codeSize);            // 先頭からファイルサイズ分を読んでコードの変数に格納
-
-    // ファイルを閉じる
-    reader.close();
-
-    // コードのコンパイル
-    const char *codeChars = code.c_str();
-    glShaderSource(shaderId, 1, &codeChars, NULL);
-    glCompileShader(shaderId);
-
-    // コンパイルの成否を判定する
-    GLint compileStatus;
-    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
-    if (compileStatus == GL_FALSE) {
-        // コンパイルが失敗したらエラーメッセージとソースコードを表示して終了
-        fprintf(stderr, "Failed to compile a shader!\n");
-
-        // エラーメッセージの長さを取得する
-        GLint logLength;
-        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &logLength);
-        if (logLength > 0) {
-            // エラーメッセージを取得する
-            GLsizei length;
-            std::string errMsg;
-            errMsg.resize(logLength);
-            glGetShaderInfoLog(shaderId, logLength, &length, &errMsg[0]);
-
-            // エラーメッセージとソースコードの出力
-            fprintf(stderr, "[ ERROR ] %s\n", errMsg.c_str());
-            fprintf(stderr, "%s\n", code.c_str());
-        }
-        exit(1);
-    }
-
-    return shaderId;
-}
-
-GLuint buildShaderProgram(const std::string &vShaderFile, const std::string &fShaderFile) {
-    // シェーダの作成
-    GLuint vertShaderId = compileShader(vShaderFile, GL_VERTEX_SHADER);
-    GLuint fragShaderId = compileShader(fShaderFile, GL_FRAGMENT_SHADER);
-    
-    // シェーダプログラムのリンク
-    GLuint programId = glCreateProgram();
-    glAttachShader(programId, vertShaderId);
-    glAttachShader(programId, fragShaderId);
-    glLinkProgram(programId);
-    
-    // リンクの成否を判定する
-    GLint linkState;
-    glGetProgramiv(programId, GL_LINK_STATUS, &linkState);
-    if (linkState == GL_FALSE) {
-        // リンクに失敗したらエラーメッセージを表示して終了
-        fprintf(stderr, "Failed to link shaders!\n");
-
-        // エラーメッセージの長さを取得する
-        GLint logLength;
-        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &logLength);
-        if (logLength > 0) {
-            // エラーメッセージを取得する
-            GLsizei length;
-            std::string errMsg;
-            errMsg.resize(logLength);
-            glGetProgramInfoLog(programId, logLength, &length, &errMsg[0]);
-
-            // エラーメッセージを出力する
-            fprintf(stderr, "[ ERROR ] %s\n", errMsg.c_str());
-        }
-        exit(1);
-    }
-    
-    // シェーダを無効化した後にIDを返す
-    glUseProgram(0);
-    return programId;
-}
-
 // シェーダの初期化
 void initShaders() {
     programId = buildShaderProgram(VERT_SHADER_FILE, FRAG_SHADER_FILE);
+    // Uniform変数の位置を列挙しておく
+    program.reflect(programId);
 }
 
 // テクスチャの初期化
@@ -442,16 +354,12 @@ void paintGL() {
         // Uniform変数の転送
         glm::mat4 mvpMat(1.0f);
 
-        GLuint uid;
-        uid = glGetUniformLocation(programId, "u_mvpMat");
-        glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvpMat));
+        program.set("u_mvpMat", mvpMat);
 
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, textureId);
-        uid = glGetUniformLocation(programId, "u_texture");
-        glUniform1i(uid, 0);
-        uid = glGetUniformLocation(programId, "u_useTexture");
-        glUniform1i(uid, 1);
+        program.set("u_texture", 0);
+        program.set("u_useTexture", 1);
 
         // VAOの有効化
         glBindVertexArray(planeVao.vaoId);
@@ -479,13 +387,9 @@ void paintGL() {
         mvpMat = glm::rotate(mvpMat, rot, glm::vec3(0.0f, 0.0f, 1.0f));
         mvpMat = glm::scale(mvpMat, glm::vec3(0.5f, 0.6f, 1.0f));
 
-        GLuint uid;
-        uid = glGetUniformLocation(programId, "u_mvpMat");
-        glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvpMat));
-        uid = glGetUniformLocation(programId, "u_useTexture");
-        glUniform1i(uid, 0);
-        uid = glGetUniformLocation(programId, "u_needleColor");
-        glUniform3f(uid, 0.0f, 0.5f, 1.0f);
+        program.set("u_mvpMat", mvpMat);
+        program.set("u_useTexture", 0);
+        program.set("u_needleColor", glm::vec3(0.0f, 0.5f, 1.0f));
     
         // VAOの有効化
         glBindVertexArray(needleVao.vaoId);
@@ -513,13 +417,9 @@ void paintGL() {
         mvpMat =glm::rotate(mvpMat, rot, glm::vec3(0.0f, 0.0f, 1.0f));        
         mvpMat = glm::scale(mvpMat, glm::vec3(0.5f, 0.9f, 1.0f));
 
-        GLuint uid;
-        uid = glGetUniformLocation(programId, "u_mvpMat");
-        glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvpMat));
-        uid = glGetUniformLocation(programId, "u_useTexture");
-        glUniform1i(uid, 0);
-        uid = glGetUniformLocation(programId, "u_needleColor");
-        glUniform3f(uid, 0.0f, 0.0f, 1.0f);
+        program.set("u_mvpMat", mvpMat);
+        program.set("u_useTexture", 0);
+        program.set("u_needleColor", glm::vec3(0.0f, 0.0f, 1.0f));
     
         // VAOの有効化
         glBindVertexArray(needleVao.vaoId);
@@ -546,13 +446,9 @@ void paintGL() {
         mvpMat = glm::rotate(mvpMat, rot, glm::vec3(0.0f, 0.0f, 1.0f));
         mvpMat = glm::scale(mvpMat, glm::vec3(0.2f, 0.9f, 1.0f));
 
-        GLuint uid;
-        uid = glGetUniformLocation(programId, "u_mvpMat");
-        glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvpMat));
-        uid = glGetUniformLocation(programId, "u_useTexture");
-        glUniform1i(uid, 0);
-        uid = glGetUniformLocation(programId, "u_needleColor");
-        glUniform3f(uid, 0.0f, 0.8f, 1.0f);
+        program.set("u_mvpMat", mvpMat);
+        program.set("u_useTexture", 0);
+        program.set("u_needleColor", glm::vec3(0.0f, 0.8f, 1.0f));
     
         // VAOの有効化
         glBindVertexArray(needleVao.vaoId);
@@ -589,20 +485,17 @@ void paintGL() {
                                         glm::vec3(0.0f, 1.0f, 0.0f));  // 視界の上方向
 
         glm::mat4 modelMat(1.0f);
-        modelMat = glm::rotate(modelMat, theta, glm::vec3(0.0f, 1.0f, 0.0f)); 
-        modelMat = glm::rotate(modelMat, theta * 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
+        const float renderTheta = timestep.lerp(prevTheta, theta);
+        modelMat = glm::rotate(modelMat, renderTheta, glm::vec3(0.0f, 1.0f, 0.0f)); 
+        modelMat = glm::rotate(modelMat, renderTheta * 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
         
         glm::mat4 mvpMat = projMat * viewMat * modelMat;
 
-        GLuint uid;
-        uid = glGetUniformLocation(programId, "u_mvpMat");
-        glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvpMat));
+        program.set("u_mvpMat", mvpMat);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, colorTextureId);
-        uid = glGetUniformLocation(programId, "u_texture");
-        glUniform1i(uid, 0);
-        uid = glGetUniformLocation(programId, "u_useTexture");
-        glUniform1i(uid, 1);
+        program.set("u_texture", 0);
+        program.set("u_useTexture", 1);
     
         // VAOの有効化
         glBindVertexArray(cubeVao.vaoId);
@@ -636,6 +529,7 @@ void resizeGL(GLFWwindow *window, int width, int height) {
 
 // アニメーションのためのアップデート
 void animate() {
+    prevTheta = theta;
     theta += 2.0f * PI / 360.0f;  // 10分の1回転
     phi += 1.0f * PI / 360.0f;
 }
@@ -681,13 +575,17 @@ int main(int argc, char **argv) {
     initializeGL();
 
     // メインループ
+    timestep.reset(glfwGetTime());
     while (glfwWindowShouldClose(window) == GL_FALSE) {
+        // アニメーション (経過時間に応じて0回以上進める)
+        const int steps = timestep.advance(glfwGetTime());
+        for (int i = 0; i < steps; i++) {
+            animate();
+        }
+
         // 描画
         paintGL();
 
-        // アニメーション
-        animate();
-
         // 描画用バッファの切り替え
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -21,6 +21,10 @@
 
 // ディレクトリの設定ファイル
 #include "common.h"
+#include <glutils/shader_builder.h>
+#include <glutils/shader_program.h>
+#include <glutils/uniform_buffer.h>
+#include <glutils/fixed_timestep.h>
 
 static int WIN_WIDTH   = 500;                       // ウィンドウの幅
 static int WIN_HEIGHT  = 500;                       // ウィンドウの高さ
@@ -57,17 +61,25 @@ GLuint indexBufferId;
 GLuint vertShaderId;
 GLuint fragShaderId;
 GLuint programId;
+ShaderProgram program;
+
+// Uniformバッファ (フレームごとのカメラと光源の情報と, 物体の材質)
+UniformBuffer<FrameBlock> frameBuffer;
+UniformBuffer<MaterialBlock> materialBuffer;
 
 // 立方体の回転角度
 static float theta = 0.0f;
+static float prevTheta = 0.0f;
+
+// アニメーションは描画の速さによらず, 1秒に60回の一定の間隔で進める
+FixedTimestep timestep(1.0 / 60.0);
 
-// シェーディングのための情報
-// Gold (参照: http://www.barradeau.com/nicoptere/dump/materials.html)
+// シェーディングのための情報 (寒色と暖色はシェーダの中で決めている)
 static const glm::vec3 lightPos = glm::vec3(5.0f, 5.0f, 5.0f);
-static const glm::vec3 diffColor = glm::vec3(0.75164f, 0.60648f, 0.22648f);
-static const glm::vec3 specColor = glm::vec3(0.628281f, 0.555802f, 0.366065f);
-static const glm::vec3 ambiColor = glm::vec3(0.24725f, 0.1995f, 0.0745f);
-static const float shininess = 51.2f;
+static const glm::vec3 diffColor = glm::vec3(0.8f, 0.2f, 0.2f);
+static const glm::vec3 specColor = glm::vec3(0.2f, 0.2f, 0.2f);
+static const glm::vec3 ambiColor = glm::vec3(0.5f, 0.5f, 0.5f);
+static const float shininess = 64.0f;
 
 // VAOの初期化
 void initVAO() {
@@ -143,107 +155,25 @@ void initVAO() {
     glBindVertexArray(0);
 }
 
-GLuint compileShader(const std::string &filename, GLuint type) {
-    // シェーダの作成
-    GLuint shaderId = glCreateShader(type);
-    
-    // ファイルの読み込み
-    std::ifstream reader;
-    size_t codeSize;
-    std::string code;
-
-    // ファイルを開く
-    reader.open(filename.c_str(), std::ios::in);
-    if (!reader.is_open()) {
-        // ファイルを開けなかったらエラーを出して終了
-        fprintf(stderr, "Failed to load a shader: %s\n", filename.c_str());
-        exit(1);
-    }
+// シェーダの初期化
+void initShaders() {
+    programId = buildShaderProgram(SHADER_NAME + ".vert", SHADER_NAME + ".frag");
 
-    // ファイルをすべて読んで変数に格納 (やや難)
-    reader.seekg(0, std::ios::end);             // ファイル読み取り位置を終端に移動 
-    codeSize = reader.tellg();                  // 現在の箇所(=終端)の位置がファイルサイズ
-    code.resize(codeSize);                      // コードを格納する変数の大きさを設定
-    reader.seekg(0);                            // ファイルの読み取り位置を先頭に移動
-    reader.read(&code[0], codeSize);            // 先頭からファイルサイズ分を読んでコードの変数に格納
-
-    // ファイルを閉じる
-    reader.close();
-
-    // コードのコンパイル
-    const char *codeChars = code.c_str();
-    glShaderSource(shaderId, 1, &codeChars, NULL);
-    glCompileShader(shaderId);
-
-    // コンパイルの成否を判定する
-    GLint compileStatus;
-    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
-    if (compileStatus == GL_FALSE) {
-        // コンパイルが失敗したらエラーメッセージとソースコードを表示して終了
-        fprintf(stderr, "Failed to compile a shader!\n");
-
-        // エラーメッセージの長さを取得する
-        GLint logLength;
-        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &logLength);
-        if (logLength > 0) {
-            // エラーメッセージを取得する
-            GLsizei length;
-            std::string errMsg;
-            errMsg.resize(logLength);
-            glGetShaderInfoLog(shaderId, logLength, &length, &errMsg[0]);
-
-            // エラーメッセージとソースコードの出力
-            fprintf(stderr, "[ ERROR ] %s\n", errMsg.c_str());
-            fprintf(stderr, "%s\n", code.c_str());
-        }
-        exit(1);
-    }
+    // Uniform変数の位置を列挙しておく
+    program.reflect(programId);
 
-    return shaderId;
+    // Uniformブロックの結合点を設定する
+    program.bindUniformBlock("FrameBlock", FRAME_BLOCK_BINDING);
+    program.bindUniformBlock("MaterialBlock", MATERIAL_BLOCK_BINDING);
 }
 
-GLuint buildShaderProgram(const std::string &shaderName) {
-    // シェーダの作成
-    GLuint vertShaderId = compileShader(shaderName + ".vert", GL_VERTEX_SHADER);
-    GLuint fragShaderId = compileShader(shaderName + ".frag", GL_FRAGMENT_SHADER);
-    
-    // シェーダプログラムのリンク
-    GLuint programId = glCreateProgram();
-    glAttachShader(programId, vertShaderId);
-    glAttachShader(programId, fragShaderId);
-    glLinkProgram(programId);
-    
-    // リンクの成否を判定する
-    GLint linkState;
-    glGetProgramiv(programId, GL_LINK_STATUS, &linkState);
-    if (linkState == GL_FALSE) {
-        // リンクに失敗したらエラーメッセージを表示して終了
-        fprintf(stderr, "Failed to link shaders!\n");
-
-        // エラーメッセージの長さを取得する
-        GLint logLength;
-        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &logLength);
-        if (logLength > 0) {
-            // エラーメッセージを取得する
-            GLsizei length;
-            std::string errMsg;
-            errMsg.resize(logLength);
-            glGetProgramInfoLog(programId, logLength, &length, &errMsg[0]);
-
-            // エラーメッセージを出力する
-            fprintf(stderr, "[ ERROR ] %s\n", errMsg.c_str());
-        }
-        exit(1);
-    }
-    
-    // シェーダを無効化した後にIDを返す
-    glUseProgram(0);
-    return programId;
-}
+// Uniformバッファの初期化
+void initUniformBuffers() {
+    frameBuffer.create();
 
-// シェーダの初期化
-void initShaders() {
-    programId = buildShaderProgram(SHADER_NAME);
+    // 材質は変わらないので最初に1回だけ転送する
+    materialBuffer.create();
+    materialBuffer.update(MaterialBlock(ambiColor, diffColor, specColor, shininess));
 }
 
 // OpenGLの初期化関数
@@ -259,6 +189,9 @@ void initializeGL() {
 
     // シェーダの用意
     initShaders();
+
+    // Uniformバッファの用意
+    initUniformBuffers();
 }
 
 // OpenGLの描画関数
@@ -274,12 +207,11 @@ void paintGL() {
                                     glm::vec3(0.0f, 0.0f, 0.0f),   // 見ている先
                                     glm::vec3(0.0f, 1.0f, 0.0f));  // 視界の上方向
 
-    glm::mat4 modelMat = glm::rotate(glm::radians(theta), glm::vec3(0.0f, 1.0f, 0.0f));
+    const float renderTheta = timestep.lerp(prevTheta, theta);
+    glm::mat4 modelMat = glm::rotate(glm::radians(renderTheta), glm::vec3(0.0f, 1.0f, 0.0f));
 
     glm::mat4 mvMat = viewMat * modelMat;
-    glm::mat4 mvpMat = projMat * viewMat * modelMat;
     glm::mat4 normMat = glm::transpose(glm::inverse(mvMat));
-    glm::mat4 lightMat = viewMat;
 
     // VAOの有効化
     glBindVertexArray(vaoId);
@@ -287,27 +219,18 @@ void paintGL() {
     // シェーダの有効化
     glUseProgram(programId);
 
-    // Uniform変数の転送
-    GLuint uid;
-    uid = glGetUniformLocation(programId, "u_mvMat");
-    glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvMat));
-    uid = glGetUniformLocation(programId, "u_mvpMat");
-    glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvpMat));
-    uid = glGetUniformLocation(programId, "u_normMat");
-    glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(normMat));
-    uid = glGetUniformLocation(programId, "u_lightMat");
-    glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(lightMat));
-
-    uid = glGetUniformLocation(programId, "u_lightPos");
-    glUniform3fv(uid, 1, glm::value_ptr(lightPos));
-    uid = glGetUniformLocation(programId, "u_diffColor");
-    glUniform3fv(uid, 1, glm::value_ptr(diffColor));
-    uid = glGetUniformLocation(programId, "u_specColor");
-    glUniform3fv(uid, 1, glm::value_ptr(specColor));
-    uid = glGetUniformLocation(programId, "u_ambiColor");
-    glUniform3fv(uid, 1, glm::value_ptr(ambiColor));
-    uid = glGetUniformLocation(programId, "u_shininess");
-    glUniform1f(uid, shininess);
+    // カメラと光源の情報はフレームごとに1回だけ転送する
+    FrameBlock frame;
+    frame.viewMat = viewMat;
+    frame.projMat = projMat;
+    frame.lightPos = glm::vec4(lightPos, 1.0f);
+    frameBuffer.update(frame);
+    frameBuffer.bind(FRAME_BLOCK_BINDING);
+    materialBuffer.bind(MATERIAL_BLOCK_BINDING);
+
+    // 物体ごとの変換行列だけを転送する
+    program.set("u_modelMat", modelMat);
+    program.set("u_normMat", normMat);
 
     // 三角形の描画
     glDrawElements(GL_TRIANGLES, indexBufferSize, GL_UNSIGNED_INT, 0);
@@ -337,6 +260,7 @@ void resizeGL(GLFWwindow *window, int width, int height) {
 
 // アニメーションのためのアップデート
 void animate() {
+    prevTheta = theta;
     theta += 1.0f;  // 1度だけ回転
 }
 
@@ -381,13 +305,17 @@ int main(int argc, char **argv) {
     initializeGL();
 
     // メインループ
+    timestep.reset(glfwGetTime());
     while (glfwWindowShouldClose(window) == GL_FALSE) {
+        // アニメーション (経過時間に応じて0回以上進める)
+        const int steps = timestep.advance(glfwGetTime());
+        for (int i = 0; i < steps; i++) {
+            animate();
+        }
+
         // 描画
         paintGL();
 
-        // アニメーション
-        animate();
-
         // 描画用バッファの切り替え
         glfwSwapBuffers(window);
         glfwPollEvents();
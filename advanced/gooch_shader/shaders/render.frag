@@ -18,10 +18,12 @@ const vec4 k_cool = k_blue + alpha * k_diff;
 const vec4 k_warm = k_yell + beta * k_diff;
 
 // Material info
-const vec4 ambMaterial = vec4(0.5, 0.5, 0.5, 1.0);
-const vec4 diffMaterial = vec4(0.8, 0.2, 0.2, 1.0);
-const vec4 specMaterial = vec4(0.2, 0.2, 0.2, 1.0);
-const float shinMaterial = 64.0;
+layout(std140) uniform MaterialBlock {
+    vec3 u_ambiColor;
+    vec3 u_diffColor;
+    vec3 u_specColor;
+    float u_shininess;
+};
 
 // uniform variables
 uniform float lightStrength = 0.2;
@@ -40,19 +42,19 @@ void main() {
 	vec4 warmColor = (1.0 + LdotN) * 0.5 * k_warm;
 
 	// ambient
-	vec4 ambient = ambMaterial * lightStrength;
+	vec4 ambient = vec4(u_ambiColor, 1.0) * lightStrength;
 
 	// diffuse
 	float NdotL = dot(N, L);
-	vec4 diffuse = vec4(max(0.0, NdotL)) * lightStrength * diffMaterial;
+	vec4 diffuse = vec4(max(0.0, NdotL)) * lightStrength * vec4(u_diffColor, 1.0);
 
 	// specular
 	float NdotH = dot(N, H);
-	float spec = pow(max(0.0, NdotH), shinMaterial);
+	float spec = pow(max(0.0, NdotH), u_shininess);
 	if (NdotL <= 0.0) {
 		spec = 0.0;
 	}
-	vec4 specular = spec * specMaterial;
+	vec4 specular = spec * vec4(u_specColor, 1.0);
 	vec4 shading = ambient + diffuse + specular;
 	vec4 npr = coolColor + warmColor;
 	out_color = shading + npr;
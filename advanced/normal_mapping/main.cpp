@@ -0,0 +1,450 @@
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#define GLAD_GL_IMPLEMENTATION
+#include <glad/gl.h>
+
+#define GLFW_INCLUDE_GLU
+#include <GLFW/glfw3.h>
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// ディレクトリの設定ファイル
+#include "common.h"
+#include "tangent_space.h"
+#include <glutils/shader_builder.h>
+#include <glutils/shader_program.h>
+#include <glutils/fixed_timestep.h>
+#include <glutils/job_system.h>
+
+static int WIN_WIDTH   = 500;                       // ウィンドウの幅
+static int WIN_HEIGHT  = 500;                       // ウィンドウの高さ
+static const char *WIN_TITLE = "OpenGL Course";     // ウィンドウのタイトル
+
+static const double PI = 4.0 * std::atan(1.0);
+
+// シェーダファイル
+static const std::string VERT_SHADER_FILE = std::string(SHADER_DIRECTORY) + "render.vert";
+static const std::string FRAG_SHADER_FILE = std::string(SHADER_DIRECTORY) + "render.frag";
+
+// モデルとテクスチャのファイル (課題用のデータを使う)
+static const std::string ASSIGNMENT_DIRECTORY = std::string(SOURCE_DIRECTORY) + "../../data/assignments/normalmap/";
+static const std::string OBJECT_FILE = ASSIGNMENT_DIRECTORY + "teapot.obj";
+static const std::string DIFFUSE_TEX_FILE = ASSIGNMENT_DIRECTORY + "sweater_diff.png";
+static const std::string NORMAL_TEX_FILE = ASSIGNMENT_DIRECTORY + "sweater_normal.png";
+
+// 頂点番号配列の大きさ
+static size_t indexBufferSize = 0;
+
+// 頂点オブジェクト
+struct Vertex {
+    Vertex(const glm::vec3 &position_, const glm::vec3 &normal_, const glm::vec2 &texcoord_)
+        : position(position_)
+        , normal(normal_)
+        , texcoord(texcoord_)
+        , tangent(1.0f, 0.0f, 0.0f, 1.0f) {
+    }
+
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texcoord;
+    glm::vec4 tangent;  // xyzが接ベクトル, wが従法線の向き (±1)
+};
+
+// バッファを参照する番号
+GLuint vaoId;
+GLuint vertexBufferId;
+GLuint indexBufferId;
+
+// テクスチャを参照する番号
+GLuint diffuseTextureId;
+GLuint normalTextureId;
+
+// シェーダを参照する番号
+GLuint vertShaderId;
+GLuint fragShaderId;
+GLuint programId;
+ShaderProgram program;
+
+// 法線と接ベクトルの計算を分割して並列に進めるワーカスレッド
+JobSystem jobs;
+
+// 物体の回転角度
+static float theta = 0.0f;
+static float prevTheta = 0.0f;
+
+// アニメーションは描画の速さによらず, 1秒に60回の一定の間隔で進める
+FixedTimestep timestep(1.0 / 60.0);
+
+// 法線マップを使うかどうか (Nキーで切り替え)
+static bool useNormalMap = true;
+
+// シェーディングのための情報
+static const glm::vec3 lightPos = glm::vec3(5.0f, 5.0f, 5.0f);
+static const glm::vec3 specColor = glm::vec3(0.2f, 0.2f, 0.2f);
+static const glm::vec3 ambiColor = glm::vec3(0.1f, 0.1f, 0.1f);
+static const float shininess = 32.0f;
+
+// VAOの初期化
+void initVAO() {
+    // モデルのロード
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string err;
+    bool success = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, OBJECT_FILE.c_str());
+    if (!err.empty()) {
+        std::cerr << "[WARNING] " << err << std::endl;
+    }
+
+    if (!success) {
+        std::cerr << "Failed to load OBJ file: " << OBJECT_FILE << std::endl;
+        exit(1);
+    }
+
+    TangentSpace tangentSpace(&jobs);
+
+    // ファイルに法線がないので, 位置だけを共有するメッシュで滑らかな法線を計算する
+    // (uvの継ぎ目で法線が分かれないようにするため)
+    std::vector<glm::vec3> objPositions(attrib.vertices.size() / 3);
+    std::vector<unsigned int> objIndices;
+    for (size_t i = 0; i < objPositions.size(); i++) {
+        objPositions[i] = glm::vec3(attrib.vertices[i * 3 + 0],
+                                    attrib.vertices[i * 3 + 1],
+                                    attrib.vertices[i * 3 + 2]);
+    }
+
+    for (size_t s = 0; s < shapes.size(); s++) {
+        const tinyobj::mesh_t &mesh = shapes[s].mesh;
+        for (size_t i = 0; i < mesh.indices.size(); i++) {
+            objIndices.push_back(mesh.indices[i].vertex_index);
+        }
+    }
+
+    std::vector<glm::vec3> objNormals;
+    tangentSpace.computeNormals(objPositions, objIndices, &objNormals);
+
+    // 位置とuvとuvの向き (鏡映されているか) の組が同じ頂点を1つにまとめる (溶接)
+    // MikkTSpaceと同じく, uvの向きが逆の三角形どうしは頂点を共有させずに, 従法線の向きが平均されないようにする
+    typedef std::tuple<int, int, int> WeldKey;
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    std::map<WeldKey, unsigned int> vertexTable;
+    for (size_t s = 0; s < shapes.size(); s++) {
+        const tinyobj::mesh_t &mesh = shapes[s].mesh;
+        for (size_t f = 0; f + 2 < mesh.indices.size(); f += 3) {
+            // 法線マップの緑成分がvの増える方向なので, vは反転しない
+            glm::vec2 texcoords[3];
+            for (int c = 0; c < 3; c++) {
+                const int t = mesh.indices[f + c].texcoord_index;
+                if (t >= 0) {
+                    texcoords[c] = glm::vec2(attrib.texcoords[t * 2 + 0], attrib.texcoords[t * 2 + 1]);
+                }
+            }
+
+            // uvの面積の符号 (TangentSpace::computeTangents() と同じ判定)
+            const glm::vec2 d1 = texcoords[1] - texcoords[0];
+            const glm::vec2 d2 = texcoords[2] - texcoords[0];
+            const int mirrored = d1.x * d2.y - d2.x * d1.y < 0.0f ? 1 : 0;
+
+            for (int c = 0; c < 3; c++) {
+                const tinyobj::index_t &index = mesh.indices[f + c];
+                const WeldKey key(index.vertex_index, index.texcoord_index, mirrored);
+
+                std::map<WeldKey, unsigned int>::const_iterator it = vertexTable.find(key);
+                if (it != vertexTable.end()) {
+                    indices.push_back(it->second);
+                    continue;
+                }
+
+                const unsigned int vertexIndex = (unsigned int)vertices.size();
+                vertices.push_back(Vertex(objPositions[index.vertex_index], objNormals[index.vertex_index], texcoords[c]));
+                vertexTable[key] = vertexIndex;
+                indices.push_back(vertexIndex);
+            }
+        }
+    }
+    indexBufferSize = indices.size();
+
+    // 溶接後のメッシュで接ベクトルを計算する
+    std::vector<glm::vec3> positions(vertices.size()), normals(vertices.size());
+    std::vector<glm::vec2> texcoords(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        positions[i] = vertices[i].position;
+        normals[i] = vertices[i].normal;
+        texcoords[i] = vertices[i].texcoord;
+    }
+
+    std::vector<glm::vec4> tangents;
+    tangentSpace.computeTangents(positions, normals, texcoords, indices, &tangents);
+    for (size_t i = 0; i < vertices.size(); i++) {
+        vertices[i].tangent = tangents[i];
+    }
+
+    // VAOの作成
+    glGenVertexArrays(1, &vaoId);
+    glBindVertexArray(vaoId);
+
+    // 頂点バッファの作成
+    glGenBuffers(1, &vertexBufferId);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferId);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+
+    // 頂点バッファの有効化
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferId);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+
+    glEnableVertexAttribArray(1);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferId);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+
+    glEnableVertexAttribArray(2);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferId);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texcoord));
+
+    glEnableVertexAttribArray(3);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferId);
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tangent));
+
+    // 頂点番号バッファの作成
+    glGenBuffers(1, &indexBufferId);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferId);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(),
+                 indices.data(), GL_STATIC_DRAW);
+
+    // VAOをOFFにしておく
+    glBindVertexArray(0);
+}
+
+// テクスチャの読み込み
+GLuint loadTexture(const std::string &filename) {
+    // OBJのuvに合わせて画像の下端をv = 0にする
+    stbi_set_flip_vertically_on_load(true);
+
+    int texWidth, texHeight, channels;
+    unsigned char *bytes = stbi_load(filename.c_str(), &texWidth, &texHeight, &channels, STBI_rgb_alpha);
+    if (!bytes) {
+        fprintf(stderr, "Failed to load image file: %s\n", filename.c_str());
+        exit(1);
+    }
+
+    GLuint textureId;
+    glGenTextures(1, &textureId);
+    glBindTexture(GL_TEXTURE_2D, textureId);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texWidth, texHeight,
+                 0, GL_RGBA, GL_UNSIGNED_BYTE, bytes);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    stbi_image_free(bytes);
+
+    return textureId;
+}
+
+// テクスチャの初期化
+void initTextures() {
+    diffuseTextureId = loadTexture(DIFFUSE_TEX_FILE);
+    normalTextureId = loadTexture(NORMAL_TEX_FILE);
+}
+
+// シェーダの初期化
+void initShaders() {
+    programId = buildShaderProgram(VERT_SHADER_FILE, FRAG_SHADER_FILE);
+    // Uniform変数の位置を列挙しておく
+    program.reflect(programId);
+}
+
+// OpenGLの初期化関数
+void initializeGL() {
+    // 深度テストの有効化
+    glEnable(GL_DEPTH_TEST);
+
+    // 背景色の設定 (黒)
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    // VAOの初期化
+    initVAO();
+
+    // テクスチャの用意
+    initTextures();
+
+    // シェーダの用意
+    initShaders();
+}
+
+// OpenGLの描画関数
+void paintGL() {
+    // 背景色の描画
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // 座標の変換
+    glm::mat4 projMat = glm::perspective(glm::radians(45.0f),
+        (float)WIN_WIDTH / (float)WIN_HEIGHT, 0.1f, 1000.0f);
+
+    glm::mat4 viewMat = glm::lookAt(glm::vec3(3.0f, 4.0f, 5.0f),   // 視点の位置
+                                    glm::vec3(0.0f, 0.5f, 0.0f),   // 見ている先
+                                    glm::vec3(0.0f, 1.0f, 0.0f));  // 視界の上方向
+
+    const float renderTheta = timestep.lerp(prevTheta, theta);
+    glm::mat4 modelMat = glm::rotate(glm::radians(renderTheta), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    glm::mat4 mvMat = viewMat * modelMat;
+    glm::mat4 mvpMat = projMat * viewMat * modelMat;
+    glm::mat4 normMat = glm::transpose(glm::inverse(mvMat));
+    glm::mat4 lightMat = viewMat;
+
+    // VAOの有効化
+    glBindVertexArray(vaoId);
+
+    // シェーダの有効化
+    glUseProgram(programId);
+
+    // Uniform変数の転送
+    program.set("u_mvMat", mvMat);
+    program.set("u_mvpMat", mvpMat);
+    program.set("u_normMat", normMat);
+    program.set("u_lightMat", lightMat);
+
+    program.set("u_lightPos", lightPos);
+    program.set("u_specColor", specColor);
+    program.set("u_ambiColor", ambiColor);
+    program.set("u_shininess", shininess);
+    program.set("u_useNormalMap", useNormalMap ? 1 : 0);
+
+    // テクスチャの有効化とシェーダへの転送
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, diffuseTextureId);
+    program.set("u_diffTexture", 0);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, normalTextureId);
+    program.set("u_normalTexture", 1);
+
+    // 三角形の描画
+    glDrawElements(GL_TRIANGLES, indexBufferSize, GL_UNSIGNED_INT, 0);
+
+    // VAOの無効化
+    glBindVertexArray(0);
+
+    // シェーダの無効化
+    glUseProgram(0);
+
+    // テクスチャの無効化
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void resizeGL(GLFWwindow *window, int width, int height) {
+    // ユーザ管理のウィンドウサイズを変更
+    WIN_WIDTH = width;
+    WIN_HEIGHT = height;
+
+    // GLFW管理のウィンドウサイズを変更
+    glfwSetWindowSize(window, WIN_WIDTH, WIN_HEIGHT);
+
+    // 実際のウィンドウサイズ (ピクセル数) を取得
+    int renderBufferWidth, renderBufferHeight;
+    glfwGetFramebufferSize(window, &renderBufferWidth, &renderBufferHeight);
+
+    // ビューポート変換の更新
+    glViewport(0, 0, renderBufferWidth, renderBufferHeight);
+}
+
+// キーボードの処理
+void keyboard(GLFWwindow *window, int key, int scancode, int action, int mods) {
+    if (action == GLFW_PRESS && key == GLFW_KEY_N) {
+        // 法線マップのON/OFFを切り替える
+        useNormalMap = !useNormalMap;
+        printf("Normal map: %s\n", useNormalMap ? "ON" : "OFF");
+    }
+}
+
+// アニメーションのためのアップデート
+void animate() {
+    prevTheta = theta;
+    theta += 1.0f;  // 1度だけ回転
+}
+
+int main(int argc, char **argv) {
+    // OpenGLを初期化する
+    if (glfwInit() == GL_FALSE) {
+        fprintf(stderr, "Initialization failed!\n");
+        return 1;
+    }
+
+    // OpenGLのバージョン設定 (Macの場合には必ず必要)
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+    // Windowの作成
+    GLFWwindow *window = glfwCreateWindow(WIN_WIDTH, WIN_HEIGHT, WIN_TITLE,
+                                          NULL, NULL);
+    if (window == NULL) {
+        fprintf(stderr, "Window creation failed!\n");
+        glfwTerminate();
+        return 1;
+    }
+
+    // OpenGLの描画対象にWindowを追加
+    glfwMakeContextCurrent(window);
+
+    // OpenGL 3.x/4.xの関数をロードする (glfwMakeContextCurrentの後でないといけない)
+    const int version = gladLoadGL(glfwGetProcAddress);
+    if (version == 0) {
+        fprintf(stderr, "Failed to load OpenGL 3.x/4.x libraries!\n");
+        return 1;
+    }
+
+    // バージョンを出力する
+    printf("Load OpenGL %d.%d\n", GLAD_VERSION_MAJOR(version), GLAD_VERSION_MINOR(version));
+
+    // ウィンドウのリサイズを扱う関数の登録
+    glfwSetWindowSizeCallback(window, resizeGL);
+
+    // キーボードのイベントを処理する関数を登録
+    glfwSetKeyCallback(window, keyboard);
+
+    // OpenGLを初期化
+    initializeGL();
+
+    // メインループ
+    timestep.reset(glfwGetTime());
+    while (glfwWindowShouldClose(window) == GL_FALSE) {
+        // アニメーション (経過時間に応じて0回以上進める)
+        const int steps = timestep.advance(glfwGetTime());
+        for (int i = 0; i < steps; i++) {
+            animate();
+        }
+
+        // 描画
+        paintGL();
+
+        // 描画用バッファの切り替え
+        glfwSwapBuffers(window);
+        glfwPollEvents();
+    }
+}
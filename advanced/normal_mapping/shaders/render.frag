@@ -0,0 +1,44 @@
+#version 330
+
+in vec3 f_positionCameraSpace;
+in vec3 f_normalCameraSpace;
+in vec3 f_tangentCameraSpace;
+in vec3 f_bitangentCameraSpace;
+in vec3 f_lightPosCameraSpace;
+in vec2 f_texcoord;
+
+out vec4 out_color;
+
+// テクスチャ
+uniform sampler2D u_diffTexture;
+uniform sampler2D u_normalTexture;
+uniform bool u_useNormalMap;
+
+// マテリアルのデータ
+uniform vec3 u_specColor;
+uniform vec3 u_ambiColor;
+uniform float u_shininess;
+
+void main() {
+    // 補間された接空間の基底 (MikkTSpaceに合わせて頂点単位では正規化しない)
+    vec3 N = f_normalCameraSpace;
+    if (u_useNormalMap) {
+        vec3 n = texture(u_normalTexture, f_texcoord).xyz * 2.0 - 1.0;
+        N = n.x * f_tangentCameraSpace + n.y * f_bitangentCameraSpace + n.z * f_normalCameraSpace;
+    }
+    N = normalize(N);
+
+    // Blinn-Phongの反射モデル
+    vec3 V = normalize(-f_positionCameraSpace);
+    vec3 L = normalize(f_lightPosCameraSpace - f_positionCameraSpace);
+    vec3 H = normalize(V + L);
+
+    vec3 diffColor = texture(u_diffTexture, f_texcoord).rgb;
+    float ndotl = max(0.0, dot(N, L));
+    float ndoth = max(0.0, dot(N, H));
+    vec3 diffuse = diffColor * ndotl;
+    vec3 specular = u_specColor * pow(ndoth, u_shininess);
+    vec3 ambient = u_ambiColor * diffColor;
+
+    out_color = vec4(diffuse + specular + ambient, 1.0);
+}
@@ -0,0 +1,39 @@
+#version 330
+
+// Attribute変数
+layout(location = 0) in vec3 in_position;
+layout(location = 1) in vec3 in_normal;
+layout(location = 2) in vec2 in_texcoord;
+layout(location = 3) in vec4 in_tangent;
+
+// Varying変数
+out vec3 f_positionCameraSpace;
+out vec3 f_normalCameraSpace;
+out vec3 f_tangentCameraSpace;
+out vec3 f_bitangentCameraSpace;
+out vec3 f_lightPosCameraSpace;
+out vec2 f_texcoord;
+
+// 光源の情報
+uniform vec3 u_lightPos;
+
+// 各種変換行列
+uniform mat4 u_mvMat;
+uniform mat4 u_mvpMat;
+uniform mat4 u_normMat;
+uniform mat4 u_lightMat;
+
+void main() {
+    gl_Position = u_mvpMat * vec4(in_position, 1.0);
+
+    // カメラ座標系への変換
+    f_positionCameraSpace = (u_mvMat * vec4(in_position, 1.0)).xyz;
+    f_normalCameraSpace = (u_normMat * vec4(in_normal, 0.0)).xyz;
+    f_tangentCameraSpace = (u_mvMat * vec4(in_tangent.xyz, 0.0)).xyz;
+    f_lightPosCameraSpace = (u_lightMat * vec4(u_lightPos, 1.0)).xyz;
+
+    // 従法線は法線と接ベクトルの外積に向きを掛けて復元する (MikkTSpaceと同じ)
+    f_bitangentCameraSpace = in_tangent.w * cross(f_normalCameraSpace, f_tangentCameraSpace);
+
+    f_texcoord = in_texcoord;
+}
@@ -0,0 +1,188 @@
+#ifndef _TANGENT_SPACE_H_
+#define _TANGENT_SPACE_H_
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <glutils/job_system.h>
+
+// 溶接済みのメッシュ (三角形が頂点番号を共有しているメッシュ) の法線と接ベクトルを計算するクラス
+// 接ベクトルは次のように求める
+//   - 三角形ごとの接ベクトルを頂点の法線に直交する平面に射影してから正規化する
+//   - 射影した平面上での頂点の角度で重み付けして足し合わせる
+//   - 従法線はシェーダで B = tangent.w * cross(N, T) として復元する
+// このクラスは頂点を分割しないので, MikkTSpaceと同じく, uvが鏡映された三角形とそうでない三角形が
+// 頂点を共有しないように, 溶接するときにuvの向き (面積の符号) の違う角を別の頂点に分けておくこと.
+// (共有していると, その頂点では従法線の向きが平均されて崩れる)
+// 計算は三角形ごとの前計算と頂点ごとの集計の2段階で, どちらもジョブシステムで分割して並列に行う
+class TangentSpace {
+public:
+    // jobsを渡すと範囲に分けて並列に計算する (NULLなら呼び出し元のスレッドだけで計算する)
+    explicit TangentSpace(JobSystem *jobs = NULL)
+        : jobs_(jobs) {
+    }
+
+    // 頂点の角度で重み付けした滑らかな法線を計算する
+    void computeNormals(const std::vector<glm::vec3> &positions,
+                        const std::vector<unsigned int> &indices,
+                        std::vector<glm::vec3> *normals) const {
+        const int numVertices = (int)positions.size();
+        const int numFaces = (int)indices.size() / 3;
+
+        // 三角形ごとの単位法線と各頂点での角度
+        std::vector<glm::vec3> faceNormals(numFaces);
+        std::vector<glm::vec3> cornerAngles(numFaces);
+        parallelFor(numFaces, [&](int f) {
+            const glm::vec3 &p0 = positions[indices[f * 3 + 0]];
+            const glm::vec3 &p1 = positions[indices[f * 3 + 1]];
+            const glm::vec3 &p2 = positions[indices[f * 3 + 2]];
+            faceNormals[f] = safeNormalize(glm::cross(p1 - p0, p2 - p0));
+            cornerAngles[f] = glm::vec3(angle(p1 - p0, p2 - p0),
+                                        angle(p2 - p1, p0 - p1),
+                                        angle(p0 - p2, p1 - p2));
+        });
+
+        // 頂点を共有する三角形の法線を集める
+        std::vector<int> offsets, corners;
+        buildAdjacency(numVertices, indices, &offsets, &corners);
+
+        normals->assign(numVertices, glm::vec3(0.0f));
+        parallelFor(numVertices, [&](int v) {
+            glm::vec3 sum(0.0f);
+            for (int k = offsets[v]; k < offsets[v + 1]; k++) {
+                const int f = corners[k] / 3;
+                sum += faceNormals[f] * cornerAngles[f][corners[k] % 3];
+            }
+            (*normals)[v] = safeNormalize(sum);
+        });
+    }
+
+    // 接ベクトル (xyz) と従法線の向き (w = ±1) を計算する
+    void computeTangents(const std::vector<glm::vec3> &positions,
+                         const std::vector<glm::vec3> &normals,
+                         const std::vector<glm::vec2> &texcoords,
+                         const std::vector<unsigned int> &indices,
+                         std::vector<glm::vec4> *tangents) const {
+        const int numVertices = (int)positions.size();
+        const int numFaces = (int)indices.size() / 3;
+
+        // 三角形ごとのuvの勾配方向 (正規化済み). 面積がつぶれたuvは寄与させない
+        std::vector<glm::vec3> faceTangents(numFaces);
+        std::vector<glm::vec3> faceBitangents(numFaces);
+        parallelFor(numFaces, [&](int f) {
+            const unsigned int i0 = indices[f * 3 + 0];
+            const unsigned int i1 = indices[f * 3 + 1];
+            const unsigned int i2 = indices[f * 3 + 2];
+            const glm::vec3 e1 = positions[i1] - positions[i0];
+            const glm::vec3 e2 = positions[i2] - positions[i0];
+            const glm::vec2 d1 = texcoords[i1] - texcoords[i0];
+            const glm::vec2 d2 = texcoords[i2] - texcoords[i0];
+
+            // uvの面積の符号で向きをそろえる (大きさは正規化で消えるので割らない)
+            const float det = d1.x * d2.y - d2.x * d1.y;
+            const float sign = det < 0.0f ? -1.0f : 1.0f;
+            if (std::abs(det) > 1.0e-12f) {
+                faceTangents[f] = safeNormalize(sign * (e1 * d2.y - e2 * d1.y));
+                faceBitangents[f] = safeNormalize(sign * (e2 * d1.x - e1 * d2.x));
+            } else {
+                faceTangents[f] = glm::vec3(0.0f);
+                faceBitangents[f] = glm::vec3(0.0f);
+            }
+        });
+
+        std::vector<int> offsets, corners;
+        buildAdjacency(numVertices, indices, &offsets, &corners);
+
+        // 頂点ごとに1回だけ, 共有する三角形の値を集める
+        tangents->assign(numVertices, glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+        parallelFor(numVertices, [&](int v) {
+            const glm::vec3 &N = normals[v];
+            glm::vec3 T(0.0f), B(0.0f);
+            for (int k = offsets[v]; k < offsets[v + 1]; k++) {
+                const int f = corners[k] / 3;
+                const int c = corners[k] % 3;
+
+                // 法線に直交する平面上での頂点の角度
+                const glm::vec3 &p0 = positions[indices[f * 3 + c]];
+                const glm::vec3 &p1 = positions[indices[f * 3 + (c + 1) % 3]];
+                const glm::vec3 &p2 = positions[indices[f * 3 + (c + 2) % 3]];
+                const float weight = angle(project(p1 - p0, N), project(p2 - p0, N));
+
+                T += safeNormalize(project(faceTangents[f], N)) * weight;
+                B += safeNormalize(project(faceBitangents[f], N)) * weight;
+            }
+
+            // 接ベクトルがつぶれた場合は法線に直交する適当な方向を使う
+            T = safeNormalize(project(T, N));
+            if (glm::dot(T, T) == 0.0f) {
+                T = safeNormalize(project(std::abs(N.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f)
+                                                               : glm::vec3(0.0f, 1.0f, 0.0f), N));
+            }
+            const float w = glm::dot(glm::cross(N, T), B) < 0.0f ? -1.0f : 1.0f;
+            (*tangents)[v] = glm::vec4(T, w);
+        });
+    }
+
+private:
+    // 並列に処理するときの1つのジョブの大きさ
+    static const int PARALLEL_GRAIN = 1024;
+
+    // 0からn-1までの番号をPARALLEL_GRAIN個ずつに分けて処理する
+    template <typename Func>
+    void parallelFor(int n, const Func &func) const {
+        if (jobs_ == NULL) {
+            for (int i = 0; i < n; i++) {
+                func(i);
+            }
+            return;
+        }
+
+        jobs_->parallelFor(n, PARALLEL_GRAIN, [&func](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                func(i);
+            }
+        });
+    }
+
+    // 頂点から, その頂点を使う三角形の角 (三角形の番号 * 3 + 何番目の頂点か) を引く表を作る
+    static void buildAdjacency(int numVertices, const std::vector<unsigned int> &indices,
+                               std::vector<int> *offsets, std::vector<int> *corners) {
+        offsets->assign(numVertices + 1, 0);
+        for (size_t i = 0; i < indices.size(); i++) {
+            (*offsets)[indices[i] + 1]++;
+        }
+        for (int v = 0; v < numVertices; v++) {
+            (*offsets)[v + 1] += (*offsets)[v];
+        }
+
+        std::vector<int> fill(offsets->begin(), offsets->end() - 1);
+        corners->resize(indices.size());
+        for (size_t i = 0; i < indices.size(); i++) {
+            (*corners)[fill[indices[i]]++] = (int)i;
+        }
+    }
+
+    static glm::vec3 project(const glm::vec3 &v, const glm::vec3 &n) {
+        return v - n * glm::dot(n, v);
+    }
+
+    static glm::vec3 safeNormalize(const glm::vec3 &v) {
+        const float len = glm::length(v);
+        return len > 1.0e-20f ? v / len : glm::vec3(0.0f);
+    }
+
+    static float angle(const glm::vec3 &a, const glm::vec3 &b) {
+        const float denom = glm::length(a) * glm::length(b);
+        if (denom <= 0.0f) {
+            return 0.0f;
+        }
+        return std::acos(std::min(1.0f, std::max(-1.0f, glm::dot(a, b) / denom)));
+    }
+
+    JobSystem *jobs_;
+};
+
+#endif  // _TANGENT_SPACE_H_
@@ -21,6 +21,11 @@
 
 // ディレクトリの設定ファイル
 #include "common.h"
+#include <glutils/shader_builder.h>
+#include <glutils/shader_program.h>
+#include <glutils/uniform_buffer.h>
+#include <glutils/mesh_arena.h>
+#include <glutils/fixed_timestep.h>
 
 static int WIN_WIDTH   = 500;                       // ウィンドウの幅
 static int WIN_HEIGHT  = 500;                       // ウィンドウの高さ
@@ -48,24 +53,34 @@ struct Vertex {
     glm::vec3 normal;
 };
 
-// バッファを参照する番号
-struct ObjectVao {
-    GLuint vaoId;
-    GLuint vertexBufferId;
-    GLuint indexBufferId;
-    size_t indexBufferSize;
-} objectVao;
-
-struct PlaneVao {
-    GLuint vaoId;
-    GLuint vertexBufferId;
-    GLuint indexBufferId;
-    size_t indexBufferSize;    
-} planeVao;
+// すべてのメッシュを詰めた頂点バッファと頂点番号バッファ
+MeshArena<Vertex> meshArena;
+int objectMesh;
+int planeMesh;
+
+// 描画ごとのデータ (シェーダからは描画番号で引く)
+struct DrawData {
+    glm::mat4 modelMat;
+    glm::vec4 normalMat[3];   // 法線の変換行列 (3x3) の各列
+    glm::vec4 params;         // x: 材質の番号, y: 影を受けるかどうか
+};
+
+static_assert(sizeof(DrawData) == 128, "DrawData must be 8 texels");
+
+std::vector<DrawData> drawData;
+DrawDataBuffer<DrawData> drawDataBuffer;
+
+// パスごとに描くメッシュの並び
+// 影を落とす物体を先頭に並べ, シャドウマップのパスでは同じ描画番号を先頭から使う
+bool useMultiDraw = false;
+MultiDrawList shadowDrawList;
+MultiDrawList renderDrawList;
 
 // シェーダを参照する番号
 GLuint programId;
 GLuint smProgramId;
+ShaderProgram program;
+ShaderProgram smProgram;
 
 // ライトの位置
 static const glm::vec3 lightPos = glm::vec3(0.0f, 7.0f, 7.0f);
@@ -87,8 +102,27 @@ struct SilverMaterial {
     float shininess = 51.2f;
 } silverMat;
 
+// Uniformバッファ (フレームごとの情報と, 金と銀の材質)
+// 描画ごとに範囲を割り当て直さずに済むよう, 材質は配列にしてシェーダ側で番号から引く
+enum {
+    MATERIAL_GOLD = 0,
+    MATERIAL_SILVER,
+    NUM_MATERIALS
+};
+
+struct MaterialTable {
+    MaterialBlock materials[NUM_MATERIALS];
+};
+
+UniformBuffer<FrameBlock> frameBuffer;
+UniformBuffer<MaterialTable> materialBuffer;
+
 // 立方体の回転角度
 static float theta = 0.0f;
+static float prevTheta = 0.0f;
+
+// アニメーションは描画の速さによらず, 1秒に60回の一定の間隔で進める
+FixedTimestep timestep(1.0 / 60.0);
 
 // シャドウ・マップのためのFBO
 struct ShadowMap {
@@ -99,7 +133,11 @@ struct ShadowMap {
 
 // VAOの初期化
 void initVAO() {
-    // 平面用VAOの作成
+    // 間接描画が使えれば, 1パスの描画を1回の呼び出しで済ませる
+    useMultiDraw = MultiDrawList::supported();
+    printf("Multi-draw indirect: %s\n", useMultiDraw ? "ON" : "OFF (one draw per mesh)");
+
+    // 平面の追加
     {
         // Vertex配列の作成
         std::vector<Vertex> vertices = {
@@ -113,38 +151,10 @@ void initVAO() {
             0, 1, 3, 0, 3, 2
         };
 
-        // VAOの作成
-        glGenVertexArrays(1, &planeVao.vaoId);
-        glBindVertexArray(planeVao.vaoId);
-
-        // 頂点バッファの作成
-        glGenBuffers(1, &planeVao.vertexBufferId);
-        glBindBuffer(GL_ARRAY_BUFFER, planeVao.vertexBufferId);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
-
-        // 頂点バッファの有効化
-        glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, planeVao.vertexBufferId);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
-
-        glEnableVertexAttribArray(1);
-        glBindBuffer(GL_ARRAY_BUFFER, planeVao.vertexBufferId);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
-
-        // 頂点番号バッファの作成
-        glGenBuffers(1, &planeVao.indexBufferId);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, planeVao.indexBufferId);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(),
-                     indices.data(), GL_STATIC_DRAW);
-
-        // 頂点バッファのサイズを変数に入れておく
-        planeVao.indexBufferSize = indices.size();
-
-        // VAOをOFFにしておく
-        glBindVertexArray(0);    
+        planeMesh = meshArena.add(vertices, indices);
     }
 
-    // オブジェクト用VAOの作成
+    // オブジェクトの追加
     {
         // モデルのロード
         tinyobj::attrib_t attrib;
@@ -189,140 +199,55 @@ void initVAO() {
             }
         }
 
-        // VAOの作成
-        glGenVertexArrays(1, &objectVao.vaoId);
-        glBindVertexArray(objectVao.vaoId);
-
-        // 頂点バッファの作成
-        glGenBuffers(1, &objectVao.vertexBufferId);
-        glBindBuffer(GL_ARRAY_BUFFER, objectVao.vertexBufferId);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
-
-        // 頂点バッファの有効化
-        glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, objectVao.vertexBufferId);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
-
-        glEnableVertexAttribArray(1);
-        glBindBuffer(GL_ARRAY_BUFFER, objectVao.vertexBufferId);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
-
-        // 頂点番号バッファの作成
-        glGenBuffers(1, &objectVao.indexBufferId);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, objectVao.indexBufferId);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(),
-                     indices.data(), GL_STATIC_DRAW);
-
-        // 頂点バッファのサイズを変数に入れておく
-        objectVao.indexBufferSize = indices.size();
-
-        // VAOをOFFにしておく
-        glBindVertexArray(0);
-    }
-}
-
-GLuint compileShader(const std::string &filename, GLuint type) {
-    // シェーダの作成
-    GLuint shaderId = glCreateShader(type);
-    
-    // ファイルの読み込み
-    std::ifstream reader;
-    size_t codeSize;
-    std::string code;
-
-    // ファイルを開く
-    reader.open(filename.c_str(), std::ios::in);
-    if (!reader.is_open()) {
-        // ファイルを開けなかったらエラーを出して終了
-        fprintf(stderr, "Failed to load a shader: %s\n", VERT_SHADER_FILE.c_str());
-        exit(1);
-    }
-
-    // ファイルをすべて読んで変数に格納 (やや難)
-    reader.seekg(0, std::ios::end);             // ファイル読み取り位置を終端に移動 
-    codeSize = reader.tellg();                  // 現在の箇所(=終端)の位置がファイルサイズ
-    code.resize(codeSize);                      // コードを格納する変数の大きさを設定
-    reader.seekg(0);                            // ファイルの読み取り位置を先頭に移動
-    reader.read(&code[0], codeSize);            // 先頭からファイルサイズ分を読んでコードの変数に格納
-
-    // ファイルを閉じる
-    reader.close();
-
-    // コードのコンパイル
-    const char *codeChars = code.c_str();
-    glShaderSource(shaderId, 1, &codeChars, NULL);
-    glCompileShader(shaderId);
-
-    // コンパイルの成否を判定する
-    GLint compileStatus;
-    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
-    if (compileStatus == GL_FALSE) {
-        // コンパイルが失敗したらエラーメッセージとソースコードを表示して終了
-        fprintf(stderr, "Failed to compile a shader!\n");
-
-        // エラーメッセージの長さを取得する
-        GLint logLength;
-        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &logLength);
-        if (logLength > 0) {
-            // エラーメッセージを取得する
-            GLsizei length;
-            std::string errMsg;
-            errMsg.resize(logLength);
-            glGetShaderInfoLog(shaderId, logLength, &length, &errMsg[0]);
-
-            // エラーメッセージとソースコードの出力
-            fprintf(stderr, "[ ERROR ] %s\n", errMsg.c_str());
-            fprintf(stderr, "%s\n", code.c_str());
-        }
-        exit(1);
+        objectMesh = meshArena.add(vertices, indices);
     }
 
-    return shaderId;
-}
-
-GLuint buildShaderProgram(const std::string &vShaderFile, const std::string &fShaderFile) {
-    // シェーダの作成
-    GLuint vertShaderId = compileShader(vShaderFile, GL_VERTEX_SHADER);
-    GLuint fragShaderId = compileShader(fShaderFile, GL_FRAGMENT_SHADER);
-    
-    // シェーダプログラムのリンク
-    GLuint programId = glCreateProgram();
-    glAttachShader(programId, vertShaderId);
-    glAttachShader(programId, fragShaderId);
-    glLinkProgram(programId);
-    
-    // リンクの成否を判定する
-    GLint linkState;
-    glGetProgramiv(programId, GL_LINK_STATUS, &linkState);
-    if (linkState == GL_FALSE) {
-        // リンクに失敗したらエラーメッセージを表示して終了
-        fprintf(stderr, "Failed to link shaders!\n");
-
-        // エラーメッセージの長さを取得する
-        GLint logLength;
-        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &logLength);
-        if (logLength > 0) {
-            // エラーメッセージを取得する
-            GLsizei length;
-            std::string errMsg;
-            errMsg.resize(logLength);
-            glGetProgramInfoLog(programId, logLength, &length, &errMsg[0]);
-
-            // エラーメッセージを出力する
-            fprintf(stderr, "[ ERROR ] %s\n", errMsg.c_str());
-        }
-        exit(1);
-    }
-    
-    // シェーダを無効化した後にIDを返す
-    glUseProgram(0);
-    return programId;
+    // まとめて転送し, 共通の頂点の形式を設定する
+    meshArena.upload();
+    meshArena.vertexAttrib(0, 3, GL_FLOAT, offsetof(Vertex, position));
+    meshArena.vertexAttrib(1, 3, GL_FLOAT, offsetof(Vertex, normal));
+
+    // 描画の並びは変わらないので最初に作っておく (描画番号はdrawDataの並びと一致させる)
+    shadowDrawList = MultiDrawList(useMultiDraw);
+    renderDrawList = MultiDrawList(useMultiDraw);
+    shadowDrawList.add(meshArena.mesh(objectMesh));
+    renderDrawList.add(meshArena.mesh(objectMesh));
+    renderDrawList.add(meshArena.mesh(planeMesh));
+    drawData.resize(renderDrawList.size());
 }
 
 // シェーダの初期化
 void initShaders() {
-    programId = buildShaderProgram(VERT_SHADER_FILE, FRAG_SHADER_FILE);
-    smProgramId = buildShaderProgram(SM_VSHADER_FILE, SM_FSHADER_FILE);
+    // 2つのプログラムをまとめて (並列に) ビルドする
+    // 間接描画を使う場合は, 描画番号を gl_DrawIDARB から取るようにビルドする
+    ShaderProgramBatch batch(glfwGetProcAddress);
+    const std::string header = useMultiDraw ? MultiDrawList::shaderHeader() : "";
+    const int renderShader = batch.add(VERT_SHADER_FILE, FRAG_SHADER_FILE, header);
+    const int smShader = batch.add(SM_VSHADER_FILE, SM_FSHADER_FILE, header);
+    batch.build();
+
+    programId = batch.program(renderShader);
+    smProgramId = batch.program(smShader);
+
+    // Uniform変数の位置を列挙しておく
+    program.reflect(programId);
+    smProgram.reflect(smProgramId);
+
+    // Uniformブロックの結合点を設定する
+    program.bindUniformBlock("FrameBlock", FRAME_BLOCK_BINDING);
+    program.bindUniformBlock("MaterialBlock", MATERIAL_BLOCK_BINDING);
+}
+
+// Uniformバッファの初期化
+void initUniformBuffers() {
+    frameBuffer.create();
+
+    // 材質は変わらないので最初に1回だけ転送する
+    MaterialTable table;
+    table.materials[MATERIAL_GOLD] = MaterialBlock(goldMat.ambiColor, goldMat.diffColor, goldMat.specColor, goldMat.shininess);
+    table.materials[MATERIAL_SILVER] = MaterialBlock(silverMat.ambiColor, silverMat.diffColor, silverMat.specColor, silverMat.shininess);
+    materialBuffer.create();
+    materialBuffer.update(table);
 }
 
 // FBOの初期化
@@ -365,13 +290,29 @@ void initializeGL() {
     // シェーダの用意
     initShaders();
 
+    // Uniformバッファの用意
+    initUniformBuffers();
+
     // FBOの初期化
     initFBO();
 }
 
+// 描画ごとのデータを作る
+DrawData makeDrawData(const glm::mat4 &modelMat, int material, bool enableSM) {
+    const glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(modelMat)));
+
+    DrawData data;
+    data.modelMat = modelMat;
+    for (int i = 0; i < 3; i++) {
+        data.normalMat[i] = glm::vec4(normalMat[i], 0.0f);
+    }
+    data.params = glm::vec4((float)material, enableSM ? 1.0f : 0.0f, 0.0f, 0.0f);
+    return data;
+}
+
 // OpenGLの描画関数
 void paintGL() {
-    // ライトスペースのためのMVP行列
+    // ライトスペースのためのVP行列
     glm::mat4 lightBiasVP;
     
     // ビューポート変換の取得
@@ -381,7 +322,17 @@ void paintGL() {
     // モデルの変形
     glm::mat4 modelMat = glm::mat4(1.0f);
     modelMat = glm::translate(modelMat, glm::vec3(0.0f, 0.5f, 0.0f));
-    modelMat = glm::rotate(modelMat, glm::radians(theta), glm::vec3(0.0f, 1.0f, 0.0f));
+    const float renderTheta = timestep.lerp(prevTheta, theta);
+    modelMat = glm::rotate(modelMat, glm::radians(renderTheta), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    // 描画ごとのデータをまとめて転送する (renderDrawListと同じ並び)
+    drawData[0] = makeDrawData(modelMat, MATERIAL_GOLD, false);
+    drawData[1] = makeDrawData(glm::mat4(1.0f), MATERIAL_SILVER, true);
+    drawDataBuffer.update(drawData);
+    drawDataBuffer.bind(1);
+
+    // すべてのメッシュは同じVAOで描く
+    glBindVertexArray(meshArena.vaoId());
 
     // ライトからの描画
     glUseProgram(smProgramId);
@@ -400,25 +351,15 @@ void paintGL() {
                                         glm::vec3(0.0f, 0.0f, 0.0f),   // 見ている先
                                         glm::vec3(0.0f, 1.0f, 0.0f));  // 視界の上方向
 
-        lightBiasVP = projMat * viewMat; // * modelMat;
+        lightBiasVP = projMat * viewMat;
 
-        glm::mat4 mvpMat = lightBiasVP * modelMat;
+        smProgram.set("u_lightVP", lightBiasVP);
+        smProgram.set("u_drawData", 1);
 
-        GLuint uid;
-        uid = glGetUniformLocation(smProgramId, "u_mvpMat");
-        glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvpMat));
-
-        // VAOの有効化
-        glBindVertexArray(objectVao.vaoId);
-
-        // 三角形の描画
-        glDrawElements(GL_TRIANGLES, objectVao.indexBufferSize, GL_UNSIGNED_INT, 0);
-
-        // VAOの無効化
-        glBindVertexArray(0);
+        // 影を落とす物体をまとめて描画
+        shadowDrawList.draw(smProgram.uniformLocation("u_drawId"));
     }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glUseProgram(0);
 
     glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
 
@@ -434,100 +375,27 @@ void paintGL() {
                                         glm::vec3(0.0f, 0.0f, 0.0f),   // 見ている先
                                         glm::vec3(0.0f, 1.0f, 0.0f));  // 視界の上方向
 
-        {
-            // Uniform変数の転送
-            glm::mat4 modelMat = glm::mat4(1.0f);
-
-            glm::mat4 mvMat = viewMat * modelMat;
-            glm::mat4 normMat = glm::transpose(glm::inverse(mvMat));
-            glm::mat4 mvpMat = projMat * viewMat * modelMat;
-            glm::mat4 lightMat = viewMat;
-
-            GLuint uid;
-            uid = glGetUniformLocation(programId, "u_mvpMat");
-            glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvpMat));
-            uid = glGetUniformLocation(programId, "u_mvMat");
-            glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvMat));
-            uid = glGetUniformLocation(programId, "u_normMat");
-            glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(normMat));
-            uid = glGetUniformLocation(programId, "u_lightMat");
-            glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(lightMat));
-
-            uid = glGetUniformLocation(programId, "u_lightPos");
-            glUniform3fv(uid, 1, glm::value_ptr(lightPos));
-            uid = glGetUniformLocation(programId, "u_diffColor");
-            glUniform3fv(uid, 1, glm::value_ptr(silverMat.diffColor));
-            uid = glGetUniformLocation(programId, "u_specColor");
-            glUniform3fv(uid, 1, glm::value_ptr(silverMat.specColor));
-            uid = glGetUniformLocation(programId, "u_ambiColor");
-            glUniform3fv(uid, 1, glm::value_ptr(silverMat.ambiColor));
-            uid = glGetUniformLocation(programId, "u_shininess");
-            glUniform1f(uid, silverMat.shininess);
-
-            glm::mat4 lightBiasMVP = lightBiasVP * modelMat;
-            uid = glGetUniformLocation(programId, "u_lightBiasMVP");
-            glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(lightBiasMVP));
-
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, shadowMap.colorTexId);
-            uid = glGetUniformLocation(programId, "u_depthTex");
-            glUniform1i(uid, 0);
-
-            uid = glGetUniformLocation(programId, "u_enableSM");
-            glUniform1i(uid, 1);
-
-            // VAOの有効化
-            glBindVertexArray(planeVao.vaoId);
-
-            // 三角形の描画
-            glDrawElements(GL_TRIANGLES, planeVao.indexBufferSize, GL_UNSIGNED_INT, 0);
-
-            // VAOの無効化
-            glBindVertexArray(0);
-        }
+        // カメラと光源の情報はフレームごとに1回だけ転送する
+        FrameBlock frame;
+        frame.viewMat = viewMat;
+        frame.projMat = projMat;
+        frame.lightPos = glm::vec4(lightPos, 1.0f);
+        frameBuffer.update(frame);
+        frameBuffer.bind(FRAME_BLOCK_BINDING);
+        materialBuffer.bind(MATERIAL_BLOCK_BINDING);
 
-        {
-            // Uniform変数の転送
-            glm::mat4 mvMat = viewMat * modelMat;
-            glm::mat4 normMat = glm::transpose(glm::inverse(mvMat));
-            glm::mat4 mvpMat = projMat * viewMat * modelMat;
-            glm::mat4 lightMat = viewMat;
-
-            GLuint uid;
-            uid = glGetUniformLocation(programId, "u_mvpMat");
-            glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvpMat));
-            uid = glGetUniformLocation(programId, "u_mvMat");
-            glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvMat));
-            uid = glGetUniformLocation(programId, "u_normMat");
-            glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(normMat));
-            uid = glGetUniformLocation(programId, "u_lightMat");
-            glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(lightMat));
-
-            uid = glGetUniformLocation(programId, "u_lightPos");
-            glUniform3fv(uid, 1, glm::value_ptr(lightPos));
-            uid = glGetUniformLocation(programId, "u_diffColor");
-            glUniform3fv(uid, 1, glm::value_ptr(goldMat.diffColor));
-            uid = glGetUniformLocation(programId, "u_specColor");
-            glUniform3fv(uid, 1, glm::value_ptr(goldMat.specColor));
-            uid = glGetUniformLocation(programId, "u_ambiColor");
-            glUniform3fv(uid, 1, glm::value_ptr(goldMat.ambiColor));
-            uid = glGetUniformLocation(programId, "u_shininess");
-            glUniform1f(uid, goldMat.shininess);
-
-            uid = glGetUniformLocation(programId, "u_enableSM");
-            glUniform1i(uid, 0);
-
-            // VAOの有効化
-            glBindVertexArray(objectVao.vaoId);
-
-            // 三角形の描画
-            glDrawElements(GL_TRIANGLES, objectVao.indexBufferSize, GL_UNSIGNED_INT, 0);
-
-            // VAOの無効化
-            glBindVertexArray(0);        
-        }
+        program.set("u_lightBiasVP", lightBiasVP);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, shadowMap.colorTexId);
+        program.set("u_depthTex", 0);
+        program.set("u_drawData", 1);
+
+        // すべての物体をまとめて描画
+        renderDrawList.draw(program.uniformLocation("u_drawId"));
     }
-    // シェーダの無効化
+    // VAOとシェーダの無効化
+    glBindVertexArray(0);
     glUseProgram(0);
 }
 
@@ -549,6 +417,7 @@ void resizeGL(GLFWwindow *window, int width, int height) {
 
 // アニメーションのためのアップデート
 void animate() {
+    prevTheta = theta;
     theta += 1.0f;  // 10分の1回転
 }
 
@@ -593,13 +462,17 @@ int main(int argc, char **argv) {
     initializeGL();
 
     // メインループ
+    timestep.reset(glfwGetTime());
     while (glfwWindowShouldClose(window) == GL_FALSE) {
+        // アニメーション (経過時間に応じて0回以上進める)
+        const int steps = timestep.advance(glfwGetTime());
+        for (int i = 0; i < steps; i++) {
+            animate();
+        }
+
         // 描画
         paintGL();
 
-        // アニメーション
-        animate();
-
         // 描画用バッファの切り替え
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -4,23 +4,30 @@ in vec3 f_positionCameraSpace;
 in vec3 f_normalCameraSpace;
 in vec3 f_lightPosCameraSpace;
 in vec4 f_positionLightSpace;
+flat in int f_materialId;
+flat in int f_enableSM;
 
 out vec4 out_color;
 
-// マテリアルのデータ
-uniform vec3 u_diffColor;
-uniform vec3 u_specColor;
-uniform vec3 u_ambiColor;
-uniform float u_shininess;
+// マテリアルのデータ (描画ごとに番号で選ぶ)
+struct Material {
+    vec3 ambiColor;
+    vec3 diffColor;
+    vec3 specColor;
+    float shininess;
+};
+
+layout(std140) uniform MaterialBlock {
+    Material u_materials[2];
+};
 
 // シャドウ・マップのための深度テクスチャ
 uniform sampler2D u_depthTex;
-uniform bool u_enableSM;
 
 void main() {
 	// 影の計算
 	float visibility = 1.0;
-	if (u_enableSM) {
+	if (f_enableSM != 0) {
 		if (f_positionLightSpace.w >= 0.0) {
 			vec2 texcoord = (f_positionLightSpace.xy / f_positionLightSpace.w) * 0.5 + 0.5;
 			float zValue = f_positionLightSpace.z / f_positionLightSpace.w;
@@ -38,11 +45,12 @@ void main() {
 	vec3 H = normalize(V + L);
 
 	// Blinn-Phongの反射モデル
+	Material material = u_materials[f_materialId];
 	float ndotl = max(0.0, dot(N, L));
 	float ndoth = max(0.0, dot(N, H));
-	vec3 diffuse = u_diffColor * ndotl;
-	vec3 specular = u_specColor * pow(ndoth, u_shininess);
-	vec3 ambient = u_ambiColor;
+	vec3 diffuse = material.diffColor * ndotl;
+	vec3 specular = material.specColor * pow(ndoth, material.shininess);
+	vec3 ambient = material.ambiColor;
 
     out_color = vec4(visibility * (diffuse + specular + ambient), 1.0);
 }
@@ -1,5 +1,14 @@
 #version 330
 
+// 間接描画ではビルド時に USE_MULTI_DRAW が定義され, 描画番号を gl_DrawIDARB から取る
+#ifdef USE_MULTI_DRAW
+#extension GL_ARB_shader_draw_parameters : require
+#define DRAW_ID gl_DrawIDARB
+#else
+uniform int u_drawId;
+#define DRAW_ID u_drawId
+#endif
+
 // Attribute変数
 layout(location = 0) in vec3 in_position;
 layout(location = 1) in vec3 in_normal;
@@ -9,23 +18,41 @@ out vec3 f_positionCameraSpace;
 out vec3 f_normalCameraSpace;
 out vec3 f_lightPosCameraSpace;
 out vec4 f_positionLightSpace;
+flat out int f_materialId;
+flat out int f_enableSM;
 
-// 光源の情報
-uniform vec3 u_lightPos;
+// フレームごとのカメラと光源の情報
+layout(std140) uniform FrameBlock {
+    mat4 u_viewMat;
+    mat4 u_projMat;
+    vec4 u_lightPos;
+};
 
-// 各種変換行列
-uniform mat4 u_mvMat;
-uniform mat4 u_mvpMat;
-uniform mat4 u_normMat;
-uniform mat4 u_lightMat;
-uniform mat4 u_lightBiasMVP;
+// 描画ごとのデータ (変換行列, 法線の変換行列の3列, 材質の番号と影の有無の計8テクセル)
+uniform samplerBuffer u_drawData;
+uniform mat4 u_lightBiasVP;
 
 void main() {
-    gl_Position = u_mvpMat * vec4(in_position, 1.0);
+    int base = DRAW_ID * 8;
+    mat4 modelMat = mat4(texelFetch(u_drawData, base + 0),
+                         texelFetch(u_drawData, base + 1),
+                         texelFetch(u_drawData, base + 2),
+                         texelFetch(u_drawData, base + 3));
+    mat3 normalMat = mat3(texelFetch(u_drawData, base + 4).xyz,
+                          texelFetch(u_drawData, base + 5).xyz,
+                          texelFetch(u_drawData, base + 6).xyz);
+    vec4 params = texelFetch(u_drawData, base + 7);
+
+    vec4 positionWorldSpace = modelMat * vec4(in_position, 1.0);
+    vec4 positionCameraSpace = u_viewMat * positionWorldSpace;
+    gl_Position = u_projMat * positionCameraSpace;
+
+    // カメラ座標系への変換 (ビュー変換は回転と平行移動だけなので, 法線にもそのまま使える)
+	f_positionCameraSpace = positionCameraSpace.xyz;
+	f_normalCameraSpace = mat3(u_viewMat) * (normalMat * in_normal);
+	f_lightPosCameraSpace = (u_viewMat * u_lightPos).xyz;
+    f_positionLightSpace = u_lightBiasVP * positionWorldSpace;
 
-    // カメラ座標系への変換
-	f_positionCameraSpace = (u_mvMat * vec4(in_position, 1.0)).xyz;
-	f_normalCameraSpace = (u_normMat * vec4(in_normal, 0.0)).xyz;
-	f_lightPosCameraSpace = (u_lightMat * vec4(u_lightPos, 1.0)).xyz;
-    f_positionLightSpace = u_lightBiasMVP * vec4(in_position, 1.0);
+    f_materialId = int(params.x);
+    f_enableSM = int(params.y);
 }
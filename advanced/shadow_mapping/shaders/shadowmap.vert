@@ -1,16 +1,34 @@
 #version 330
 
+// 間接描画ではビルド時に USE_MULTI_DRAW が定義され, 描画番号を gl_DrawIDARB から取る
+#ifdef USE_MULTI_DRAW
+#extension GL_ARB_shader_draw_parameters : require
+#define DRAW_ID gl_DrawIDARB
+#else
+uniform int u_drawId;
+#define DRAW_ID u_drawId
+#endif
+
 // Attribute変数
 layout(location = 0) in vec3 in_position;
 
 // Varying変数
 out vec4 f_positionLightSpace;
 
-// 各種変換行列
-uniform mat4 u_mvpMat;
+// 描画ごとのデータ (先頭の4テクセルが変換行列)
+uniform samplerBuffer u_drawData;
+
+// ライトから見たときのVP行列
+uniform mat4 u_lightVP;
 
 void main() {
-    gl_Position = u_mvpMat * vec4(in_position, 1.0);
+    int base = DRAW_ID * 8;
+    mat4 modelMat = mat4(texelFetch(u_drawData, base + 0),
+                         texelFetch(u_drawData, base + 1),
+                         texelFetch(u_drawData, base + 2),
+                         texelFetch(u_drawData, base + 3));
+
+    gl_Position = u_lightVP * modelMat * vec4(in_position, 1.0);
 
     // ライトから見たときの座標
     f_positionLightSpace = gl_Position;
@@ -1,10 +1,14 @@
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <iostream>
 #include <string>
 #include <algorithm>
-#include <deque>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 #define GLAD_GL_IMPLEMENTATION
 #include <glad/gl.h>
@@ -24,6 +28,27 @@
 #include "tiny_obj_loader.h"
 
 #include "common.h"
+#include "texture_atlas.h"
+#include "replay.h"
+#include <glutils/shader_builder.h>
+#include <glutils/shader_program.h>
+#include <glutils/uniform_buffer.h>
+#include <glutils/render_queue.h>
+#include <glutils/stream_buffer.h>
+#include <glutils/frustum_culling.h>
+#include <glutils/occlusion_culling.h>
+#include <glutils/spatial_hash.h>
+#include <glutils/entity_pool.h>
+#include <glutils/fixed_timestep.h>
+#include <glutils/particle_system.h>
+#include <glutils/job_system.h>
+#include <glutils/frame_arena.h>
+#include <glutils/scene_graph.h>
+#include <glutils/triple_buffer.h>
+
+// ヒープからの確保の回数を数える (フレームごとに確保が起きていないかを確かめる)
+#define GLUTILS_ALLOCATION_COUNTER_IMPLEMENTATION
+#include <glutils/allocation_counter.h>
 
 static int WIN_WIDTH   = 800;                       // ウィンドウの幅
 static int WIN_HEIGHT  = 600;                       // ウィンドウの高さ
@@ -51,14 +76,88 @@ static const std::string CLEAR_TEXFILE    = std::string(DATA_DIRECTORY) + "clear
 
 static const std::string RENDER_SHADER    = std::string(SHADER_DIRECTORY) + "render";
 static const std::string TEXTURE_SHADER   = std::string(SHADER_DIRECTORY) + "texture";
+static const std::string INSTANCED_SHADER = std::string(SHADER_DIRECTORY) + "instanced";
+static const std::string PARTICLE_SHADER  = std::string(SHADER_DIRECTORY) + "particle";
 
 static const glm::vec3 cameraPos = glm::vec3(0.0f, 100.0f, 0.0f);
 static const glm::vec3 eyeTo = glm::vec3(0.0f, 0.0f, 0.0f);
 static const glm::vec3 upVec = glm::vec3(0.0f, 0.0f, -1.0f);
 static const glm::vec3 lightPos = glm::vec3(0.0f, 50.0f, 0.0f);
 
-std::deque<glm::vec3> bulletPos;
-std::deque<glm::vec3> balloonPos;
+// 弾と風船 (位置と速度を配列で持ち, 削除は末尾の要素との入れ替えで行う)
+EntityPool bulletPool;
+EntityPool balloonPool;
+
+// 弾の速さ (1秒に進む距離)
+// あたり判定は1ステップの移動をなぞって行うので, 速くしても風船をすり抜けない
+static const glm::vec3 BULLET_VELOCITY = glm::vec3(0.0f, 0.0f, -120.0f);
+
+// 同時に撃てる弾の数
+static const int MAX_BULLETS = 10;
+
+// 風船の並べ方 (コマンドライン引数で変えられる)
+static int balloonRows = 5;
+static int balloonCols = 10;
+
+// フレームごとの一時的なデータを置く領域
+FrameArena frameArena;
+
+// カリングの結果 (インスタンス描画に渡す位置). 毎フレーム frameArena の中に作る
+struct VisibleSet {
+    explicit VisibleSet(FrameArena &arena)
+        : aircraft(false)
+        , balloons(FrameAllocator<glm::vec3>(arena))
+        , bullets(FrameAllocator<glm::vec3>(arena)) {
+    }
+
+    bool aircraft;
+    FrameVector<glm::vec3> balloons;
+    FrameVector<glm::vec3> bullets;
+};
+
+// 直前に描いたフレームのカリングの結果 (frameArenaは2フレーム分あるので, 次のフレームを描く間も読める)
+const VisibleSet *lastVisible = NULL;
+
+// 直前のフレーム (ステップの更新と描画) でのヒープからの確保の回数
+size_t lastFrameAllocations = 0;
+
+// 視錐台カリングに使う境界球の配列と, 見えた物体の番号
+SphereCullingSet cullingSet;
+std::vector<int> visibleIndices;
+
+// カリング, あたり判定, 粒子の更新, 画像の読み込みで共有するワーカスレッド
+JobSystem jobs;
+
+// CPUで描く深度バッファによる遮蔽カリング (Oキーで切り替え)
+// 飛行機と, カメラに近い順にNUM_OCCLUDER_BALLOONS個の風船を遮蔽物として使う
+static const int NUM_OCCLUDER_BALLOONS = 32;
+OcclusionCuller occlusionCuller(256, 128, &jobs);
+bool enableOcclusionCulling = true;
+
+// 弾と風船が当たったとみなす中心間の距離
+static const float HIT_DISTANCE = 2.0f;
+
+// 風船の位置の空間ハッシュ (あたり判定のたびに作り直す)
+SpatialHash balloonGrid(HIT_DISTANCE * 2.0f);
+
+// 弾ごとに最初に触れる風船の番号 (あたり判定の一時配列)
+std::vector<int> bulletTargets;
+
+// 風船が割れたときに飛び散る破片 (最大数の分を最初に確保しておく)
+static const int MAX_PARTICLES = 65536;
+static const int PARTICLES_PER_HIT = 2000;
+static const float PARTICLE_SPEED = 20.0f;         // 飛び散る速さ (1秒に進む距離)
+static const float PARTICLE_LIFETIME = 1.0f;       // 秒
+static const float PARTICLE_SIZE = 0.5f;
+static const glm::vec3 PARTICLE_GRAVITY = glm::vec3(0.0f, -30.0f, 0.0f);
+ParticleSystem debrisParticles;
+
+// 描画パス (描画命令はパスの順に並べ替えられる)
+enum RenderPass {
+    PASS_BACKGROUND = 0,
+    PASS_OPAQUE,
+    PASS_OVERLAY,
+};
 
 struct Vertex {
     Vertex()
@@ -84,133 +183,105 @@ struct Camera {
 };
 
 Camera camera;
+static const float CAMERA_NEAR = 0.1f;
+static const float CAMERA_FAR = 1000.0f;
+
+// 描画命令をためて並べ替えるキューと, 重複した状態変更を省くためのキャッシュ
+RenderQueue renderQueue;
+GLStateCache glState;
+RenderStats lastStats;
+
+// スプライトや画面表示用の小さなテクスチャをまとめたアトラス
+TextureAtlas atlas;
+
+// 物体ごとの材質を入れるUniformバッファ
+UniformBuffer<MaterialBlock> materialBuffer;
+
+// フレームごとに書き換えるデータ (カメラと光源の情報, 弾と風船の位置) を流し込むバッファ
+StreamBuffer frameStream;
+GLint uniformOffsetAlignment = 256;
+
+// 物体の変換行列 (RenderObjectごとに1つのノードを持つ)
+SceneGraph scene;
+
+// まとめてビルドしたシェーダプログラム (バッチの番号ごとに1つ)
+// 同じシェーダを使う物体は, プログラムと転送済みのUniform変数の値のキャッシュを共有する
+std::vector<ShaderProgram> shaderPrograms;
 
 struct RenderObject {
     GLuint programId;
+    ShaderProgram *program;
+    int shaderIndex;
+    int materialIndex;
     GLuint vaoId;
     GLuint vboId;
     GLuint iboId;
     GLuint textureId;
     int bufferSize;
 
-    glm::mat4 modelMat;
+    int node;   // sceneのノードの番号 (モデル行列はシーングラフが持つ)
     glm::vec3 ambiColor;
     glm::vec3 diffColor;
     glm::vec3 specColor;
     float shininess;
+    glm::vec4 uvRect;
+
+    // モデル座標系での境界 (loadOBJで計算する)
+    BoundingBox bounds;
+    BoundingSphere boundingSphere;
+
+    // CPU側に残す頂点の位置 (3つずつで1つの三角形. 遮蔽物として描くときに使う)
+    std::vector<glm::vec3> positions;
     
     void initialize() {
         programId = 0u;
+        program = NULL;
+        shaderIndex = -1;
+        materialIndex = 0;
         vaoId = 0u;
         vboId = 0u;
         iboId = 0u;
         textureId = 0u;
         bufferSize = 0;
         
+        node = scene.addNode();
         ambiColor = glm::vec3(0.0f, 0.0f, 0.0f);
         diffColor = glm::vec3(1.0f, 1.0f, 1.0f);
         specColor = glm::vec3(0.0f, 0.0f, 0.0f);
+        uvRect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
     }
     
-    void buildShader(const std::string &basename) {
-        const std::string vertShaderFile = basename + ".vert";
-        const std::string fragShaderFile = basename + ".frag";
-    
-        // シェーダの用意
-        GLuint vertShaderId = glCreateShader(GL_VERTEX_SHADER);
-        GLuint fragShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-        
-        // ファイルの読み込み (Vertex shader)
-        std::ifstream vertFileInput(vertShaderFile.c_str(), std::ios::in);
-        if (!vertFileInput.is_open()) {
-            fprintf(stderr, "Failed to load vertex shader: %s\n", vertShaderFile.c_str());
-            exit(1);
-        }
-        std::istreambuf_iterator<char> vertDataBegin(vertFileInput);
-        std::istreambuf_iterator<char> vertDataEnd;
-        const std::string vertFileData(vertDataBegin,vertDataEnd);
-        const char *vertShaderCode = vertFileData.c_str();
+    // モデル行列 (最後に scene.update() したときのもの)
+    const glm::mat4 &modelMat() const {
+        return scene.world(node);
+    }
 
-        // ファイルの読み込み (Fragment shader)
-        std::ifstream fragFileInput(fragShaderFile.c_str(), std::ios::in);
-        if (!fragFileInput.is_open()) {
-            fprintf(stderr, "Failed to load fragment shader: %s\n", fragShaderFile.c_str());
-            exit(1);
-        }
-        std::istreambuf_iterator<char> fragDataBegin(fragFileInput);
-        std::istreambuf_iterator<char> fragDataEnd;
-        const std::string fragFileData(fragDataBegin,fragDataEnd);
-        const char *fragShaderCode = fragFileData.c_str();
-        
-        // シェーダのコンパイル
-        GLint compileStatus;
-        glShaderSource(vertShaderId, 1, &vertShaderCode, NULL);
-        glCompileShader(vertShaderId);
-        glGetShaderiv(vertShaderId, GL_COMPILE_STATUS, &compileStatus);
-        if (compileStatus == GL_FALSE) {
-            fprintf(stderr, "Failed to compile vertex shader!\n");
-            
-            GLint logLength;
-            glGetShaderiv(vertShaderId, GL_INFO_LOG_LENGTH, &logLength);
-            if (logLength > 0) {
-                GLsizei length;
-                char *errmsg = new char[logLength + 1];
-                glGetShaderInfoLog(vertShaderId, logLength, &length, errmsg);
-                
-                std::cerr << errmsg << std::endl;
-                fprintf(stderr, "%s", vertShaderCode);
-                
-                delete[] errmsg;
-            }
-        }
-        
-        glShaderSource(fragShaderId, 1, &fragShaderCode, NULL);
-        glCompileShader(fragShaderId);
-        glGetShaderiv(fragShaderId, GL_COMPILE_STATUS, &compileStatus);
-        if (compileStatus == GL_FALSE) {
-            fprintf(stderr, "Failed to compile fragment shader!\n");
-            
-            GLint logLength;
-            glGetShaderiv(fragShaderId, GL_INFO_LOG_LENGTH, &logLength);
-            if (logLength > 0) {
-                GLsizei length;
-                char *errmsg = new char[logLength + 1];
-                glGetShaderInfoLog(fragShaderId, logLength, &length, errmsg);
-                
-                std::cerr << errmsg << std::endl;
-                fprintf(stderr, "%s", vertShaderCode);
-                
-                delete[] errmsg;
-            }
-        }
-        
-        // シェーダプログラムの用意
-        programId = glCreateProgram();
-        glAttachShader(programId, vertShaderId);
-        glAttachShader(programId, fragShaderId);
-        
-        GLint linkState;
-        glLinkProgram(programId);
-        glGetProgramiv(programId, GL_LINK_STATUS, &linkState);
-        if (linkState == GL_FALSE) {
-            fprintf(stderr, "Failed to link shaders!\n");
-            
-            GLint logLength;
-            glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &logLength);
-            if (logLength > 0) {
-                GLsizei length;
-                char *errmsg = new char[logLength + 1];
-                glGetProgramInfoLog(programId, logLength, &length, errmsg);
-                
-                std::cerr << errmsg << std::endl;
-                delete[] errmsg;
-            }
-            
-            exit(1);
-        }
+    // モデル行列を変える (scene.update() するまで modelMat() には反映されない)
+    void setModelMat(const glm::mat4 &mat) {
+        scene.setLocal(node, mat);
+    }
+
+    // シェーダを登録する (ビルドは他の物体のシェーダとまとめて行う)
+    void addShader(ShaderProgramBatch &batch, const std::string &basename) {
+        shaderIndex = batch.add(basename + ".vert", basename + ".frag");
+    }
+
+    void addShader(ShaderProgramBatch &batch, const std::string &vertFile, const std::string &fragFile) {
+        shaderIndex = batch.add(vertFile, fragFile);
+    }
+
+    // まとめてビルドした結果を受け取る (initShaderPrograms() の後に呼ぶ)
+    void setShader(const ShaderProgramBatch &batch) {
+        programId = batch.program(shaderIndex);
+        program = &shaderPrograms[shaderIndex];
+    }
+
+    MaterialBlock material() const {
+        return MaterialBlock(ambiColor, diffColor, specColor, shininess);
     }
     
-    void loadOBJ(const std::string &filename) {
+    // OBJファイルを読み込み, 頂点の位置と境界だけを計算する (OpenGLは使わない)
+    void loadMesh(const std::string &filename, std::vector<Vertex> *vertices, std::vector<unsigned int> *indices) {
         // Load OBJ file.
         tinyobj::attrib_t attrib;
         std::vector<tinyobj::shape_t> shapes;
@@ -226,8 +297,8 @@ struct RenderObject {
             exit(1);
         }
         
-        std::vector<Vertex> vertices;
-        std::vector<unsigned int> indices;
+        vertices->clear();
+        indices->clear();
         for (int s = 0; s < shapes.size(); s++) {
             const tinyobj::shape_t &shape = shapes[s];
             for (int i = 0; i < shape.mesh.indices.size(); i++) {
@@ -257,10 +328,23 @@ struct RenderObject {
                     );
                 }
                 
-                indices.push_back(vertices.size());
-                vertices.push_back(vertex);
+                indices->push_back(vertices->size());
+                vertices->push_back(vertex);
             }
         }
+
+        // 視錐台カリングのための境界
+        positions.resize(vertices->size());
+        for (size_t i = 0; i < vertices->size(); i++) {
+            positions[i] = (*vertices)[i].position;
+        }
+        computeBounds(positions, &bounds, &boundingSphere);
+    }
+
+    void loadOBJ(const std::string &filename) {
+        std::vector<Vertex> vertices;
+        std::vector<unsigned int> indices;
+        loadMesh(filename, &vertices, &indices);
         
         // Prepare VAO.
         glGenVertexArrays(1, &vaoId);
@@ -269,7 +353,7 @@ struct RenderObject {
         glGenBuffers(1, &vboId);
         glBindBuffer(GL_ARRAY_BUFFER, vboId);
         glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(),
-                     vertices.data(), GL_DYNAMIC_DRAW);
+                     vertices.data(), GL_STATIC_DRAW);
         
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
@@ -286,6 +370,47 @@ struct RenderObject {
         
         glBindVertexArray(0);
     }
+
+    // 粒子を描くための, xy平面上の一辺1の正方形の板を作る (インスタンス属性も有効にする)
+    void createBillboard() {
+        const Vertex vertices[] = {
+            Vertex(glm::vec3(-0.5f, -0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(0.0f, 0.0f)),
+            Vertex(glm::vec3( 0.5f, -0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(1.0f, 0.0f)),
+            Vertex(glm::vec3( 0.5f,  0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(1.0f, 1.0f)),
+            Vertex(glm::vec3(-0.5f,  0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(0.0f, 1.0f)),
+        };
+        const unsigned int indices[] = { 0, 1, 2, 0, 2, 3 };
+
+        glGenVertexArrays(1, &vaoId);
+        glBindVertexArray(vaoId);
+
+        glGenBuffers(1, &vboId);
+        glBindBuffer(GL_ARRAY_BUFFER, vboId);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texcoord));
+
+        glGenBuffers(1, &iboId);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        bufferSize = 6;
+
+        glEnableVertexAttribArray(3);
+        glVertexAttribDivisor(3, 1);
+        glBindVertexArray(0);
+    }
+
+    // インスタンスごとの平行移動を3番の属性から読むようにする (loadOBJの後に呼ぶ)
+    // 参照先のバッファは描画のたびに uploadInstances で設定する
+    void enableInstancing() {
+        glBindVertexArray(vaoId);
+        glEnableVertexAttribArray(3);
+        glVertexAttribDivisor(3, 1);
+        glBindVertexArray(0);
+    }
     
     void loadTexture(const std::string &filename) {
         int texWidth, texHeight, channels;
@@ -307,53 +432,160 @@ struct RenderObject {
         
         stbi_image_free(bytes);
     }
+
+    // アトラスの一部をテクスチャとして使う (同じページを使う物体はテクスチャを共有する)
+    void setAtlasRegion(const TextureAtlas &atlas, const std::string &name) {
+        const AtlasRegion &region = atlas.region(name);
+        textureId = atlas.textureId(region.page);
+        uvRect = region.uvRect;
+    }
     
-    void draw(const Camera &camera) {
-        glUseProgram(programId);
-        
-        GLuint location;
-        location = glGetUniformLocation(programId, "u_ambiColor");
-        glUniform3fv(location, 1, glm::value_ptr(ambiColor));
-        location = glGetUniformLocation(programId, "u_diffColor");
-        glUniform3fv(location, 1, glm::value_ptr(diffColor));
-        location = glGetUniformLocation(programId, "u_specColor");
-        glUniform3fv(location, 1, glm::value_ptr(specColor));
-        location = glGetUniformLocation(programId, "u_shininess");
-        glUniform1f(location, shininess);
+    // 描画命令をキューに積む (実際の描画は RenderQueue::execute でまとめて行う)
+    void submit(RenderQueue &queue, const Camera &camera, RenderPass pass, bool depthTest, bool blend) {
+        DrawItem item = makeDrawItem(camera, pass, depthTest, blend);
+        item.prepare = [this, &camera]() { setUniforms(camera); };
+        queue.submit(item);
+    }
+
+    // 同じ物体をoffsetsの各位置に平行移動して, 1回の描画命令でまとめて描く
+    // (enableInstancing() を呼んでおき, シェーダには instanced.vert を使うこと)
+    void submitInstanced(RenderQueue &queue, const Camera &camera, RenderPass pass,
+                         const FrameVector<glm::vec3> &offsets) {
+        if (offsets.empty()) {
+            return;
+        }
+
+        uploadInstances(offsets);
+
+        DrawItem item = makeDrawItem(camera, pass, true, false);
+        item.instanceCount = (GLsizei)offsets.size();
+        item.prepare = [this, &camera]() { setInstancedUniforms(camera); };
+        queue.submit(item);
+    }
+
+    // 粒子ごとに板をカメラに向けて, 1回の描画命令でまとめて描く
+    // (createBillboard() で作った板を使い, シェーダには particle.vert を使うこと)
+    void submitParticles(RenderQueue &queue, const Camera &camera, RenderPass pass,
+                         const ParticleSystem &particles, float size) {
+        if (particles.empty()) {
+            return;
+        }
+
+        // 粒子の配列から描画用の並びへの変換は, ストリーム領域に直接書き込む
+        const int stride = sizeof(float) * ParticleSystem::FLOATS_PER_INSTANCE;
+        GLintptr offset;
+        float *dst = (float*)frameStream.allocate(stride * particles.size(), sizeof(float), &offset);
+        particles.writeInstances(dst);
+        submitParticleInstances(queue, camera, pass, offset, particles.size(), size);
+    }
+
+    // writeInstances() の並びに書き出し済みの粒子を描く (別のスレッドから受け取った写しに使う)
+    void submitParticles(RenderQueue &queue, const Camera &camera, RenderPass pass,
+                         const std::vector<float> &instances, int count, float size) {
+        if (count == 0) {
+            return;
+        }
+
+        const int stride = sizeof(float) * ParticleSystem::FLOATS_PER_INSTANCE;
+        GLintptr offset;
+        void *dst = frameStream.allocate(stride * count, sizeof(float), &offset);
+        memcpy(dst, instances.data(), stride * count);
+        submitParticleInstances(queue, camera, pass, offset, count, size);
+    }
+
+private:
+    // ストリーム領域の offset から並ぶ count 個の粒子の描画命令を積む
+    void submitParticleInstances(RenderQueue &queue, const Camera &camera, RenderPass pass,
+                                 GLintptr offset, int count, float size) {
+        bindInstanceAttribute(offset, ParticleSystem::FLOATS_PER_INSTANCE);
+
+        DrawItem item = makeDrawItem(camera, pass, true, false);
+        item.instanceCount = (GLsizei)count;
+        item.prepare = [this, size]() {
+            materialBuffer.bind(MATERIAL_BLOCK_BINDING, materialIndex);
+            program->set("u_particleSize", size);
+        };
+        queue.submit(item);
+    }
+
+    DrawItem makeDrawItem(const Camera &camera, RenderPass pass, bool depthTest, bool blend) const {
+        // 物体の原点のカメラからの距離で, 同じ状態の物体を手前から並べる
+        const float depth = -(camera.viewMat * modelMat()[3]).z;
+
+        DrawItem item;
+        item.key = RenderQueue::makeKey(pass, programId, materialIndex, textureId,
+                                        RenderQueue::quantizeDepth(depth, CAMERA_NEAR, CAMERA_FAR));
+        item.programId = programId;
+        item.vaoId = vaoId;
+        item.textureId = textureId;
+        item.depthTest = depthTest;
+        item.blend = blend;
+        item.count = bufferSize;
+        return item;
+    }
+
+    // プログラムとVAOはキューが有効にしてから呼ぶ
+    void setUniforms(const Camera &camera) {
+        // 材質はUniformバッファ内の範囲を割り当てるだけ
+        materialBuffer.bind(MATERIAL_BLOCK_BINDING, materialIndex);
 
         glm::mat4 mvMat, mvpMat, normMat;
-        mvMat = camera.viewMat * modelMat;
+        mvMat = camera.viewMat * modelMat();
         mvpMat = camera.projMat * mvMat;
-        normMat = glm::transpose(glm::inverse(mvMat));
+        normMat = viewNormalMat(camera);
         
-        location = glGetUniformLocation(programId, "u_lightPos");
-        glUniform3fv(location, 1, glm::value_ptr(lightPos));
-        location = glGetUniformLocation(programId, "u_lightMat");
-        glUniformMatrix4fv(location, 1, false, glm::value_ptr(camera.viewMat));
-        location = glGetUniformLocation(programId, "u_mvMat");
-        glUniformMatrix4fv(location, 1, false, glm::value_ptr(mvMat));
-        location = glGetUniformLocation(programId, "u_mvpMat");
-        glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(mvpMat));
-        location = glGetUniformLocation(programId, "u_normMat");
-        glUniformMatrix4fv(location, 1, false, glm::value_ptr(normMat));
+        // 名前から位置を引く表を使い, 前回と同じ値の転送は省く
+        program->set("u_mvMat", mvMat);
+        program->set("u_mvpMat", mvpMat);
+        program->set("u_normMat", normMat);
         
+        program->set("u_uvRect", uvRect);
+        setTextureUniforms();
+    }
+
+    void setInstancedUniforms(const Camera &camera) {
+        materialBuffer.bind(MATERIAL_BLOCK_BINDING, materialIndex);
+
+        // 平行移動は法線の向きを変えないので, 法線の変換行列は全インスタンスで共通
+        glm::mat4 normMat = viewNormalMat(camera);
+        program->set("u_modelMat", modelMat());
+        program->set("u_normMat", normMat);
+        program->set("u_uvRect", uvRect);
+        setTextureUniforms();
+    }
+
+    // カメラ座標系での法線の変換行列
+    // ビュー行列は回転と平行移動だけ (lookAtで作る) なので, その左上3x3の逆転置はそれ自身になり,
+    // シーングラフが物体の動いたときだけ計算しておく法線の変換行列に掛けるだけで済む
+    glm::mat4 viewNormalMat(const Camera &camera) const {
+        return glm::mat4(glm::mat3(camera.viewMat) * scene.normalMatrix(node));
+    }
+
+    // テクスチャ自体はキューが割り当てるので, ここではシェーダに使うかどうかを伝えるだけ
+    void setTextureUniforms() {
         if (textureId != 0) {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, textureId);
-            location = glGetUniformLocation(programId, "u_isTextured");
-            glUniform1i(location, 1);
-            location = glGetUniformLocation(programId, "u_texture");
-            glUniform1i(location, 0);
+            program->set("u_isTextured", 1);
+            program->set("u_texture", 0);
         } else {
-            location = glGetUniformLocation(programId, "u_isTextured");
-            glUniform1i(location, 0);
+            program->set("u_isTextured", 0);
         }
-        
-        glBindVertexArray(vaoId);
-        glDrawElements(GL_TRIANGLES, bufferSize, GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+    }
+
+    // 位置をこのフレームのストリーム領域に書き込み, 3番の属性の参照先をそこに付け替える
+    void uploadInstances(const FrameVector<glm::vec3> &offsets) {
+        GLintptr offset;
+        void *dst = frameStream.allocate(sizeof(glm::vec3) * offsets.size(), sizeof(float), &offset);
+        memcpy(dst, offsets.data(), sizeof(glm::vec3) * offsets.size());
+        bindInstanceAttribute(offset, 3);
+    }
 
-        glUseProgram(0);
+    // 3番の属性の参照先を, ストリーム領域のoffsetから float が components 個ずつ並んだものにする
+    // (VAOの切り替えはキューと同じ状態キャッシュを通す)
+    void bindInstanceAttribute(GLintptr offset, int components) {
+        glState.bindVertexArray(vaoId);
+        glBindBuffer(GL_ARRAY_BUFFER, frameStream.id());
+        glVertexAttribPointer(3, components, GL_FLOAT, GL_FALSE, sizeof(float) * components, (void*)offset);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
 };
 
@@ -363,9 +595,29 @@ RenderObject balloon;
 RenderObject sky;
 RenderObject startDisp;
 RenderObject clearDisp;
+RenderObject debris;
 float aircraftVelo = 0.0f;
 float aircraftAcc = 0.05f;
 
+// 飛行機の位置 (描画では直前のステップの位置との間を補間して aircraft のモデル行列にする)
+glm::vec3 aircraftPos = glm::vec3(0.0f, 0.0f, 30.0f);
+glm::vec3 prevAircraftPos = aircraftPos;
+
+// ゲームは描画の速さによらず, 1秒に60回の一定の間隔で進める
+FixedTimestep timestep(1.0 / 60.0);
+
+// 描画用に補間した弾の位置
+std::vector<glm::vec3> bulletRenderPos;
+
+// 風船の配置などに使う乱数の種 (記録の再生では記録した種を使う)
+unsigned int gameSeed = (unsigned int)time(0);
+
+// 押し続けているキー (メインスレッドがフレームごとに調べる) と,
+// コールバックで押されたキー (次のステップの入力として1回だけ使う)
+// シミュレーション用のスレッドからも読むのでアトミックにする
+std::atomic<unsigned int> heldInput(0u);
+std::atomic<unsigned int> pressedInput(0u);
+
 enum {
     GAME_MODE_START,
     GAME_MODE_PLAY,
@@ -374,132 +626,638 @@ enum {
 
 int gameMode = GAME_MODE_START;
 
+// シミュレーション用のスレッドから描画用のスレッドに渡すゲームの状態 (描画に使うものだけ)
+struct GameSnapshot {
+    GameSnapshot()
+        : gameMode(GAME_MODE_START)
+        , numParticles(0)
+        , time(0.0) {
+    }
+
+    int gameMode;
+    glm::vec3 prevAircraftPos;
+    glm::vec3 aircraftPos;
+    std::vector<glm::vec3> prevBulletPositions;
+    std::vector<glm::vec3> bulletPositions;
+    std::vector<glm::vec3> balloonPositions;
+    std::vector<float> particleInstances;   // ParticleSystem::writeInstances() の並び
+    int numParticles;
+    double time;    // 最後のステップを終えた時刻
+};
+
+// 起動時に --sim-thread を付けると, update() を別のスレッドで進める (重いステップがあっても描画が止まらない)
+// ゲームの状態はそのスレッドだけが触り, 描画側には三重バッファの受け渡し口で写しを渡す
+bool useSimulationThread = false;
+TripleBuffer<GameSnapshot> gameMailbox;
+std::atomic<bool> quitSimulation(false);
+
 float sign(float x) {
     if (x < -1.0e-8f) return -1.0f;
     if (x >  1.0e-8f) return  1.0f;
     return 0.0f;
 }
 
+// 位置だけが違う物体のうち, 視錐台と交わるものの位置をvisibleOffsetsに書き出す
+void cullInstances(const Frustum &frustum, const RenderObject &object, const std::vector<glm::vec3> &positions,
+                   FrameVector<glm::vec3> *visibleOffsets) {
+    const BoundingSphere sphere = object.boundingSphere.transformed(object.modelMat());
+
+    cullingSet.clear();
+    cullingSet.reserve(positions.size());
+    for (size_t i = 0; i < positions.size(); i++) {
+        cullingSet.add(positions[i] + sphere.center, sphere.radius);
+    }
+    cullingSet.cull(frustum, &visibleIndices);
+
+    visibleOffsets->clear();
+    visibleOffsets->reserve(visibleIndices.size());
+    for (size_t i = 0; i < visibleIndices.size(); i++) {
+        visibleOffsets->push_back(positions[visibleIndices[i]]);
+    }
+}
+
+// カメラに近い風船を遮蔽物として深度バッファに描く (offsetsは視錐台カリング後の位置)
+void addOccluderInstances(const glm::vec3 &eyePos, const RenderObject &object, FrameVector<glm::vec3> *offsets) {
+    const size_t count = std::min(offsets->size(), (size_t)NUM_OCCLUDER_BALLOONS);
+    std::partial_sort(offsets->begin(), offsets->begin() + count, offsets->end(),
+                      [&eyePos](const glm::vec3 &a, const glm::vec3 &b) {
+                          return glm::dot(a - eyePos, a - eyePos) < glm::dot(b - eyePos, b - eyePos);
+                      });
+
+    for (size_t i = 0; i < count; i++) {
+        occlusionCuller.addOccluder(object.positions, glm::translate((*offsets)[i]) * object.modelMat());
+    }
+}
+
+// 遮蔽物に隠れている位置をoffsetsから取り除く
+void occludeInstances(const RenderObject &object, FrameVector<glm::vec3> *offsets) {
+    size_t visible = 0;
+    for (size_t i = 0; i < offsets->size(); i++) {
+        if (occlusionCuller.isVisible(object.bounds, glm::translate((*offsets)[i]) * object.modelMat())) {
+            (*offsets)[visible++] = (*offsets)[i];
+        }
+    }
+    offsets->resize(visible);
+}
+
+// p0からp1へ動く点が, centerを中心とする半径radiusの球に入る最初の時刻 t (0〜1) を求める
+// (弾の大きさは HIT_DISTANCE に含めるので, 動く球と止まった球の判定は線分と球の判定になる)
+bool sweepPointSphere(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &center, float radius, float *t) {
+    const glm::vec3 d = p1 - p0;
+    const glm::vec3 m = p0 - center;
+    const float c = glm::dot(m, m) - radius * radius;
+    if (c <= 0.0f) {
+        // 最初から球の中にいる
+        *t = 0.0f;
+        return true;
+    }
+
+    // |m + t d|^2 = radius^2 の小さい方の解. 球から遠ざかる場合と止まっている場合は当たらない
+    const float a = glm::dot(d, d);
+    const float b = glm::dot(m, d);
+    if (b >= 0.0f || a <= 0.0f) {
+        return false;
+    }
+
+    const float disc = b * b - a * c;
+    if (disc < 0.0f) {
+        return false;
+    }
+
+    *t = (-b - std::sqrt(disc)) / a;
+    return *t <= 1.0f;
+}
+
+// 弾と風船のあたり判定. 当たった弾と風船を取り除き, 当たった数を返す
+// 弾は直前のステップの位置から現在の位置までの移動をなぞり, 配列の順に, まだ当たっていない風船のうち
+// 最も早く触れるもの (同時なら配列で最も前にあるもの) と当たる
+// 判定の間は印を付けるだけにして, 最後にまとめて取り除く
+// particlesを渡すと, 割れた風船の位置から破片を飛び散らせる
+int collideBullets(EntityPool &bullets, EntityPool &balloons, ParticleSystem *particles = NULL) {
+    balloonGrid.build(balloons.positions().begin(), balloons.positions().end());
+
+    // i番目の弾が生きている風船のうち最初に触れるものを探す
+    // 移動の線分を囲む球の中にある風船だけを候補にする
+    auto findTarget = [&](int i) -> int {
+        const glm::vec3 &p0 = bullets.previousPosition(i);
+        const glm::vec3 &p1 = bullets.position(i);
+        const glm::vec3 mid = (p0 + p1) * 0.5f;
+        const float reach = glm::length(p1 - p0) * 0.5f + HIT_DISTANCE;
+
+        int target = -1;
+        float targetTime = 0.0f;
+        balloonGrid.query(mid, reach, [&](int j) {
+            float t;
+            if (!balloons.isAlive(j) || !sweepPointSphere(p0, p1, balloons.position(j), HIT_DISTANCE, &t)) {
+                return;
+            }
+
+            if (target < 0 || t < targetTime || (t == targetTime && j < target)) {
+                target = j;
+                targetTime = t;
+            }
+        });
+        return target;
+    };
+
+    // 先に, ほかの弾のことは考えずに弾ごとの相手を並列に探しておく (この間は印を付けない)
+    bulletTargets.resize(bullets.size());
+    jobs.parallelFor(bullets.size(), 64, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            bulletTargets[i] = findTarget(i);
+        }
+    });
+
+    // 弾の順に当てる. 前の弾が同じ風船を割っていたら, 残りの風船から探し直す
+    // (最初に触れる風船が残っていれば, 残りの風船の中でもそれが最初なので結果は順に調べた場合と同じ)
+    int hits = 0;
+    for (int i = 0; i < bullets.size(); i++) {
+        int target = bulletTargets[i];
+        if (target >= 0 && !balloons.isAlive(target)) {
+            target = findTarget(i);
+        }
+
+        if (target >= 0) {
+            bullets.kill(i);
+            balloons.kill(target);
+            hits++;
+
+            if (particles != NULL) {
+                particles->emitBurst(balloons.position(target), PARTICLES_PER_HIT, PARTICLE_SPEED, PARTICLE_LIFETIME);
+            }
+        }
+    }
+
+    if (hits > 0) {
+        bullets.removeDead();
+        balloons.removeDead();
+    }
+    return hits;
+}
+
+// 空間ハッシュを使わない総当たりのあたり判定 (速度の比較と結果の確認用)
+int collideBulletsBruteForce(EntityPool &bullets, EntityPool &balloons) {
+    int hits = 0;
+    for (int i = 0; i < bullets.size(); i++) {
+        int target = -1;
+        float targetTime = 0.0f;
+        for (int j = 0; j < balloons.size(); j++) {
+            float t;
+            if (balloons.isAlive(j) &&
+                sweepPointSphere(bullets.previousPosition(i), bullets.position(i), balloons.position(j), HIT_DISTANCE, &t) &&
+                (target < 0 || t < targetTime)) {
+                target = j;
+                targetTime = t;
+            }
+        }
+
+        if (target >= 0) {
+            bullets.kill(i);
+            balloons.kill(target);
+            hits++;
+        }
+    }
+
+    if (hits > 0) {
+        bullets.removeDead();
+        balloons.removeDead();
+    }
+    return hits;
+}
+
+// あたり判定の速度の計測 (ウィンドウは作らない)
+// 格子状に並べた風船の間に弾をばらまいて1ステップ動かし, 空間ハッシュと総当たりで時間を比べる
+void benchmarkCollision(int numBalloons, int numBullets) {
+    const int cols = std::max(1, (int)std::sqrt((float)numBalloons));
+    EntityPool balloons;
+    for (int i = 0; i < numBalloons; i++) {
+        balloons.create(glm::vec3((i % cols) * 10.0f, 0.0f, (i / cols) * -10.0f));
+    }
+
+    srand(0);
+    const float width = cols * 10.0f;
+    const float depth = ((numBalloons + cols - 1) / cols) * 10.0f;
+    EntityPool bullets;
+    for (int i = 0; i < numBullets; i++) {
+        bullets.create(glm::vec3(width * rand() / (float)RAND_MAX, 0.0f, -depth * rand() / (float)RAND_MAX),
+                       BULLET_VELOCITY);
+    }
+    bullets.integrate((float)timestep.stepSeconds());
+
+    typedef std::chrono::high_resolution_clock Clock;
+    const int repeats = 10;
+    double hashMs = 0.0, bruteForceMs = 0.0;
+    int hashHits = 0, bruteForceHits = 0;
+    EntityPool hashBullets, hashBalloons, bruteBullets, bruteBalloons;
+    for (int r = 0; r < repeats; r++) {
+        hashBullets = bullets;
+        hashBalloons = balloons;
+        Clock::time_point start = Clock::now();
+        hashHits = collideBullets(hashBullets, hashBalloons);
+        hashMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        bruteBullets = bullets;
+        bruteBalloons = balloons;
+        start = Clock::now();
+        bruteForceHits = collideBulletsBruteForce(bruteBullets, bruteBalloons);
+        bruteForceMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    printf("Collision of %d bullets and %d balloons: %d hits\n", numBullets, numBalloons, hashHits);
+    printf("  brute force:  %.3f ms\n", bruteForceMs / repeats);
+    printf("  spatial hash: %.3f ms (x%.2f)\n", hashMs / repeats, bruteForceMs / hashMs);
+    if (hashHits != bruteForceHits || hashBullets.positions() != bruteBullets.positions() ||
+        hashBalloons.positions() != bruteBalloons.positions()) {
+        fprintf(stderr, "Collision results do not match!\n");
+        exit(1);
+    }
+}
+
+// カリングの速度の計測 (ウィンドウは作らない)
+// カメラの周りにばらまいた球を, SIMD版とそうでない版で判定して時間を比べる
+void benchmarkCulling(int count) {
+    const glm::mat4 projMat = glm::perspective(45.0f, 800.0f / 600.0f, CAMERA_NEAR, CAMERA_FAR);
+    const glm::mat4 viewMat = glm::lookAt(glm::vec3(0.0f, 40.0f, 80.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const Frustum frustum(projMat * viewMat);
+
+    srand(0);
+    SphereCullingSet set;
+    set.reserve(count);
+    for (int i = 0; i < count; i++) {
+        const glm::vec3 p = glm::vec3(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX, rand() / (float)RAND_MAX);
+        set.add(p * 1000.0f - glm::vec3(500.0f), 1.0f + 4.0f * rand() / (float)RAND_MAX);
+    }
+
+    typedef std::chrono::high_resolution_clock Clock;
+    const int repeats = 20;
+    std::vector<int> visibleScalar, visibleSimd;
+
+    Clock::time_point start = Clock::now();
+    for (int r = 0; r < repeats; r++) {
+        set.cullScalar(frustum, &visibleScalar);
+    }
+    const double scalarMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / repeats;
+
+    start = Clock::now();
+    for (int r = 0; r < repeats; r++) {
+        set.cull(frustum, &visibleSimd);
+    }
+    const double simdMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / repeats;
+
+    printf("Culling %d spheres: %d visible\n", count, (int)visibleSimd.size());
+    printf("  scalar: %.3f ms\n", scalarMs);
+    printf("  %s: %.3f ms (x%.2f)\n", SphereCullingSet::isSimd() ? "SSE" : "scalar (no SSE)", simdMs, scalarMs / simdMs);
+    if (visibleScalar != visibleSimd) {
+        fprintf(stderr, "Culling results do not match!\n");
+        exit(1);
+    }
+}
+
+// 粒子の更新の速度の計測 (ウィンドウは作らない)
+// 寿命が尽きた分を毎ステップ破裂で補い, count個の粒子が生きている状態を保ったまま時間を計る
+void benchmarkParticles(int count) {
+    ParticleSystem particles;
+    particles.reserve(count);
+    particles.setSeed(1u);
+
+    typedef std::chrono::high_resolution_clock Clock;
+    const float dt = (float)timestep.stepSeconds();
+    const int steps = 300;
+    std::vector<float> instances((size_t)count * ParticleSystem::FLOATS_PER_INSTANCE);
+    double emitMs = 0.0, updateMs = 0.0, writeMs = 0.0;
+    int minAlive = count;
+    for (int s = 0; s < steps; s++) {
+        Clock::time_point start = Clock::now();
+        while (particles.size() < count) {
+            const glm::vec3 center((s % 10) * 10.0f - 45.0f, 0.0f, (s % 5) * -10.0f);
+            particles.emitBurst(center, PARTICLES_PER_HIT, PARTICLE_SPEED, PARTICLE_LIFETIME);
+        }
+        emitMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        start = Clock::now();
+        particles.update(dt, PARTICLE_GRAVITY, &jobs);
+        updateMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        minAlive = std::min(minAlive, particles.size());
+
+        // 描画用の並びへの変換 (ゲームではストリーム用のバッファに直接書き込む)
+        start = Clock::now();
+        particles.writeInstances(instances.data());
+        writeMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    printf("Particles: %d live (at least %d after update), %d steps, %s, %d threads\n",
+           count, minAlive, steps, ParticleSystem::isSimd() ? "SSE" : "scalar (no SSE)", jobs.numThreads());
+    printf("  emit:   %.3f ms/step\n", emitMs / steps);
+    printf("  update: %.3f ms/step\n", updateMs / steps);
+    printf("  write:  %.3f ms/step (%.1f MB)\n", writeMs / steps,
+           count * sizeof(float) * ParticleSystem::FLOATS_PER_INSTANCE / (1024.0 * 1024.0));
+}
+
 void gameInit() {
     // 飛行機の位置の初期化
-    aircraft.modelMat = glm::translate(glm::vec3(0.0f, 0.0f, 30.0f));
+    aircraftPos = glm::vec3(0.0f, 0.0f, 30.0f);
+    prevAircraftPos = aircraftPos;
 
-    // 弾の初期化
-    bulletPos.clear();
+    // 弾と破片の初期化 (弾は最大数の分を確保しておく)
+    bulletPool.clear();
+    bulletPool.reserve(MAX_BULLETS);
+    debrisParticles.clear();
+    debrisParticles.setSeed(gameSeed);
 
     // 風船の配置
-    srand((unsigned long)time(0));
+    srand(gameSeed);
+
+    balloonPool.clear();
+    balloonPool.reserve(balloonRows * balloonCols);
+    for (int i = 0; i < balloonRows; i++) {
+        for (int j = 0; j < balloonCols; j++) {
+            float rx = j * 10.0f - (balloonCols - 1) * 5.0f;
+            float rz = (i - (balloonRows - 1)) * 10.0f;
+            balloonPool.create(glm::vec3(rx, 0.0f, rz));
+        }
+    }
+}
 
-    const int rows = 5;
-    const int cols = 10;
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            float rx = j * 10.0f - 45.0f;
-            float rz = i * 10.0f - 40.0f;
-            balloonPos.push_back(glm::vec3(rx, 0.0f, rz));
+void initCamera() {
+    float aspect = WIN_WIDTH / (float)WIN_HEIGHT;
+    //camera.projMat = glm::ortho(-50.0f * aspect, 50.0f * aspect, -50.0f, 50.0f, 0.1f, 1000.0f);
+    //camera.viewMat = glm::lookAt(cameraPos, eyeTo, upVec);
+
+    camera.projMat = glm::perspective(45.0f, aspect, CAMERA_NEAR, CAMERA_FAR);
+    camera.viewMat = glm::lookAt(glm::vec3(0.0f, 40.0f, 80.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+void initAtlas() {
+    static const int numFiles = 3;
+    const std::string files[numFiles] = { SKY_TEXFILE, START_TEXFILE, CLEAR_TEXFILE };
+
+    // 画像の展開はファイルごとに並列に行い, アトラスへの追加は順に行う
+    unsigned char *bytes[numFiles];
+    int texWidth[numFiles], texHeight[numFiles];
+    jobs.parallelFor(numFiles, 1, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            int channels;
+            bytes[i] = stbi_load(files[i].c_str(), &texWidth[i], &texHeight[i], &channels, STBI_rgb_alpha);
+        }
+    });
+
+    for (int i = 0; i < numFiles; i++) {
+        if (!bytes[i]) {
+            fprintf(stderr, "Failed to load image file: %s\n", files[i].c_str());
+            exit(1);
         }
+
+        atlas.add(files[i], texWidth[i], texHeight[i], bytes[i]);
+        stbi_image_free(bytes[i]);
+    }
+
+    atlas.pack();
+    atlas.upload();
+}
+
+// ビルドしたプログラムごとに, Uniform変数の位置を列挙してUniformブロックの結合点を設定する
+void initShaderPrograms(const ShaderProgramBatch &batch) {
+    shaderPrograms.resize(batch.size());
+    for (int i = 0; i < batch.size(); i++) {
+        shaderPrograms[i].reflect(batch.program(i));
+        shaderPrograms[i].bindUniformBlock("FrameBlock", FRAME_BLOCK_BINDING);
+        shaderPrograms[i].bindUniformBlock("MaterialBlock", MATERIAL_BLOCK_BINDING);
     }
 }
 
 void initializeGL() {
-    glEnable(GL_DEPTH_TEST);
-    glDisable(GL_CULL_FACE);
+    glState.enable(GL_DEPTH_TEST);
+    glState.disable(GL_CULL_FACE);
 
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
+    initAtlas();
+
+    // シェーダはすべて登録してから並列にビルドする
+    ShaderProgramBatch shaderBatch(glfwGetProcAddress);
+
     aircraft.initialize();
     aircraft.loadOBJ(AIRCRAFT_OBJFILE);
-    aircraft.buildShader(RENDER_SHADER);
+    aircraft.addShader(shaderBatch, RENDER_SHADER);
     aircraft.loadTexture(AIRCRAFT_TEXFILE);
-    aircraft.modelMat = glm::translate(glm::vec3(0.0f, 0.0f, 30.0f));
+    aircraft.setModelMat(glm::translate(glm::vec3(0.0f, 0.0f, 30.0f)));
     
     balloon.initialize();
     balloon.loadOBJ(BALLOON_OBJFILE);
-    balloon.buildShader(RENDER_SHADER);
+    balloon.enableInstancing();
+    balloon.addShader(shaderBatch, INSTANCED_SHADER + ".vert", RENDER_SHADER + ".frag");
     balloon.diffColor = glm::vec3(1.0f, 0.0f, 0.0f);
     balloon.specColor = glm::vec3(0.2f, 0.2f, 0.2f);
     balloon.ambiColor = glm::vec3(0.1f, 0.0f, 0.0f);
 
     bullet.initialize();
     bullet.loadOBJ(BULLET_OBJFILE);
-    bullet.buildShader(RENDER_SHADER);
+    bullet.enableInstancing();
+    bullet.addShader(shaderBatch, INSTANCED_SHADER + ".vert", RENDER_SHADER + ".frag");
     bullet.diffColor = glm::vec3(0.5f, 0.5f, 0.0f);
     bullet.specColor = glm::vec3(0.5f, 0.5f, 0.5f);
 
     sky.initialize();
     sky.loadOBJ(SKY_OBJFILE);
-    sky.buildShader(TEXTURE_SHADER);
-    sky.loadTexture(SKY_TEXFILE);
+    sky.addShader(shaderBatch, TEXTURE_SHADER);
+    sky.setAtlasRegion(atlas, SKY_TEXFILE);
 
     startDisp.initialize();
     startDisp.loadOBJ(START_OBJFILE);
-    startDisp.buildShader(TEXTURE_SHADER);
-    startDisp.loadTexture(START_TEXFILE);
+    startDisp.addShader(shaderBatch, TEXTURE_SHADER);
+    startDisp.setAtlasRegion(atlas, START_TEXFILE);
 
     clearDisp.initialize();
     clearDisp.loadOBJ(CLEAR_OBJFILE);
-    clearDisp.buildShader(TEXTURE_SHADER);
-    clearDisp.loadTexture(CLEAR_TEXFILE);
+    clearDisp.addShader(shaderBatch, TEXTURE_SHADER);
+    clearDisp.setAtlasRegion(atlas, CLEAR_TEXFILE);
+
+    debris.initialize();
+    debris.createBillboard();
+    debris.addShader(shaderBatch, PARTICLE_SHADER);
+    debris.diffColor = glm::vec3(1.0f, 0.8f, 0.2f);
+    debris.ambiColor = glm::vec3(0.4f, 0.0f, 0.0f);
+
+    shaderBatch.build();
+    initShaderPrograms(shaderBatch);
+    aircraft.setShader(shaderBatch);
+    balloon.setShader(shaderBatch);
+    bullet.setShader(shaderBatch);
+    sky.setShader(shaderBatch);
+    startDisp.setShader(shaderBatch);
+    clearDisp.setShader(shaderBatch);
+    debris.setShader(shaderBatch);
+
+    // 材質は変わらないので, 最初に1回だけまとめて転送する
+    RenderObject *objects[] = { &aircraft, &balloon, &bullet, &sky, &startDisp, &clearDisp, &debris };
+    const int numObjects = sizeof(objects) / sizeof(objects[0]);
+    materialBuffer.create(numObjects);
+    for (int i = 0; i < numObjects; i++) {
+        objects[i]->materialIndex = i;
+        materialBuffer.update(objects[i]->material(), i);
+    }
 
-    float aspect = WIN_WIDTH / (float)WIN_HEIGHT;
-    //camera.projMat = glm::ortho(-50.0f * aspect, 50.0f * aspect, -50.0f, 50.0f, 0.1f, 1000.0f);
-    //camera.viewMat = glm::lookAt(cameraPos, eyeTo, upVec);
+    // ストリーム用のバッファは1フレームで書き込む最大量に合わせて確保する
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformOffsetAlignment);
+    const int maxInstances = MAX_BULLETS + balloonRows * balloonCols;
+    frameStream.create(sizeof(FrameBlock) + uniformOffsetAlignment + sizeof(glm::vec3) * maxInstances + sizeof(float) * 3 +
+                       sizeof(float) * ParticleSystem::FLOATS_PER_INSTANCE * MAX_PARTICLES);
 
-    camera.projMat = glm::perspective(45.0f, (float)WIN_WIDTH / (float)WIN_HEIGHT, 0.1f, 1000.0f);
-    camera.viewMat = glm::lookAt(glm::vec3(0.0f, 40.0f, 80.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    // 半透明の表示はすべて同じ合成方法を使う
+    glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+    initCamera();
+    gameInit();
+}
 
+// 1フレームの一時的なデータの領域を, すべての風船と弾が見える場合の結果が入る大きさで確保する
+// (風船の数が決まってから呼ぶ. 再生では記録した行数と列数を使う)
+void createFrameArena() {
+    frameArena.create(sizeof(VisibleSet) + sizeof(glm::vec3) * (balloonRows * balloonCols + MAX_BULLETS) + 4096);
+}
 
-    gameInit();
+// 飛行機を aircraftRenderPos に置き, 風船と弾 (描画用に補間済みの位置) のうち見えるものを調べる
+// (結果は frameArena の中に作るので, 次の次のフレームが始まるまで使える. OpenGLは使わない)
+const VisibleSet *cullScene(const glm::vec3 &aircraftRenderPos,
+                            const std::vector<glm::vec3> &balloonPositions,
+                            const std::vector<glm::vec3> &bulletPositions) {
+    const glm::mat4 viewProjMat = camera.projMat * camera.viewMat;
+    const Frustum frustum(viewProjMat);
+    aircraft.setModelMat(glm::translate(aircraftRenderPos));
+    scene.update();
+
+    VisibleSet *visible = frameArena.create<VisibleSet>(frameArena);
+    visible->aircraft = frustum.intersects(aircraft.boundingSphere.transformed(aircraft.modelMat()));
+    cullInstances(frustum, balloon, balloonPositions, &visible->balloons);
+    cullInstances(frustum, bullet, bulletPositions, &visible->bullets);
+    if (enableOcclusionCulling) {
+        // 手前の物体を遮蔽物として描いてから, それに隠れる風船と弾を取り除く
+        const glm::vec3 eyePos = glm::vec3(glm::inverse(camera.viewMat)[3]);
+        occlusionCuller.beginFrame(viewProjMat);
+        if (visible->aircraft) {
+            occlusionCuller.addOccluder(aircraft.positions, aircraft.modelMat());
+        }
+        addOccluderInstances(eyePos, balloon, &visible->balloons);
+        occlusionCuller.rasterize();
+
+        occludeInstances(balloon, &visible->balloons);
+        occludeInstances(bullet, &visible->bullets);
+    }
+    return visible;
+}
+
+// 動く物体を直前のステップとの間を alpha の割合だけ補間した位置に置き, 見えるものを調べる
+const VisibleSet *computeVisibility(float alpha) {
+    bulletPool.interpolatePositions(alpha, &bulletRenderPos);
+    return cullScene(prevAircraftPos + (aircraftPos - prevAircraftPos) * alpha,
+                     balloonPool.positions(), bulletRenderPos);
+}
+
+// シミュレーション用のスレッドから受け取った状態を補間して, 見えるものを調べる
+const VisibleSet *computeVisibility(const GameSnapshot &snapshot, float alpha) {
+    const std::vector<glm::vec3> &prev = snapshot.prevBulletPositions;
+    const std::vector<glm::vec3> &curr = snapshot.bulletPositions;
+    bulletRenderPos.resize(curr.size());
+    for (size_t i = 0; i < curr.size(); i++) {
+        bulletRenderPos[i] = prev[i] + (curr[i] - prev[i]) * alpha;
+    }
+    return cullScene(snapshot.prevAircraftPos + (snapshot.aircraftPos - snapshot.prevAircraftPos) * alpha,
+                     snapshot.balloonPositions, bulletRenderPos);
+}
+
+// 描画に使うゲームの状態を写す (シミュレーション用のスレッドで, ステップを進めた後に呼ぶ)
+// 写し先の配列は使い回すので, 大きさが伸びきった後は確保が起きない
+void captureSnapshot(GameSnapshot *snapshot) {
+    snapshot->gameMode = gameMode;
+    snapshot->prevAircraftPos = prevAircraftPos;
+    snapshot->aircraftPos = aircraftPos;
+    snapshot->prevBulletPositions = bulletPool.previousPositions();
+    snapshot->bulletPositions = bulletPool.positions();
+    snapshot->balloonPositions = balloonPool.positions();
+    snapshot->particleInstances.resize((size_t)debrisParticles.size() * ParticleSystem::FLOATS_PER_INSTANCE);
+    snapshot->numParticles = debrisParticles.writeInstances(snapshot->particleInstances.data());
 }
 
 void paintGL() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glDisable(GL_DEPTH_TEST);
-    sky.draw(camera);
-    glEnable(GL_DEPTH_TEST);
+    // このフレームで書き換えるデータはすべてストリーム用のバッファに書き込む
+    frameStream.beginFrame();
+
+    // カメラと光源の情報はフレームごとに1回だけ転送する
+    GLintptr frameOffset;
+    FrameBlock *frame = (FrameBlock*)frameStream.allocate(sizeof(FrameBlock), uniformOffsetAlignment, &frameOffset);
+    frame->viewMat = camera.viewMat;
+    frame->projMat = camera.projMat;
+    frame->lightPos = glm::vec4(lightPos, 1.0f);
+    glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, frameStream.id(), frameOffset, sizeof(FrameBlock));
+
+    // 描画命令を積むだけで, 描く順序と状態の切り替えはキューに任せる
+    lastVisible = NULL;
+    renderQueue.clear();
+
+    // シミュレーション用のスレッドを使う場合は, 受け取った最新の状態を描く (まだ届いていなければ前回のまま)
+    // (ゲームの状態はシミュレーション用のスレッドが書き換えるので, そのときはここでは読まない)
+    const GameSnapshot *snapshot = NULL;
+    float alpha;
+    int mode;
+    if (useSimulationThread) {
+        gameMailbox.consume();
+        snapshot = &gameMailbox.readBuffer();
+        alpha = (float)std::max(0.0, std::min((glfwGetTime() - snapshot->time) / timestep.stepSeconds(), 1.0));
+        mode = snapshot->gameMode;
+    } else {
+        alpha = (float)timestep.alpha();
+        mode = gameMode;
+    }
+
+    // 動かした物体のモデル行列だけを計算し直す (プレイ中の飛行機は computeVisibility() で補間して更新する)
+    scene.update();
+    sky.submit(renderQueue, camera, PASS_BACKGROUND, false, false);
 
-    switch (gameMode) {
+    switch (mode) {
     case GAME_MODE_START:
-        {
-            glDisable(GL_DEPTH_TEST);
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-            startDisp.draw(camera);
-            glEnable(GL_DEPTH_TEST);
-            glDisable(GL_BLEND);
-        }
+        startDisp.submit(renderQueue, camera, PASS_OVERLAY, false, true);
         break;
 
-    case GAME_MODE_PLAY:
-        {
-            aircraft.draw(camera);
+    case GAME_MODE_PLAY: {
+        // 画面に映らない物体は描画命令を積まない
+        const VisibleSet *visible = snapshot != NULL ? computeVisibility(*snapshot, alpha) : computeVisibility(alpha);
+        if (visible->aircraft) {
+            aircraft.submit(renderQueue, camera, PASS_OPAQUE, true, false);
+        }
 
-            std::deque<glm::vec3>::iterator it;
-            for (it = bulletPos.begin(); it != bulletPos.end(); ++it) {
-                bullet.modelMat = glm::translate(*it);
-                bullet.draw(camera);
-            }
+        // 弾と風船は位置だけが違うので, 見えるものだけをそれぞれ1回の描画命令でまとめて描く
+        balloon.submitInstanced(renderQueue, camera, PASS_OPAQUE, visible->balloons);
+        bullet.submitInstanced(renderQueue, camera, PASS_OPAQUE, visible->bullets);
+        lastVisible = visible;
 
-            for (it = balloonPos.begin(); it != balloonPos.end(); ++it) {
-                balloon.modelMat = glm::translate(*it);
-                balloon.draw(camera);
-            }
+        // 破片はすべてまとめて1回の描画命令で描く
+        if (snapshot != NULL) {
+            debris.submitParticles(renderQueue, camera, PASS_OPAQUE, snapshot->particleInstances,
+                                   snapshot->numParticles, PARTICLE_SIZE);
+        } else {
+            debris.submitParticles(renderQueue, camera, PASS_OPAQUE, debrisParticles, PARTICLE_SIZE);
         }
         break;
+    }
 
     case GAME_MODE_CLEAR:
-        {
-            glDisable(GL_DEPTH_TEST);
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-            clearDisp.draw(camera);
-            glEnable(GL_DEPTH_TEST);
-            glDisable(GL_BLEND);
-        }
+        clearDisp.submit(renderQueue, camera, PASS_OVERLAY, false, true);
         break;
-    }    
+    }
+
+    frameStream.flush();
+
+    glState.resetStats();
+    renderQueue.execute(glState);
+    lastStats = glState.stats();
+
+    // GPUがこのフレームの領域を読み終えたかを, 次に同じ領域へ書き込む前に確認できるようにする
+    frameStream.endFrame();
+
+    // このフレームの一時的なデータは, 次のフレームの終わりに捨てられる
+    frameArena.endFrame();
 }
 
 void resizeGL(GLFWwindow *window, int width, int height) {
@@ -519,86 +1277,45 @@ void resizeGL(GLFWwindow *window, int width, int height) {
 
     // カメラ行列の更新
     float aspect = WIN_WIDTH / (float)WIN_HEIGHT;
-    camera.projMat = glm::ortho(-50.0f * aspect, 50.0f * aspect, -50.0f, 50.0f, 0.1f, 1000.0f);
+    camera.projMat = glm::ortho(-50.0f * aspect, 50.0f * aspect, -50.0f, 50.0f, CAMERA_NEAR, CAMERA_FAR);
 }
 
-void update() {
-    if (gameMode == GAME_MODE_PLAY) {
-        // 球の位置のアップデート
-        for (auto it = bulletPos.begin(); it != bulletPos.end(); ++it) {
-            it->z += -2.0f;
-        }
-
-        // 風船とのあたり判定
-        bool hit = true;
-        while(hit) {
-            hit = false;
-            for (auto it = bulletPos.begin(); it != bulletPos.end() && !hit; ++it) {
-                for (auto jt = balloonPos.begin(); jt != balloonPos.end() && !hit; ++jt) {
-                    glm::vec3 diff = *it - *jt;
-                    if (glm::length(*it - *jt) <= 2.0f) {
-                        bulletPos.erase(it);
-                        balloonPos.erase(jt);
-                        hit = true;
-                    }
-                }
-            }
-        }
-
-        // 画面外の弾を削除
-        while (!bulletPos.empty()) {
-            if (bulletPos.begin()->z <= -100.0f) {
-                bulletPos.pop_front();
-                continue;
-            }
-            break;
-        }
-
-        // 飛行機を原則させる
-        aircraftVelo -= sign(aircraftVelo) * aircraftAcc * 0.2f;
-    }
-
-    if (gameMode == GAME_MODE_PLAY && balloonPos.empty()) {
-        gameMode = GAME_MODE_CLEAR;
-    }
-}
-
-void keyboard(GLFWwindow *window) {
-    int state;
-   
+// 押し続けているキーで飛行機を動かす
+void steerAircraft(unsigned int input) {
     if (gameMode == GAME_MODE_PLAY) {
         // 左
-        state = glfwGetKey(window, GLFW_KEY_LEFT);
-        if (state == GLFW_PRESS || state == GLFW_REPEAT) {
+        if (input & INPUT_LEFT) {
             aircraftVelo = std::min(aircraftVelo, 0.0f);
             aircraftVelo -= aircraftAcc;
             aircraftVelo = std::max(aircraftVelo, -0.5f);
-            aircraft.modelMat = glm::translate(aircraft.modelMat, glm::vec3(aircraftVelo, 0.0f, 0.0f));
+            aircraftPos.x += aircraftVelo;
         }
 
         // 右
-        state = glfwGetKey(window, GLFW_KEY_RIGHT);
-        if (state == GLFW_PRESS || state == GLFW_REPEAT) {
+        if (input & INPUT_RIGHT) {
             aircraftVelo = std::max(aircraftVelo, 0.0f);
             aircraftVelo += aircraftAcc;
             aircraftVelo = std::min(aircraftVelo, 0.5f);
-            aircraft.modelMat = glm::translate(aircraft.modelMat, glm::vec3(aircraftVelo, 0.0f, 0.0f));
+            aircraftPos.x += aircraftVelo;
         }
     }
 }
 
-void keyboardCallback(GLFWwindow *window, int key, int scanmode, int action, int mods) {
+// ゲームを1ステップ進める (inputはこのステップの入力. 同じ入力を与えれば同じように進む)
+void update(unsigned int input) {
+    // 描画の補間のために, 動かす前の位置を覚えておく
+    prevAircraftPos = aircraftPos;
+    bulletPool.savePrevious();
+
+    // 押されたキーの処理
     if (gameMode == GAME_MODE_PLAY) {
-        // Space
-        if (key == GLFW_KEY_SPACE && action == GLFW_PRESS) {
-            if (bulletPos.size() < 10) {
-                glm::vec4 pos = aircraft.modelMat * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-                pos = pos / pos.w;
-                bulletPos.push_back(glm::vec3(pos.x, pos.y, pos.z));
+        if (input & INPUT_FIRE) {
+            if (bulletPool.size() < MAX_BULLETS) {
+                bulletPool.create(aircraftPos, BULLET_VELOCITY);
             }
         }
     } else {
-        if (key == GLFW_KEY_ENTER && action == GLFW_PRESS) {
+        if (input & INPUT_ENTER) {
             if (gameMode == GAME_MODE_START) {
                 gameMode = GAME_MODE_PLAY;
             } else if (gameMode == GAME_MODE_CLEAR) {
@@ -607,9 +1324,265 @@ void keyboardCallback(GLFWwindow *window, int key, int scanmode, int action, int
             }
         }
     }
+
+    if (gameMode == GAME_MODE_PLAY) {
+        // 球の位置のアップデート
+        bulletPool.integrate((float)timestep.stepSeconds());
+
+        // 風船とのあたり判定 (割れた風船からは破片が飛び散る)
+        collideBullets(bulletPool, balloonPool, &debrisParticles);
+        debrisParticles.update((float)timestep.stepSeconds(), PARTICLE_GRAVITY, &jobs);
+
+        // 画面外の弾を削除
+        for (int i = 0; i < bulletPool.size(); i++) {
+            if (bulletPool.position(i).z <= -100.0f) {
+                bulletPool.kill(i);
+            }
+        }
+        bulletPool.removeDead();
+
+        // 飛行機を原則させる
+        aircraftVelo -= sign(aircraftVelo) * aircraftAcc * 0.2f;
+    }
+
+    if (gameMode == GAME_MODE_PLAY && balloonPool.empty()) {
+        gameMode = GAME_MODE_CLEAR;
+    }
+
+    // 押し続けているキーの処理
+    steerAircraft(input);
+}
+
+// 押し続けているキーを調べる (GLFWのキーの状態はメインスレッドでしか読めないので, フレームごとに呼ぶ)
+void pollHeldKeys(GLFWwindow *window) {
+    unsigned int input = 0u;
+
+    int state;
+    state = glfwGetKey(window, GLFW_KEY_LEFT);
+    if (state == GLFW_PRESS || state == GLFW_REPEAT) {
+        input |= INPUT_LEFT;
+    }
+
+    state = glfwGetKey(window, GLFW_KEY_RIGHT);
+    if (state == GLFW_PRESS || state == GLFW_REPEAT) {
+        input |= INPUT_RIGHT;
+    }
+    heldInput.store(input);
+}
+
+// このステップの入力を集める (押し続けているキーと, 前のステップの後にコールバックで押されたキー)
+unsigned int nextInput() {
+    return heldInput.load() | pressedInput.exchange(0u);
+}
+
+// シミュレーション用のスレッドの処理 (ステップごとの入力はこのスレッドで集めて記録する)
+void simulationLoop(InputRecording *recording) {
+    FixedTimestep simTimestep(timestep.stepSeconds());
+    simTimestep.reset(glfwGetTime());
+    while (!quitSimulation.load()) {
+        const int steps = simTimestep.advance(glfwGetTime());
+        for (int i = 0; i < steps; i++) {
+            const unsigned int input = nextInput();
+            if (recording != NULL) {
+                recording->ticks.push_back((uint8_t)input);
+            }
+            update(input);
+        }
+
+        if (steps > 0) {
+            GameSnapshot &snapshot = gameMailbox.writeBuffer();
+            captureSnapshot(&snapshot);
+            snapshot.time = glfwGetTime();
+            gameMailbox.publish();
+        } else {
+            // 次のステップの時刻まで休む
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+// 記録した入力でゲームを最大の速さで進め, ステップごとの処理時間の分布を表示する (ウィンドウは作らない)
+// 描画はしないが, 描画の前に行うカリングはプレイ中のステップごとに行って時間を計る
+// あわせて, 配列が伸びきった後のステップでヒープからの確保が起きていないかを確かめ, 起きていれば false を返す
+bool replayRecording(const InputRecording &recording) {
+    balloonRows = std::max(1, recording.rows);
+    balloonCols = std::max(1, recording.cols);
+    gameSeed = recording.seed;
+    createFrameArena();
+
+    // カリングに必要な形と境界だけを読み込む
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    aircraft.initialize();
+    aircraft.loadMesh(AIRCRAFT_OBJFILE, &vertices, &indices);
+    balloon.initialize();
+    balloon.loadMesh(BALLOON_OBJFILE, &vertices, &indices);
+    bullet.initialize();
+    bullet.loadMesh(BULLET_OBJFILE, &vertices, &indices);
+
+    initCamera();
+    gameInit();
+
+    typedef std::chrono::high_resolution_clock Clock;
+    TickHistogram updateTimes("update");
+    TickHistogram cullingTimes("culling");
+    updateTimes.reserve(recording.ticks.size());
+    cullingTimes.reserve(recording.ticks.size());
+
+    // プレイを始めてから1秒分のステップは配列が伸びるので確保が起きてよい
+    const int warmupTicks = (int)(1.0 / timestep.stepSeconds());
+    int playTicks = 0;
+    size_t totalAllocations = 0;
+    int allocatingTicks = 0;
+    int firstAllocatingTick = -1;
+    for (size_t i = 0; i < recording.ticks.size(); i++) {
+        const size_t allocationsBefore = AllocationCounter::count();
+        Clock::time_point start = Clock::now();
+        update(recording.ticks[i]);
+        updateTimes.add(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+
+        if (gameMode == GAME_MODE_PLAY) {
+            start = Clock::now();
+            computeVisibility(1.0f);
+            cullingTimes.add(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+            playTicks++;
+        }
+        frameArena.endFrame();
+
+        const size_t allocations = AllocationCounter::count() - allocationsBefore;
+        totalAllocations += allocations;
+        if (playTicks > warmupTicks && allocations > 0) {
+            allocatingTicks++;
+            if (firstAllocatingTick < 0) {
+                firstAllocatingTick = (int)i;
+            }
+        }
+    }
+
+    printf("Replayed %d ticks (seed %u, %d x %d balloons, occlusion culling %s)\n",
+           (int)recording.ticks.size(), gameSeed, balloonRows, balloonCols, enableOcclusionCulling ? "on" : "off");
+    printf("  final state: mode %d, %d balloons, %d bullets, %d particles, aircraft x = %.3f\n",
+           gameMode, balloonPool.size(), bulletPool.size(), debrisParticles.size(), aircraftPos.x);
+    updateTimes.print();
+    cullingTimes.print();
+
+    printf("heap allocations: %lu in total, %d ticks allocated after the first %d ticks of play (frame arena peak %lu bytes)\n",
+           (unsigned long)totalAllocations, allocatingTicks, warmupTicks,
+           (unsigned long)frameArena.peak());
+    if (!AllocationCounter::installed()) {
+        printf("  (allocation counter is not installed)\n");
+    } else if (allocatingTicks > 0) {
+        fprintf(stderr, "Steady-state ticks made heap allocations (first at tick %d)!\n", firstAllocatingTick);
+        return false;
+    }
+    return true;
+}
+
+void keyboardCallback(GLFWwindow *window, int key, int scanmode, int action, int mods) {
+    // 直前のフレームの描画回数と状態変更の回数を表示する
+    if (key == GLFW_KEY_S && action == GLFW_PRESS) {
+        printf("draws: %d, state changes: %d, skipped calls: %d\n",
+               lastStats.draws, lastStats.stateChanges, lastStats.skippedCalls);
+        printf("heap allocations: %lu, frame arena: %lu / %lu bytes (peak %lu)\n",
+               (unsigned long)lastFrameAllocations, (unsigned long)frameArena.lastUsed(),
+               (unsigned long)frameArena.segmentSize(), (unsigned long)frameArena.peak());
+        if (lastVisible != NULL) {
+            printf("visible balloons: %d, visible bullets: %d\n",
+                   (int)lastVisible->balloons.size(), (int)lastVisible->bullets.size());
+        }
+        if (enableOcclusionCulling) {
+            printf("occluder triangles: %d, occluded: %d / %d (%d bands, %d threads)\n",
+                   occlusionCuller.numOccluderTriangles(), occlusionCuller.numOccluded(),
+                   occlusionCuller.numTested(), occlusionCuller.numBands(), jobs.numThreads());
+        }
+    }
+
+    // 遮蔽カリングの切り替え
+    if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+        enableOcclusionCulling = !enableOcclusionCulling;
+        printf("occlusion culling: %s\n", enableOcclusionCulling ? "on" : "off");
+    }
+
+    // ゲームを動かすキーは次のステップの入力として update() で処理する (記録と再生のため)
+    if (key == GLFW_KEY_SPACE && action == GLFW_PRESS) {
+        pressedInput |= INPUT_FIRE;
+    }
+
+    if (key == GLFW_KEY_ENTER && action == GLFW_PRESS) {
+        pressedInput |= INPUT_ENTER;
+    }
 }
 
 int main(int argc, char **argv) {
+    // カリングの速度の計測 (例: shooting_game --bench-culling 1000000)
+    if (argc >= 2 && std::string(argv[1]) == "--bench-culling") {
+        benchmarkCulling(argc >= 3 ? std::max(1, atoi(argv[2])) : 1000000);
+        return 0;
+    }
+
+    // あたり判定の速度の計測 (例: shooting_game --bench-collision 10000 1000)
+    if (argc >= 2 && std::string(argv[1]) == "--bench-collision") {
+        benchmarkCollision(argc >= 3 ? std::max(1, atoi(argv[2])) : 10000,
+                           argc >= 4 ? std::max(1, atoi(argv[3])) : 1000);
+        return 0;
+    }
+
+    // 粒子の更新の速度の計測 (例: shooting_game --bench-particles 1000000)
+    if (argc >= 2 && std::string(argv[1]) == "--bench-particles") {
+        benchmarkParticles(argc >= 3 ? std::max(1, atoi(argv[2])) : 1000000);
+        return 0;
+    }
+
+    // 入力の記録と再生 (例: shooting_game --record play.rec, shooting_game --replay play.rec)
+    // 再生ではウィンドウを作らずに記録したステップを最大の速さで進め, 処理時間の分布を表示する
+    // (Oキーの切り替えは記録されないので, 遮蔽カリングなしで比べるときは --no-occlusion を付ける)
+    // --sim-thread を付けると, ゲームを別のスレッドで進めて描画側には三重バッファで状態を渡す
+    std::string recordFile, replayFile;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--record" && i + 1 < argc) {
+            recordFile = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replayFile = argv[++i];
+        } else if (arg == "--no-occlusion") {
+            enableOcclusionCulling = false;
+        } else if (arg == "--sim-thread") {
+            useSimulationThread = true;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
+    // 風船の行数と列数 (例: shooting_game 300 400 で12万個)
+    if (positional.size() >= 2) {
+        balloonRows = std::max(1, atoi(positional[0].c_str()));
+        balloonCols = std::max(1, atoi(positional[1].c_str()));
+    }
+
+    // 破片の粒子は最大数の分を最初に確保しておく
+    debrisParticles.reserve(MAX_PARTICLES);
+
+    if (!replayFile.empty()) {
+        InputRecording recording;
+        if (!recording.load(replayFile)) {
+            fprintf(stderr, "Failed to load input recording: %s\n", replayFile.c_str());
+            return 1;
+        }
+        return replayRecording(recording) ? 0 : 1;
+    }
+
+    createFrameArena();
+
+    // 記録中にステップごとの確保が起きないように, 1時間分を確保しておく
+    InputRecording recording;
+    recording.seed = gameSeed;
+    recording.rows = balloonRows;
+    recording.cols = balloonCols;
+    if (!recordFile.empty()) {
+        recording.ticks.reserve((size_t)(3600.0 / timestep.stepSeconds()));
+    }
+
     // OpenGLを初期化する
     if (glfwInit() == GL_FALSE) {
         fprintf(stderr, "Initialization failed!\n");
@@ -652,19 +1625,54 @@ int main(int argc, char **argv) {
     // OpenGLを初期化
     initializeGL();
     
+    // シミュレーション用のスレッドを始める (以後, ゲームの状態と記録はそのスレッドだけが触る)
+    std::thread simulationThread;
+    if (useSimulationThread) {
+        GameSnapshot initial;
+        captureSnapshot(&initial);
+        initial.time = glfwGetTime();
+        gameMailbox.reset(initial);
+        simulationThread = std::thread(simulationLoop, recordFile.empty() ? NULL : &recording);
+    }
+
     // メインループ
+    timestep.reset(glfwGetTime());
     while (glfwWindowShouldClose(window) == GL_FALSE) {
+        const size_t allocationsBefore = AllocationCounter::count();
+
+        // アニメーションとキーボード処理 (経過時間に応じて0回以上進める)
+        pollHeldKeys(window);
+        if (!useSimulationThread) {
+            const int steps = timestep.advance(glfwGetTime());
+            for (int i = 0; i < steps; i++) {
+                const unsigned int input = nextInput();
+                if (!recordFile.empty()) {
+                    recording.ticks.push_back((uint8_t)input);
+                }
+                update(input);
+            }
+        }
+
         // 描画
         paintGL();
-        
-        // アニメーション
-        update();
-
-        // キーボード処理
-        keyboard(window);
+        lastFrameAllocations = AllocationCounter::count() - allocationsBefore;
 
         // 描画用バッファの切り替え
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
+
+    if (useSimulationThread) {
+        quitSimulation.store(true);
+        simulationThread.join();
+    }
+
+    // 記録を書き出す
+    if (!recordFile.empty()) {
+        if (!recording.save(recordFile)) {
+            fprintf(stderr, "Failed to save input recording: %s\n", recordFile.c_str());
+            return 1;
+        }
+        printf("Recorded %d ticks: %s\n", (int)recording.ticks.size(), recordFile.c_str());
+    }
 }
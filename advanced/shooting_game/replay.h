@@ -0,0 +1,162 @@
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+// 1ステップ分の入力 (押されているキーと, そのステップで押されたキーのビット)
+enum InputBits {
+    INPUT_LEFT  = 1 << 0,   // 左 (押している間)
+    INPUT_RIGHT = 1 << 1,   // 右 (押している間)
+    INPUT_FIRE  = 1 << 2,   // Space (押したとき)
+    INPUT_ENTER = 1 << 3,   // Enter (押したとき)
+};
+
+// 記録ファイルの先頭
+struct RecordingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seed;
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t numTicks;
+};
+
+// ゲームの乱数の種, 風船の並べ方と, ステップごとの入力の記録
+// ゲームは一定の間隔のステップで進むので, 同じ種と同じ入力を与えれば同じように進む.
+// ファイルはヘッダの後にステップごとの入力を1バイトずつ並べたもの (1時間で約200KB).
+struct InputRecording {
+    InputRecording()
+        : seed(0u)
+        , rows(0)
+        , cols(0) {
+    }
+
+    bool save(const std::string &filename) const {
+        FILE *fp = fopen(filename.c_str(), "wb");
+        if (fp == NULL) {
+            return false;
+        }
+
+        RecordingHeader header;
+        header.magic = MAGIC;
+        header.version = VERSION;
+        header.seed = seed;
+        header.rows = (uint32_t)rows;
+        header.cols = (uint32_t)cols;
+        header.numTicks = (uint32_t)ticks.size();
+
+        bool success = fwrite(&header, sizeof(header), 1, fp) == 1;
+        if (success && !ticks.empty()) {
+            success = fwrite(ticks.data(), 1, ticks.size(), fp) == ticks.size();
+        }
+        return fclose(fp) == 0 && success;
+    }
+
+    bool load(const std::string &filename) {
+        FILE *fp = fopen(filename.c_str(), "rb");
+        if (fp == NULL) {
+            return false;
+        }
+
+        RecordingHeader header;
+        if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != MAGIC || header.version != VERSION) {
+            fclose(fp);
+            return false;
+        }
+
+        seed = header.seed;
+        rows = (int)header.rows;
+        cols = (int)header.cols;
+        ticks.resize(header.numTicks);
+        const bool success = ticks.empty() || fread(ticks.data(), 1, ticks.size(), fp) == ticks.size();
+        fclose(fp);
+        return success;
+    }
+
+    uint32_t seed;
+    int rows;
+    int cols;
+    std::vector<uint8_t> ticks;
+
+private:
+    static const uint32_t MAGIC = 0x50524753u;  // "SGRP"
+    static const uint32_t VERSION = 1u;
+};
+
+// 1ステップあたりの処理時間の分布
+// 時間はマイクロ秒単位で2のべき乗ごとの区間に数え, 百分位数は全サンプルを並べて求める
+class TickHistogram {
+public:
+    explicit TickHistogram(const std::string &name)
+        : name_(name) {
+    }
+
+    void reserve(size_t n) {
+        samples_.reserve(n);
+    }
+
+    void add(double microseconds) {
+        samples_.push_back(microseconds);
+    }
+
+    int count() const {
+        return (int)samples_.size();
+    }
+
+    void print() const {
+        if (samples_.empty()) {
+            printf("%s: no samples\n", name_.c_str());
+            return;
+        }
+
+        std::vector<double> sorted = samples_;
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.0;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            total += sorted[i];
+        }
+
+        printf("%s: %d ticks, mean %.2f us, p50 %.2f us, p90 %.2f us, p99 %.2f us, max %.2f us\n",
+               name_.c_str(), (int)sorted.size(), total / sorted.size(),
+               percentile(sorted, 0.5), percentile(sorted, 0.9), percentile(sorted, 0.99), sorted.back());
+
+        // 区間kは [2^(k-1), 2^k) マイクロ秒 (区間0は1マイクロ秒未満)
+        std::vector<int> buckets;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            const int k = sorted[i] < 1.0 ? 0 : 1 + (int)std::floor(std::log2(sorted[i]));
+            if (k >= (int)buckets.size()) {
+                buckets.resize(k + 1, 0);
+            }
+            buckets[k]++;
+        }
+
+        const int maxCount = *std::max_element(buckets.begin(), buckets.end());
+        for (size_t k = 0; k < buckets.size(); k++) {
+            if (buckets[k] == 0) {
+                continue;
+            }
+
+            const double lo = k == 0 ? 0.0 : std::ldexp(1.0, (int)k - 1);
+            const double hi = std::ldexp(1.0, (int)k);
+            const int bar = (buckets[k] * 50 + maxCount - 1) / maxCount;
+            printf("  [%8.0f, %8.0f) us %8d %s\n", lo, hi, buckets[k], std::string(bar, '#').c_str());
+        }
+    }
+
+private:
+    static double percentile(const std::vector<double> &sorted, double p) {
+        const size_t index = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+        return sorted[index];
+    }
+
+    std::string name_;
+    std::vector<double> samples_;
+};
+
+#endif  // _REPLAY_H_
@@ -0,0 +1,35 @@
+#version 410
+
+layout(location = 0) in vec3 in_position;
+layout(location = 1) in vec3 in_normal;
+layout(location = 2) in vec2 in_texcoord;
+layout(location = 3) in vec3 in_instanceOffset;   // インスタンスごとの平行移動
+
+layout(location = 0) out vec3 f_posViewSpace;
+layout(location = 1) out vec3 f_normViewSpace;
+layout(location = 2) out vec3 f_lightPosViewSpace;
+layout(location = 3) out vec2 f_texcoord;
+
+layout(std140) uniform FrameBlock {
+    mat4 u_viewMat;
+    mat4 u_projMat;
+    vec4 u_lightPos;
+};
+
+uniform mat4 u_modelMat;
+uniform mat4 u_normMat;
+uniform vec4 u_uvRect;
+
+void main(void) {
+    vec4 posWorldSpace = u_modelMat * vec4(in_position, 1.0);
+    posWorldSpace.xyz += in_instanceOffset;
+
+    vec4 posViewSpace = u_viewMat * posWorldSpace;
+    gl_Position = u_projMat * posViewSpace;
+
+    // 平行移動は法線に影響しないので, 法線の変換はすべてのインスタンスで共通
+    f_posViewSpace = posViewSpace.xyz;
+    f_normViewSpace = (u_normMat * vec4(in_normal, 0.0)).xyz;
+    f_lightPosViewSpace = (u_viewMat * u_lightPos).xyz;
+    f_texcoord = u_uvRect.xy + in_texcoord * u_uvRect.zw;
+}
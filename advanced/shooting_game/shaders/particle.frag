@@ -0,0 +1,25 @@
+#version 410
+
+layout(location = 0) in vec2 f_texcoord;
+layout(location = 1) in float f_life;
+
+layout(location = 0) out vec4 out_color;
+
+layout(std140) uniform MaterialBlock {
+    vec3 u_ambiColor;
+    vec3 u_diffColor;
+    vec3 u_specColor;
+    float u_shininess;
+};
+
+void main(void) {
+    // 円の外側は捨てて, 丸い破片に見せる (半透明にしないので並べ替えは要らない)
+    vec2 d = f_texcoord - vec2(0.5);
+    if (dot(d, d) > 0.25) {
+        discard;
+    }
+
+    // 飛び出した直後は明るく, 寿命が尽きるにつれて暗くする
+    out_color.rgb = mix(u_ambiColor, u_diffColor, f_life);
+    out_color.a = 1.0;
+}
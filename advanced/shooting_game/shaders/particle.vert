@@ -0,0 +1,26 @@
+#version 410
+
+layout(location = 0) in vec3 in_position;        // 板の頂点 (xyが -0.5〜0.5 の正方形)
+layout(location = 2) in vec2 in_texcoord;
+layout(location = 3) in vec4 in_particle;        // 粒子の位置 (xyz) と残りの寿命の割合 (w)
+
+layout(location = 0) out vec2 f_texcoord;
+layout(location = 1) out float f_life;
+
+layout(std140) uniform FrameBlock {
+    mat4 u_viewMat;
+    mat4 u_projMat;
+    vec4 u_lightPos;
+};
+
+uniform float u_particleSize;
+
+void main(void) {
+    // 板がいつもカメラを向くように, 視点座標系で広げる (寿命が尽きるにつれて小さくなる)
+    vec4 posViewSpace = u_viewMat * vec4(in_particle.xyz, 1.0);
+    posViewSpace.xy += in_position.xy * u_particleSize * in_particle.w;
+    gl_Position = u_projMat * posViewSpace;
+
+    f_texcoord = in_texcoord;
+    f_life = in_particle.w;
+}
@@ -7,10 +7,12 @@ layout(location = 3) in vec2 f_texcoord;
 
 layout(location = 0) out vec4 out_color;
 
-uniform vec3 u_ambiColor;
-uniform vec3 u_diffColor;
-uniform vec3 u_specColor;
-uniform float u_shininess;
+layout(std140) uniform MaterialBlock {
+    vec3 u_ambiColor;
+    vec3 u_diffColor;
+    vec3 u_specColor;
+    float u_shininess;
+};
 
 uniform bool u_isTextured;
 uniform sampler2D u_texture;
@@ -0,0 +1,287 @@
+#ifndef _TEXTURE_ATLAS_H_
+#define _TEXTURE_ATLAS_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// アトラス内の1枚の画像の位置
+struct AtlasRegion {
+    AtlasRegion()
+        : page(-1)
+        , x(0)
+        , y(0)
+        , width(0)
+        , height(0)
+        , uvRect(0.0f, 0.0f, 1.0f, 1.0f) {
+    }
+
+    int page;
+    int x, y, width, height;
+    glm::vec4 uvRect;  // (u0, v0, uの幅, vの幅). uv' = uvRect.xy + uv * uvRect.zw
+};
+
+// 小さな画像をスカイライン法で共有のテクスチャ (ページ) に詰め込むクラス
+// 画像の周囲には端の画素を複製した余白を入れ, 線形補間で隣の画像が混ざらないようにする
+class TextureAtlas {
+public:
+    explicit TextureAtlas(int pageSize = 4096, int padding = 2)
+        : pageSize_(pageSize)
+        , padding_(padding) {
+    }
+
+    // RGBAの画像を登録する (実際の配置はpack()で行う)
+    void add(const std::string &name, int width, int height, const unsigned char *rgba) {
+        Image image;
+        image.name = name;
+        image.width = width;
+        image.height = height;
+        image.pixels.assign(rgba, rgba + (size_t)width * height * 4);
+        images_.push_back(image);
+    }
+
+    // 登録された画像を高さの降順に配置し, ページの画素を作る
+    void pack() {
+        std::vector<int> order(images_.size());
+        for (int i = 0; i < (int)order.size(); i++) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [this](int a, int b) {
+            if (images_[a].height != images_[b].height) {
+                return images_[a].height > images_[b].height;
+            }
+            return images_[a].width > images_[b].width;
+        });
+
+        pages_.clear();
+        for (int k = 0; k < (int)order.size(); k++) {
+            const Image &image = images_[order[k]];
+            const int w = image.width + 2 * padding_;
+            const int h = image.height + 2 * padding_;
+
+            // 既存のページに入る場所を探し, なければ新しいページを作る
+            AtlasRegion region;
+            int x = 0, y = 0;
+            for (int p = 0; p < (int)pages_.size(); p++) {
+                if (pages_[p].insert(w, h, &x, &y)) {
+                    region.page = p;
+                    break;
+                }
+            }
+
+            if (region.page < 0) {
+                // ページより大きな画像は専用のページに置く
+                pages_.push_back(Page(std::max(pageSize_, w), std::max(pageSize_, h)));
+                region.page = (int)pages_.size() - 1;
+                pages_.back().insert(w, h, &x, &y);
+            }
+
+            region.x = x + padding_;
+            region.y = y + padding_;
+            region.width = image.width;
+            region.height = image.height;
+            regions_[image.name] = region;
+            pages_[region.page].usedWidth = std::max(pages_[region.page].usedWidth, x + w);
+            pages_[region.page].usedHeight = std::max(pages_[region.page].usedHeight, y + h);
+        }
+
+        // 使われた範囲だけをテクスチャにする
+        for (int p = 0; p < (int)pages_.size(); p++) {
+            pages_[p].pixels.assign((size_t)pages_[p].usedWidth * pages_[p].usedHeight * 4, 0);
+        }
+
+        for (int i = 0; i < (int)images_.size(); i++) {
+            AtlasRegion &region = regions_[images_[i].name];
+            Page &page = pages_[region.page];
+            blit(page, region, images_[i]);
+
+            region.uvRect = glm::vec4((float)region.x / page.usedWidth,
+                                      (float)region.y / page.usedHeight,
+                                      (float)region.width / page.usedWidth,
+                                      (float)region.height / page.usedHeight);
+        }
+
+        images_.clear();
+    }
+
+    // ページをテクスチャとして転送する
+    void upload() {
+        for (int p = 0; p < (int)pages_.size(); p++) {
+            Page &page = pages_[p];
+            glGenTextures(1, &page.textureId);
+            glBindTexture(GL_TEXTURE_2D, page.textureId);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, page.usedWidth, page.usedHeight,
+                         0, GL_RGBA, GL_UNSIGNED_BYTE, page.pixels.data());
+
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            // CPU側の画素はもう不要
+            std::vector<unsigned char>().swap(page.pixels);
+        }
+    }
+
+    void release() {
+        for (int p = 0; p < (int)pages_.size(); p++) {
+            if (pages_[p].textureId != 0) {
+                glDeleteTextures(1, &pages_[p].textureId);
+                pages_[p].textureId = 0;
+            }
+        }
+    }
+
+    const AtlasRegion &region(const std::string &name) const {
+        std::map<std::string, AtlasRegion>::const_iterator it = regions_.find(name);
+        if (it == regions_.end()) {
+            fprintf(stderr, "Image is not found in texture atlas: %s\n", name.c_str());
+            exit(1);
+        }
+        return it->second;
+    }
+
+    GLuint textureId(int page) const {
+        return pages_[page].textureId;
+    }
+
+    int numPages() const {
+        return (int)pages_.size();
+    }
+
+private:
+    struct Image {
+        std::string name;
+        int width, height;
+        std::vector<unsigned char> pixels;
+    };
+
+    // スカイラインの1区間 (xからwidthの幅で高さがy)
+    struct SkylineNode {
+        SkylineNode(int x_, int y_, int width_)
+            : x(x_)
+            , y(y_)
+            , width(width_) {
+        }
+
+        int x, y, width;
+    };
+
+    struct Page {
+        Page(int width_, int height_)
+            : width(width_)
+            , height(height_)
+            , usedWidth(0)
+            , usedHeight(0)
+            , textureId(0u) {
+            skyline.push_back(SkylineNode(0, 0, width));
+        }
+
+        // 上端が最も低くなる位置 (同じなら最も隙間の狭い位置) に配置する
+        bool insert(int w, int h, int *outX, int *outY) {
+            int bestIndex = -1, bestY = height, bestWidth = width + 1;
+            for (int i = 0; i < (int)skyline.size(); i++) {
+                int y;
+                if (fits(i, w, h, &y) && (y < bestY || (y == bestY && skyline[i].width < bestWidth))) {
+                    bestIndex = i;
+                    bestY = y;
+                    bestWidth = skyline[i].width;
+                }
+            }
+
+            if (bestIndex < 0) {
+                return false;
+            }
+
+            *outX = skyline[bestIndex].x;
+            *outY = bestY;
+            addSkylineLevel(bestIndex, skyline[bestIndex].x, bestY + h, w);
+            return true;
+        }
+
+        bool fits(int index, int w, int h, int *outY) const {
+            const int x = skyline[index].x;
+            if (x + w > width) {
+                return false;
+            }
+
+            int y = skyline[index].y;
+            int remaining = w;
+            for (int i = index; remaining > 0; i++) {
+                y = std::max(y, skyline[i].y);
+                if (y + h > height) {
+                    return false;
+                }
+                remaining -= skyline[i].width;
+            }
+
+            *outY = y;
+            return true;
+        }
+
+        void addSkylineLevel(int index, int x, int y, int w) {
+            skyline.insert(skyline.begin() + index, SkylineNode(x, y, w));
+
+            // 新しい区間に隠れた区間を削る
+            for (int i = index + 1; i < (int)skyline.size(); i++) {
+                const int prevEnd = skyline[i - 1].x + skyline[i - 1].width;
+                if (skyline[i].x >= prevEnd) {
+                    break;
+                }
+
+                const int shrink = prevEnd - skyline[i].x;
+                skyline[i].x += shrink;
+                skyline[i].width -= shrink;
+                if (skyline[i].width > 0) {
+                    break;
+                }
+                skyline.erase(skyline.begin() + i);
+                i--;
+            }
+
+            // 同じ高さの区間をまとめる
+            for (int i = 0; i < (int)skyline.size() - 1; i++) {
+                if (skyline[i].y == skyline[i + 1].y) {
+                    skyline[i].width += skyline[i + 1].width;
+                    skyline.erase(skyline.begin() + i + 1);
+                    i--;
+                }
+            }
+        }
+
+        int width, height;
+        int usedWidth, usedHeight;
+        std::vector<SkylineNode> skyline;
+        std::vector<unsigned char> pixels;
+        GLuint textureId;
+    };
+
+    // 画像をページに書き込み, 余白には端の画素を複製する
+    void blit(Page &page, const AtlasRegion &region, const Image &image) const {
+        for (int y = -padding_; y < image.height + padding_; y++) {
+            const int sy = std::min(std::max(y, 0), image.height - 1);
+            for (int x = -padding_; x < image.width + padding_; x++) {
+                const int sx = std::min(std::max(x, 0), image.width - 1);
+                const size_t dst = ((size_t)(region.y + y) * page.usedWidth + (region.x + x)) * 4;
+                const size_t src = ((size_t)sy * image.width + sx) * 4;
+                std::memcpy(&page.pixels[dst], &image.pixels[src], 4);
+            }
+        }
+    }
+
+    int pageSize_;
+    int padding_;
+    std::vector<Image> images_;
+    std::vector<Page> pages_;
+    std::map<std::string, AtlasRegion> regions_;
+};
+
+#endif  // _TEXTURE_ATLAS_H_
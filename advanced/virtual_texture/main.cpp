@@ -0,0 +1,352 @@
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#define GLAD_GL_IMPLEMENTATION
+#include <glad/gl.h>
+
+#define GLFW_INCLUDE_GLU
+#include <GLFW/glfw3.h>
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// ディレクトリの設定ファイル
+#include "common.h"
+#include "virtual_texture.h"
+#include <glutils/shader_builder.h>
+#include <glutils/shader_program.h>
+#include <glutils/fixed_timestep.h>
+
+static int WIN_WIDTH   = 500;                       // ウィンドウの幅
+static int WIN_HEIGHT  = 500;                       // ウィンドウの高さ
+static const char *WIN_TITLE = "OpenGL Course";     // ウィンドウのタイトル
+
+static const double PI = 4.0 * std::atan(1.0);
+
+// シェーダファイル
+static const std::string VERT_SHADER_FILE = std::string(SHADER_DIRECTORY) + "render.vert";
+static const std::string FRAG_SHADER_FILE = std::string(SHADER_DIRECTORY) + "render.frag";
+
+// 表示する画像 (コマンドライン引数で指定されなければテクスチャマッピングの例の画像を使う)
+static std::string IMAGE_FILE = std::string(SOURCE_DIRECTORY) + "../../src/texture_mapping/data/checker.png";
+
+// タイルとキャッシュの設定
+static const int TILE_SIZE = 128;
+static const int TILE_BORDER = 1;
+static const int CACHE_SLOTS_X = 8;
+static const int CACHE_SLOTS_Y = 8;
+
+// 頂点オブジェクト
+struct Vertex {
+    Vertex(const glm::vec3 &position_, const glm::vec2 &texcoord_)
+        : position(position_)
+        , texcoord(texcoord_) {
+    }
+
+    glm::vec3 position;
+    glm::vec2 texcoord;
+};
+
+// バッファを参照する番号
+GLuint vaoId;
+GLuint vertexBufferId;
+GLuint indexBufferId;
+
+// シェーダを参照する番号
+GLuint programId;
+ShaderProgram program;
+
+// 仮想テクスチャ
+VirtualTexture virtualTexture;
+
+// 画像を貼る平面の縦横比
+static float aspect = 1.0f;
+
+// アニメーションの角度
+static float theta = 0.0f;
+static float prevTheta = 0.0f;
+
+// アニメーションは描画の速さによらず, 1秒に60回の一定の間隔で進める
+FixedTimestep timestep(1.0 / 60.0);
+
+// VAOの初期化
+void initVAO() {
+    // 画像のuv座標 (0, 0) - (1, 1) が平面の (-aspect, -1) - (aspect, 1) に対応する
+    std::vector<Vertex> vertices = {
+        Vertex(glm::vec3(-aspect, 0.0f, -1.0f), glm::vec2(0.0f, 0.0f)),
+        Vertex(glm::vec3( aspect, 0.0f, -1.0f), glm::vec2(1.0f, 0.0f)),
+        Vertex(glm::vec3(-aspect, 0.0f,  1.0f), glm::vec2(0.0f, 1.0f)),
+        Vertex(glm::vec3( aspect, 0.0f,  1.0f), glm::vec2(1.0f, 1.0f))
+    };
+
+    std::vector<unsigned int> indices = {
+        0, 1, 3, 0, 3, 2
+    };
+
+    // VAOの作成
+    glGenVertexArrays(1, &vaoId);
+    glBindVertexArray(vaoId);
+
+    // 頂点バッファの作成
+    glGenBuffers(1, &vertexBufferId);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferId);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+
+    // 頂点バッファの有効化
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texcoord));
+
+    // 頂点番号バッファの作成
+    glGenBuffers(1, &indexBufferId);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferId);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(),
+                 indices.data(), GL_STATIC_DRAW);
+
+    // VAOをOFFにしておく
+    glBindVertexArray(0);
+}
+
+// シェーダの初期化
+void initShaders() {
+    programId = buildShaderProgram(VERT_SHADER_FILE, FRAG_SHADER_FILE);
+    // Uniform変数の位置を列挙しておく
+    program.reflect(programId);
+}
+
+// 仮想テクスチャの初期化
+void initVirtualTexture() {
+    SourceStamp stamp;
+    if (!getSourceStamp(IMAGE_FILE, &stamp)) {
+        fprintf(stderr, "Failed to load image file: %s\n", IMAGE_FILE.c_str());
+        exit(1);
+    }
+
+    // タイルファイルが無いか, 壊れているか, 画像が更新されていれば画像から作成する
+    const std::string tileFile = IMAGE_FILE + ".tiles";
+    if (!virtualTexture.open(tileFile, CACHE_SLOTS_X, CACHE_SLOTS_Y, stamp)) {
+        printf("Build tile file: %s\n", tileFile.c_str());
+
+        bool success = false;
+        const std::string ext = IMAGE_FILE.substr(IMAGE_FILE.find_last_of('.') + 1);
+        if (ext == "ppm") {
+            // PPMは画像全体を読み込まずに, 数行ずつ読みながらタイルに分割する
+            PpmRowSource source;
+            if (!source.open(IMAGE_FILE)) {
+                fprintf(stderr, "Failed to load image file: %s\n", IMAGE_FILE.c_str());
+                exit(1);
+            }
+            success = VirtualTexture::buildTileFile(tileFile, &source, stamp, TILE_SIZE, TILE_BORDER);
+        } else {
+            // その他の形式はstb_imageで展開する (メモリに載る大きさの画像に限る)
+            int texWidth, texHeight, channels;
+            unsigned char *bytes = stbi_load(IMAGE_FILE.c_str(), &texWidth, &texHeight, &channels, STBI_rgb_alpha);
+            if (!bytes) {
+                fprintf(stderr, "Failed to load image file: %s\n", IMAGE_FILE.c_str());
+                exit(1);
+            }
+
+            MemoryRowSource source(bytes, texWidth, texHeight);
+            success = VirtualTexture::buildTileFile(tileFile, &source, stamp, TILE_SIZE, TILE_BORDER);
+            stbi_image_free(bytes);
+        }
+
+        if (!success || !virtualTexture.open(tileFile, CACHE_SLOTS_X, CACHE_SLOTS_Y, stamp)) {
+            fprintf(stderr, "Failed to open tile file: %s\n", tileFile.c_str());
+            exit(1);
+        }
+    }
+
+    aspect = (float)virtualTexture.width() / (float)virtualTexture.height();
+    printf("Virtual texture: %d x %d, %d levels\n", virtualTexture.width(), virtualTexture.height(), virtualTexture.numLevels());
+}
+
+// OpenGLの初期化関数
+void initializeGL() {
+    // 深度テストの有効化
+    glEnable(GL_DEPTH_TEST);
+
+    // 背景色の設定 (黒)
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    // 仮想テクスチャの初期化
+    initVirtualTexture();
+
+    // VAOの初期化
+    initVAO();
+
+    // シェーダの用意
+    initShaders();
+}
+
+// OpenGLの描画関数
+void paintGL() {
+    // 背景色の描画
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // 座標の変換 (平面に近づいたり離れたりする)
+    const float renderTheta = timestep.lerp(prevTheta, theta);
+    const float distance = 0.02f * std::pow(200.0f, 0.5f + 0.5f * std::cos(renderTheta * 0.5f));
+    glm::mat4 projMat = glm::perspective(glm::radians(45.0f),
+        (float)WIN_WIDTH / (float)WIN_HEIGHT, 0.001f, 100.0f);
+
+    glm::mat4 viewMat = glm::lookAt(glm::vec3(0.0f, distance, distance * 0.5f),  // 視点の位置
+                                    glm::vec3(0.0f, 0.0f, 0.0f),                 // 見ている先
+                                    glm::vec3(0.0f, 0.0f, -1.0f));               // 視界の上方向
+
+    glm::mat4 modelMat = glm::rotate(renderTheta * 0.2f, glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 mvpMat = projMat * viewMat * modelMat;
+
+    // 仮想画像のuv座標から平面上の位置への変換
+    const glm::vec2 uvScale = virtualTexture.uvScale();
+    glm::mat4 uvToModel = glm::mat4(glm::vec4(2.0f * aspect / uvScale.x, 0.0f, 0.0f, 0.0f),
+                                    glm::vec4(0.0f, 0.0f, 2.0f / uvScale.y, 0.0f),
+                                    glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
+                                    glm::vec4(-aspect, 0.0f, -1.0f, 1.0f));
+
+    // 見えているタイルを読み込む
+    int renderBufferWidth, renderBufferHeight;
+    glfwGetFramebufferSize(glfwGetCurrentContext(), &renderBufferWidth, &renderBufferHeight);
+    virtualTexture.update(mvpMat * uvToModel, renderBufferWidth, renderBufferHeight);
+
+    // VAOの有効化
+    glBindVertexArray(vaoId);
+
+    // シェーダの有効化
+    glUseProgram(programId);
+
+    // Uniform変数の転送
+    program.set("u_mvpMat", mvpMat);
+    program.set("u_uvScale", uvScale);
+    program.set("u_tileSize", (float)virtualTexture.tileSize());
+    program.set("u_border", (float)virtualTexture.border());
+    program.set("u_cacheSlots", virtualTexture.cacheSlots());
+    program.set("u_maxLevel", (float)(virtualTexture.numLevels() - 1));
+
+    // テクスチャの有効化とシェーダへの転送
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, virtualTexture.pageTableId());
+    program.set("u_pageTable", 0);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, virtualTexture.cacheTextureId());
+    program.set("u_tileCache", 1);
+
+    // 三角形の描画
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+
+    // VAOの無効化
+    glBindVertexArray(0);
+
+    // シェーダの無効化
+    glUseProgram(0);
+
+    // テクスチャの無効化
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void resizeGL(GLFWwindow *window, int width, int height) {
+    // ユーザ管理のウィンドウサイズを変更
+    WIN_WIDTH = width;
+    WIN_HEIGHT = height;
+
+    // GLFW管理のウィンドウサイズを変更
+    glfwSetWindowSize(window, WIN_WIDTH, WIN_HEIGHT);
+
+    // 実際のウィンドウサイズ (ピクセル数) を取得
+    int renderBufferWidth, renderBufferHeight;
+    glfwGetFramebufferSize(window, &renderBufferWidth, &renderBufferHeight);
+
+    // ビューポート変換の更新
+    glViewport(0, 0, renderBufferWidth, renderBufferHeight);
+}
+
+// アニメーションのためのアップデート
+void animate() {
+    prevTheta = theta;
+    theta += 2.0f * PI / 360.0f;
+}
+
+int main(int argc, char **argv) {
+    // 表示する画像の指定
+    if (argc > 1) {
+        IMAGE_FILE = argv[1];
+    }
+
+    // OpenGLを初期化する
+    if (glfwInit() == GL_FALSE) {
+        fprintf(stderr, "Initialization failed!\n");
+        return 1;
+    }
+
+    // OpenGLのバージョン設定 (Macの場合には必ず必要)
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+    // Windowの作成
+    GLFWwindow *window = glfwCreateWindow(WIN_WIDTH, WIN_HEIGHT, WIN_TITLE,
+                                          NULL, NULL);
+    if (window == NULL) {
+        fprintf(stderr, "Window creation failed!");
+        glfwTerminate();
+        return 1;
+    }
+
+    // OpenGLの描画対象にWindowを追加
+    glfwMakeContextCurrent(window);
+
+    // OpenGL 3.x/4.xの関数をロードする (glfwMakeContextCurrentの後でないといけない)
+    const int version = gladLoadGL(glfwGetProcAddress);
+    if (version == 0) {
+        fprintf(stderr, "Failed to load OpenGL 3.x/4.x libraries!\n");
+        return 1;
+    }
+
+    // バージョンを出力する
+    printf("Load OpenGL %d.%d\n", GLAD_VERSION_MAJOR(version), GLAD_VERSION_MINOR(version));
+
+    // ウィンドウのリサイズを扱う関数の登録
+    glfwSetWindowSizeCallback(window, resizeGL);
+
+    // OpenGLを初期化
+    initializeGL();
+
+    // メインループ
+    timestep.reset(glfwGetTime());
+    while (glfwWindowShouldClose(window) == GL_FALSE) {
+        // アニメーション (経過時間に応じて0回以上進める)
+        const int steps = timestep.advance(glfwGetTime());
+        for (int i = 0; i < steps; i++) {
+            animate();
+        }
+
+        // 描画
+        paintGL();
+
+        // キャッシュの状態をタイトルに表示
+        char title[256];
+        sprintf(title, "%s (resident: %d, pending: %d, uploads: %d)", WIN_TITLE,
+                virtualTexture.residentTiles(), virtualTexture.pendingTiles(), virtualTexture.uploadsLastFrame());
+        glfwSetWindowTitle(window, title);
+
+        // 描画用バッファの切り替え
+        glfwSwapBuffers(window);
+        glfwPollEvents();
+    }
+}
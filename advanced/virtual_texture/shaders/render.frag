@@ -0,0 +1,40 @@
+#version 410
+
+in vec2 f_texcoord;
+
+out vec4 out_color;
+
+// ページテーブル (RGBA = キャッシュ内のスロットx, スロットy, タイルのレベル, 未使用)
+uniform sampler2D u_pageTable;
+// タイルを格納したキャッシュテクスチャ
+uniform sampler2D u_tileCache;
+
+uniform vec2 u_uvScale;       // 画像のuvから仮想画像のuvへの拡大率
+uniform float u_tileSize;     // タイル1辺の画素数 (境界を除く)
+uniform float u_border;       // タイルの周囲の境界の画素数
+uniform vec2 u_cacheSlots;    // キャッシュのスロット数
+uniform float u_maxLevel;
+
+void main(void) {
+    vec2 uv = f_texcoord * u_uvScale;
+
+    // 画面上の微分から使うべきミップレベルを求める
+    vec2 tiles0 = vec2(textureSize(u_pageTable, 0));
+    vec2 texel = uv * tiles0 * u_tileSize;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0e-8));
+    int level = int(clamp(floor(lod), 0.0, u_maxLevel));
+
+    // ページテーブルから常駐しているタイル (無ければより粗いタイル) を求める
+    ivec2 cells = textureSize(u_pageTable, level);
+    ivec2 cell = clamp(ivec2(uv * vec2(cells)), ivec2(0), cells - 1);
+    vec3 entry = floor(texelFetch(u_pageTable, cell, level).xyz * 255.0 + 0.5);
+
+    // タイル内の位置からキャッシュテクスチャ上の位置を求める
+    vec2 tilePos = uv * tiles0 / exp2(entry.z);
+    vec2 inTile = clamp(tilePos - floor(tilePos), 0.0, 1.0);
+    float slotSize = u_tileSize + 2.0 * u_border;
+    vec2 pixel = entry.xy * slotSize + u_border + inTile * u_tileSize;
+    out_color = textureLod(u_tileCache, pixel / (u_cacheSlots * slotSize), 0.0);
+}
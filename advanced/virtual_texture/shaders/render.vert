@@ -0,0 +1,13 @@
+#version 410
+
+layout(location = 0) in vec3 in_position;
+layout(location = 1) in vec2 in_texcoord;
+
+out vec2 f_texcoord;
+
+uniform mat4 u_mvpMat;
+
+void main() {
+    gl_Position = u_mvpMat * vec4(in_position, 1.0);
+    f_texcoord = in_texcoord;
+}
@@ -0,0 +1,1135 @@
+#ifndef _VIRTUAL_TEXTURE_H_
+#define _VIRTUAL_TEXTURE_H_
+
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// 読み込み専用でメモリにマップしたファイル
+class MappedFile {
+public:
+    MappedFile()
+        : data_(NULL)
+        , size_(0) {
+#ifdef _WIN32
+        file_ = INVALID_HANDLE_VALUE;
+        mapping_ = NULL;
+#else
+        fd_ = -1;
+#endif
+    }
+
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(const std::string &filename) {
+        close();
+#ifdef _WIN32
+        file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file_ == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(file_, &fileSize);
+        size_ = (size_t)fileSize.QuadPart;
+
+        mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping_ == NULL) {
+            close();
+            return false;
+        }
+        data_ = (const unsigned char *)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+#else
+        fd_ = ::open(filename.c_str(), O_RDONLY);
+        if (fd_ < 0) {
+            return false;
+        }
+
+        struct stat st;
+        fstat(fd_, &st);
+        size_ = (size_t)st.st_size;
+
+        void *ptr = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        data_ = ptr == MAP_FAILED ? NULL : (const unsigned char *)ptr;
+#endif
+        if (data_ == NULL) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data_ != NULL) UnmapViewOfFile(data_);
+        if (mapping_ != NULL) CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+        mapping_ = NULL;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_ != NULL) munmap((void *)data_, size_);
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+#endif
+        data_ = NULL;
+        size_ = 0;
+    }
+
+    const unsigned char *data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const unsigned char *data_;
+    size_t size_;
+#ifdef _WIN32
+    HANDLE file_;
+    HANDLE mapping_;
+#else
+    int fd_;
+#endif
+};
+
+// 画像を上の行から順に1行ずつ読み出すためのインタフェース
+// タイルファイルを作るときに, 画像全体をメモリに置かずに済むようにする
+class ImageRowSource {
+public:
+    virtual ~ImageRowSource() {
+    }
+
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+
+    // 次の1行をRGBA (1画素4バイト) で読み出す
+    virtual bool readRow(unsigned char *rgba) = 0;
+};
+
+// メモリ上のRGBA画像から読み出す (画像はコピーせずに参照する)
+class MemoryRowSource : public ImageRowSource {
+public:
+    MemoryRowSource(const unsigned char *rgba, int width, int height)
+        : rgba_(rgba)
+        , width_(width)
+        , height_(height)
+        , row_(0) {
+    }
+
+    int width() const {
+        return width_;
+    }
+
+    int height() const {
+        return height_;
+    }
+
+    bool readRow(unsigned char *rgba) {
+        if (row_ >= height_) {
+            return false;
+        }
+        std::memcpy(rgba, rgba_ + (size_t)row_ * width_ * 4, (size_t)width_ * 4);
+        row_++;
+        return true;
+    }
+
+private:
+    const unsigned char *rgba_;
+    int width_, height_;
+    int row_;
+};
+
+// バイナリ形式のPPM (P6, 1チャンネル8ビット) をファイルから少しずつ読み出す
+// stb_imageは画像全体を展開するので, メモリに載らない巨大な画像はこの形式で与える
+class PpmRowSource : public ImageRowSource {
+public:
+    PpmRowSource()
+        : fp_(NULL)
+        , width_(0)
+        , height_(0) {
+    }
+
+    ~PpmRowSource() {
+        close();
+    }
+
+    bool open(const std::string &filename) {
+        close();
+        fp_ = fopen(filename.c_str(), "rb");
+        if (fp_ == NULL) {
+            return false;
+        }
+
+        // ヘッダの最後の値の直後には空白が1文字だけあり, その次から画素が始まる
+        int maxValue = 0;
+        if (fgetc(fp_) != 'P' || fgetc(fp_) != '6' || !readHeaderValue(&width_) ||
+            !readHeaderValue(&height_) || !readHeaderValue(&maxValue) ||
+            width_ <= 0 || height_ <= 0 || maxValue != 255) {
+            close();
+            return false;
+        }
+
+        rgb_.resize((size_t)width_ * 3);
+        return true;
+    }
+
+    void close() {
+        if (fp_ != NULL) {
+            fclose(fp_);
+        }
+        fp_ = NULL;
+    }
+
+    int width() const {
+        return width_;
+    }
+
+    int height() const {
+        return height_;
+    }
+
+    bool readRow(unsigned char *rgba) {
+        if (fread(rgb_.data(), 3, width_, fp_) != (size_t)width_) {
+            return false;
+        }
+        for (int x = 0; x < width_; x++) {
+            rgba[x * 4 + 0] = rgb_[x * 3 + 0];
+            rgba[x * 4 + 1] = rgb_[x * 3 + 1];
+            rgba[x * 4 + 2] = rgb_[x * 3 + 2];
+            rgba[x * 4 + 3] = 255;
+        }
+        return true;
+    }
+
+private:
+    PpmRowSource(const PpmRowSource &) = delete;
+    PpmRowSource &operator=(const PpmRowSource &) = delete;
+
+    // 空白とコメントを読み飛ばし, 10進数の値を1つ読む
+    bool readHeaderValue(int *value) {
+        int c = fgetc(fp_);
+        while (c == '#' || std::isspace(c)) {
+            if (c == '#') {
+                while (c != '\n' && c != EOF) {
+                    c = fgetc(fp_);
+                }
+            }
+            c = fgetc(fp_);
+        }
+
+        if (!std::isdigit(c)) {
+            return false;
+        }
+
+        long long v = 0;
+        while (std::isdigit(c)) {
+            v = v * 10 + (c - '0');
+            if (v > INT_MAX) {
+                return false;
+            }
+            c = fgetc(fp_);
+        }
+        *value = (int)v;
+        return true;
+    }
+
+    FILE *fp_;
+    int width_, height_;
+    std::vector<unsigned char> rgb_;
+};
+
+// タイルファイルの元になった画像ファイルの大きさと更新時刻
+// タイルファイルに記録しておき, 画像が変わっていればタイルファイルを作り直す
+struct SourceStamp {
+    SourceStamp()
+        : size(0)
+        , mtime(0) {
+    }
+
+    uint64_t size;
+    int64_t mtime;
+};
+
+inline bool getSourceStamp(const std::string &filename, SourceStamp *stamp) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &attr)) {
+        return false;
+    }
+    stamp->size = ((uint64_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+    stamp->mtime = (int64_t)(((uint64_t)attr.ftLastWriteTime.dwHighDateTime << 32) | attr.ftLastWriteTime.dwLowDateTime);
+#else
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        return false;
+    }
+    stamp->size = (uint64_t)st.st_size;
+    stamp->mtime = (int64_t)st.st_mtime;
+#endif
+    return true;
+}
+
+// タイルファイルの先頭に置かれる情報
+// ヘッダの後に全タイルのオフセット (uint64, 存在しないタイルは0) が並び, その後にタイルの画素が続く
+struct TileFileHeader {
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t tileSize;
+    uint32_t border;
+    uint32_t numLevels;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+};
+
+// 巨大な画像をタイルに分割し, 必要な部分だけを固定サイズのキャッシュテクスチャに読み込むクラス
+// 仮想的な画像は (tileSize << (numLevels - 1)) 画素の正方形で, 実際の画像はその左上に置かれる
+class VirtualTexture {
+public:
+    static const uint32_t MAGIC = 0x32495456;  // "VTI2"
+
+    // タイルの番号は24ビットで表すので, レベル数はこれ以下にする
+    static const int MAX_LEVELS = 25;
+
+    // キャッシュテクスチャの大きさを抑えるため, タイルの一辺はこれ以下にする
+    static const int MAX_TILE_SIZE = 1024;
+
+    VirtualTexture()
+        : offsets_(NULL)
+        , numLevels_(0)
+        , tileSize_(0)
+        , border_(0)
+        , slotSize_(0)
+        , slotsX_(0)
+        , slotsY_(0)
+        , width_(0)
+        , height_(0)
+        , frame_(0)
+        , maxRequestsPerFrame_(32)
+        , maxUploadsPerFrame_(8)
+        , uploadsLastFrame_(0)
+        , pageTableId_(0u)
+        , cacheTextureId_(0u)
+        , stop_(false) {
+    }
+
+    ~VirtualTexture() {
+        if (loader_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            cond_.notify_all();
+            loader_.join();
+        }
+    }
+
+    // 画像からミップマップのピラミッドを作り, タイルファイルとして書き出す
+    // 画像は数行ずつ読み出し, 粗いレベルは書き出し済みの1つ細かいレベルのタイルから作るので,
+    // 使うメモリはタイル1行分程度で済む
+    // stampには元の画像ファイルの情報を渡し, openのときに画像が変わっていないかを調べるのに使う
+    static bool buildTileFile(const std::string &filename, ImageRowSource *source, const SourceStamp &stamp,
+                              int tileSize = 128, int border = 1) {
+        const int width = source->width();
+        const int height = source->height();
+        if (width <= 0 || height <= 0 || tileSize <= 0 || tileSize > MAX_TILE_SIZE || border < 0 || border > tileSize) {
+            return false;
+        }
+
+        int numLevels = 1;
+        while (((int64_t)tileSize << (numLevels - 1)) < std::max(width, height)) {
+            numLevels++;
+        }
+        if (numLevels > MAX_LEVELS) {
+            return false;
+        }
+
+        FILE *fp = fopen(filename.c_str(), "w+b");
+        if (fp == NULL) {
+            return false;
+        }
+
+        TileFileHeader header;
+        header.magic = MAGIC;
+        header.width = width;
+        header.height = height;
+        header.tileSize = tileSize;
+        header.border = border;
+        header.numLevels = numLevels;
+        header.sourceSize = stamp.size;
+        header.sourceTime = stamp.mtime;
+
+        std::vector<uint64_t> offsets(tableSize(numLevels), 0);
+        fwrite(&header, sizeof(header), 1, fp);
+        fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), fp);
+        uint64_t offset = sizeof(header) + sizeof(uint64_t) * offsets.size();
+
+        bool success = true;
+        int w = width, h = height;
+        for (int l = 0; l < numLevels && success; l++) {
+            if (l == 0) {
+                success = writeLevel(fp, source, numLevels, l, tileSize, border, &offsets, &offset);
+            } else {
+                // 1つ細かいレベルをファイルから読み戻し, 2x2画素の平均で縮小する
+                TileRowSource finer(fp, &offsets[levelOffset(numLevels, l - 1)], 1 << (numLevels - l),
+                                    w, h, tileSize, border);
+                HalfRowSource coarser(&finer);
+                success = writeLevel(fp, &coarser, numLevels, l, tileSize, border, &offsets, &offset);
+                w = coarser.width();
+                h = coarser.height();
+            }
+        }
+
+        success = success && seekFile(fp, sizeof(header)) &&
+                  fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), fp) == offsets.size();
+        success = fclose(fp) == 0 && success;
+        if (!success) {
+            // 書きかけのファイルが次回に開かれないように消しておく
+            std::remove(filename.c_str());
+        }
+        return success;
+    }
+
+    // タイルファイルを開き, キャッシュテクスチャとページテーブルを用意する (要OpenGLコンテキスト)
+    // ファイルが壊れているか, stampの画像から作られたものでなければfalseを返す
+    bool open(const std::string &filename, int slotsX, int slotsY, const SourceStamp &stamp) {
+        if (!file_.open(filename) || !validateTileFile(stamp)) {
+            file_.close();
+            return false;
+        }
+
+        TileFileHeader header;
+        std::memcpy(&header, file_.data(), sizeof(header));
+
+        width_ = header.width;
+        height_ = header.height;
+        tileSize_ = header.tileSize;
+        border_ = header.border;
+        numLevels_ = header.numLevels;
+        slotSize_ = tileSize_ + 2 * border_;
+        slotsX_ = slotsX;
+        slotsY_ = slotsY;
+        offsets_ = (const uint64_t *)(file_.data() + sizeof(header));
+
+        // タイルの画素を保持するキャッシュテクスチャ
+        glGenTextures(1, &cacheTextureId_);
+        glBindTexture(GL_TEXTURE_2D, cacheTextureId_);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, slotsX_ * slotSize_, slotsY_ * slotSize_, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        // 各レベルの各タイルがキャッシュのどこにあるかを表すページテーブル (ミップマップ付き)
+        pageTable_.resize(numLevels_);
+        dirty_.assign(numLevels_, DirtyRect());
+        glGenTextures(1, &pageTableId_);
+        glBindTexture(GL_TEXTURE_2D, pageTableId_);
+        for (int l = 0; l < numLevels_; l++) {
+            const int n = tilesPerSide(l);
+            pageTable_[l].assign((size_t)n * n * 4, 0);
+            glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8, n, n, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels_ - 1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        // スロット0には最も粗いタイルを常駐させ, 他のタイルが無いときの代わりとする
+        slots_.assign(slotsX_ * slotsY_, Slot());
+        for (int i = (int)slots_.size() - 1; i >= 1; i--) {
+            freeSlots_.push_back(i);
+        }
+        const uint64_t root = tileKey(numLevels_ - 1, 0, 0);
+        slots_[0].key = root;
+        slots_[0].occupied = true;
+        uploadTile(0, tilePixels(root));
+        resident_[root] = 0;
+        refreshSubtree(numLevels_ - 1, 0, 0);
+        uploadPageTable();
+
+        loader_ = std::thread(&VirtualTexture::loaderLoop, this);
+        return true;
+    }
+
+    // 見えているタイルを求め, 読み込みの要求と読み込み済みタイルの転送を行う
+    // uvToClip: 仮想画像のuv座標 (u, v, 0, 1) をクリップ座標に移す行列
+    void update(const glm::mat4 &uvToClip, int viewportWidth, int viewportHeight) {
+        frame_++;
+
+        std::vector<uint64_t> visible;
+        collectVisibleTiles(uvToClip, viewportWidth, viewportHeight, &visible);
+
+        // 常駐しているタイルは最近使われたものとして記録し, それ以外は読み込みを要求する
+        std::vector<uint64_t> missing;
+        for (size_t i = 0; i < visible.size(); i++) {
+            std::unordered_map<uint64_t, int>::iterator it = resident_.find(visible[i]);
+            if (it != resident_.end()) {
+                touchSlot(it->second);
+            } else {
+                missing.push_back(visible[i]);
+            }
+        }
+
+        std::vector<LoadedTile> completed;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            // まだ読み込みが始まっていない古い要求は破棄し, 現在の視点で必要なものだけを要求する
+            for (size_t i = 0; i < requests_.size(); i++) {
+                requested_.erase(requests_[i]);
+            }
+            requests_.clear();
+            for (size_t i = 0; i < missing.size() && (int)requests_.size() < maxRequestsPerFrame_; i++) {
+                if (requested_.insert(missing[i]).second) {
+                    requests_.push_back(missing[i]);
+                }
+            }
+
+            completed.swap(completed_);
+        }
+        cond_.notify_one();
+
+        // 読み込みの終わったタイルをキャッシュに転送する
+        uploadsLastFrame_ = 0;
+        for (size_t i = 0; i < completed.size(); i++) {
+            const uint64_t key = completed[i].key;
+            requested_.erase(key);
+            if (resident_.count(key) != 0 || uploadsLastFrame_ >= maxUploadsPerFrame_) {
+                continue;
+            }
+
+            const int slot = allocateSlot();
+            if (slot < 0) {
+                continue;
+            }
+
+            slots_[slot].key = key;
+            slots_[slot].occupied = true;
+            touchSlot(slot);
+            uploadTile(slot, completed[i].pixels.data());
+            resident_[key] = slot;
+            refreshSubtree(keyLevel(key), keyX(key), keyY(key));
+            uploadsLastFrame_++;
+        }
+
+        uploadPageTable();
+    }
+
+    GLuint pageTableId() const {
+        return pageTableId_;
+    }
+
+    GLuint cacheTextureId() const {
+        return cacheTextureId_;
+    }
+
+    // 画像のuv座標から仮想画像のuv座標への拡大率
+    glm::vec2 uvScale() const {
+        const float virtualSize = (float)(tileSize_ << (numLevels_ - 1));
+        return glm::vec2(width_ / virtualSize, height_ / virtualSize);
+    }
+
+    int width() const {
+        return width_;
+    }
+
+    int height() const {
+        return height_;
+    }
+
+    int tileSize() const {
+        return tileSize_;
+    }
+
+    int border() const {
+        return border_;
+    }
+
+    int numLevels() const {
+        return numLevels_;
+    }
+
+    glm::vec2 cacheSlots() const {
+        return glm::vec2(slotsX_, slotsY_);
+    }
+
+    int residentTiles() const {
+        return (int)resident_.size();
+    }
+
+    int pendingTiles() const {
+        return (int)requested_.size();
+    }
+
+    int uploadsLastFrame() const {
+        return uploadsLastFrame_;
+    }
+
+private:
+    struct LoadedTile {
+        uint64_t key;
+        std::vector<unsigned char> pixels;
+    };
+
+    struct Slot {
+        Slot()
+            : key(0)
+            , lastUsed(0)
+            , occupied(false)
+            , inLru(false) {
+        }
+
+        uint64_t key;
+        uint64_t lastUsed;
+        bool occupied;
+        bool inLru;
+        std::list<int>::iterator lruIt;
+    };
+
+    struct DirtyRect {
+        DirtyRect()
+            : x0(INT32_MAX)
+            , y0(INT32_MAX)
+            , x1(-1)
+            , y1(-1) {
+        }
+
+        int x0, y0, x1, y1;
+    };
+
+    // ヘッダとオフセット表がファイルの中身と矛盾していないかを調べる
+    bool validateTileFile(const SourceStamp &stamp) const {
+        if (file_.size() < sizeof(TileFileHeader)) {
+            return false;
+        }
+
+        TileFileHeader header;
+        std::memcpy(&header, file_.data(), sizeof(header));
+        if (header.magic != MAGIC || header.sourceSize != stamp.size || header.sourceTime != stamp.mtime) {
+            return false;
+        }
+
+        // 範囲外の値はシフトやタイル数の計算で未定義動作になるので, 先に調べておく
+        if (header.numLevels < 1 || header.numLevels > (uint32_t)MAX_LEVELS || header.tileSize < 1 ||
+            header.tileSize > (uint32_t)MAX_TILE_SIZE || header.border > header.tileSize) {
+            return false;
+        }
+
+        const uint64_t virtualSize = (uint64_t)header.tileSize << (header.numLevels - 1);
+        if (header.width < 1 || header.height < 1 || header.width > virtualSize || header.height > virtualSize ||
+            header.width > (uint32_t)INT_MAX || header.height > (uint32_t)INT_MAX) {
+            return false;
+        }
+
+        const size_t numTiles = tableSize(header.numLevels);
+        const uint64_t dataStart = sizeof(header) + sizeof(uint64_t) * (uint64_t)numTiles;
+        if (file_.size() < dataStart) {
+            return false;
+        }
+
+        // タイルの画素がファイルに収まっているか (存在しないタイルは0)
+        const uint64_t slotSize = header.tileSize + 2 * header.border;
+        const uint64_t tileBytes = slotSize * slotSize * 4;
+        const uint64_t *offsets = (const uint64_t *)(file_.data() + sizeof(header));
+        for (size_t i = 0; i < numTiles; i++) {
+            if (offsets[i] != 0 && (offsets[i] < dataStart || offsets[i] > file_.size() ||
+                                    file_.size() - offsets[i] < tileBytes)) {
+                return false;
+            }
+        }
+
+        // 最も粗いタイルは常駐させるので必ず必要
+        return offsets[numTiles - 1] != 0;
+    }
+
+    // 書き出し済みのタイルから, あるレベルの画像を上の行から順に読み戻す
+    class TileRowSource : public ImageRowSource {
+    public:
+        TileRowSource(FILE *fp, const uint64_t *offsets, int tilesPerSide, int width, int height,
+                      int tileSize, int border)
+            : fp_(fp)
+            , offsets_(offsets)
+            , tilesPerSide_(tilesPerSide)
+            , width_(width)
+            , height_(height)
+            , tileSize_(tileSize)
+            , border_(border)
+            , row_(0)
+            , strip_((size_t)tileSize * width * 4)
+            , tile_((size_t)(tileSize + 2 * border) * (tileSize + 2 * border) * 4) {
+        }
+
+        int width() const {
+            return width_;
+        }
+
+        int height() const {
+            return height_;
+        }
+
+        bool readRow(unsigned char *rgba) {
+            if (row_ >= height_) {
+                return false;
+            }
+
+            // タイル1行分の内側 (境界を除いた部分) をまとめて読み込む
+            const int j = row_ % tileSize_;
+            if (j == 0 && !readTileRow(row_ / tileSize_)) {
+                return false;
+            }
+
+            std::memcpy(rgba, &strip_[(size_t)j * width_ * 4], (size_t)width_ * 4);
+            row_++;
+            return true;
+        }
+
+    private:
+        bool readTileRow(int ty) {
+            const int slotSize = tileSize_ + 2 * border_;
+            for (int tx = 0; tx * tileSize_ < width_; tx++) {
+                if (!seekFile(fp_, offsets_[(size_t)ty * tilesPerSide_ + tx]) ||
+                    fread(tile_.data(), 1, tile_.size(), fp_) != tile_.size()) {
+                    return false;
+                }
+
+                const int columns = std::min(tileSize_, width_ - tx * tileSize_);
+                for (int j = 0; j < tileSize_; j++) {
+                    std::memcpy(&strip_[((size_t)j * width_ + tx * tileSize_) * 4],
+                                &tile_[((size_t)(j + border_) * slotSize + border_) * 4], (size_t)columns * 4);
+                }
+            }
+            return true;
+        }
+
+        FILE *fp_;
+        const uint64_t *offsets_;
+        int tilesPerSide_;
+        int width_, height_;
+        int tileSize_, border_;
+        int row_;
+        std::vector<unsigned char> strip_;
+        std::vector<unsigned char> tile_;
+    };
+
+    // 2x2画素の平均で縦横半分に縮小しながら読み出す
+    class HalfRowSource : public ImageRowSource {
+    public:
+        explicit HalfRowSource(ImageRowSource *source)
+            : source_(source)
+            , row_(0)
+            , upper_((size_t)source->width() * 4)
+            , lower_((size_t)source->width() * 4) {
+        }
+
+        int width() const {
+            return std::max(1, (source_->width() + 1) / 2);
+        }
+
+        int height() const {
+            return std::max(1, (source_->height() + 1) / 2);
+        }
+
+        bool readRow(unsigned char *rgba) {
+            if (row_ >= height() || !source_->readRow(upper_.data())) {
+                return false;
+            }
+
+            // 画像の高さが奇数なら最後の行は自分自身と平均する
+            if (2 * row_ + 1 < source_->height()) {
+                if (!source_->readRow(lower_.data())) {
+                    return false;
+                }
+            } else {
+                lower_ = upper_;
+            }
+
+            const int w = source_->width();
+            for (int x = 0; x < width(); x++) {
+                const int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+                for (int c = 0; c < 4; c++) {
+                    const int sum = upper_[x0 * 4 + c] + upper_[x1 * 4 + c] + lower_[x0 * 4 + c] + lower_[x1 * 4 + c];
+                    rgba[x * 4 + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+            row_++;
+            return true;
+        }
+
+    private:
+        ImageRowSource *source_;
+        int row_;
+        std::vector<unsigned char> upper_, lower_;
+    };
+
+    static bool seekFile(FILE *fp, uint64_t offset) {
+#ifdef _WIN32
+        return _fseeki64(fp, (__int64)offset, SEEK_SET) == 0;
+#else
+        return fseeko(fp, (off_t)offset, SEEK_SET) == 0;
+#endif
+    }
+
+    // 1つのレベルの画像をタイルに切り分けて書き出す
+    // 境界の画素のために上下に重なるタイル1行分 (tileSize + 2 * border 行) だけを保持する
+    static bool writeLevel(FILE *fp, ImageRowSource *source, int numLevels, int level, int tileSize, int border,
+                           std::vector<uint64_t> *offsets, uint64_t *offset) {
+        const int w = source->width();
+        const int h = source->height();
+        const int n = 1 << (numLevels - 1 - level);
+        const int slotSize = tileSize + 2 * border;
+        const size_t rowBytes = (size_t)w * 4;
+
+        std::vector<unsigned char> strip((size_t)slotSize * rowBytes);
+        std::vector<unsigned char> row(rowBytes);
+        std::vector<unsigned char> tile((size_t)slotSize * slotSize * 4);
+        int lastRow = -1;
+        for (int ty = 0; ty * tileSize < h; ty++) {
+            for (int j = 0; j < slotSize; j++) {
+                unsigned char *dst = &strip[(size_t)j * rowBytes];
+                if (ty > 0 && j < 2 * border) {
+                    // 前のタイル行と重なる行はすでに読み込んである
+                    std::memcpy(dst, &strip[(size_t)(j + tileSize) * rowBytes], rowBytes);
+                    continue;
+                }
+
+                const int sy = std::min(std::max(ty * tileSize + j - border, 0), h - 1);
+                while (lastRow < sy) {
+                    if (!source->readRow(row.data())) {
+                        return false;
+                    }
+                    lastRow++;
+                }
+                std::memcpy(dst, row.data(), rowBytes);
+            }
+
+            for (int tx = 0; tx * tileSize < w; tx++) {
+                // 隣のタイルとの境界で補間できるように周囲の画素も含めて切り出す
+                for (int j = 0; j < slotSize; j++) {
+                    for (int i = 0; i < slotSize; i++) {
+                        const int sx = std::min(std::max(tx * tileSize + i - border, 0), w - 1);
+                        std::memcpy(&tile[(j * slotSize + i) * 4], &strip[(size_t)j * rowBytes + (size_t)sx * 4], 4);
+                    }
+                }
+
+                // 細かいレベルの読み戻しでファイル位置が動いているので, 末尾に戻してから書く
+                (*offsets)[levelOffset(numLevels, level) + (size_t)ty * n + tx] = *offset;
+                if (!seekFile(fp, *offset) || fwrite(tile.data(), 1, tile.size(), fp) != tile.size()) {
+                    return false;
+                }
+                *offset += tile.size();
+            }
+        }
+        return true;
+    }
+
+    static uint64_t tileKey(int level, int x, int y) {
+        return ((uint64_t)level << 48) | ((uint64_t)y << 24) | (uint64_t)x;
+    }
+
+    static int keyLevel(uint64_t key) {
+        return (int)(key >> 48);
+    }
+
+    static int keyY(uint64_t key) {
+        return (int)((key >> 24) & 0xffffff);
+    }
+
+    static int keyX(uint64_t key) {
+        return (int)(key & 0xffffff);
+    }
+
+    static size_t tableSize(int numLevels) {
+        return levelOffset(numLevels, numLevels);
+    }
+
+    // オフセット表の中でレベルlの先頭の位置
+    static size_t levelOffset(int numLevels, int l) {
+        size_t offset = 0;
+        for (int k = 0; k < l; k++) {
+            const size_t n = (size_t)1 << (numLevels - 1 - k);
+            offset += n * n;
+        }
+        return offset;
+    }
+
+    int tilesPerSide(int level) const {
+        return 1 << (numLevels_ - 1 - level);
+    }
+
+    uint64_t tileOffset(uint64_t key) const {
+        const int l = keyLevel(key);
+        return offsets_[levelOffset(numLevels_, l) + (size_t)keyY(key) * tilesPerSide(l) + keyX(key)];
+    }
+
+    const unsigned char *tilePixels(uint64_t key) const {
+        return file_.data() + tileOffset(key);
+    }
+
+    // 粗いレベルから順に画面上のタイルを調べ, 1画素あたり1テクセルより粗いタイルは細分する
+    void collectVisibleTiles(const glm::mat4 &uvToClip, int viewportWidth, int viewportHeight,
+                             std::vector<uint64_t> *visible) const {
+        // 同時に使えるタイルの数はキャッシュの大きさで決まる
+        const size_t budget = slots_.size() - 1;
+
+        std::deque<uint64_t> queue;
+        queue.push_back(tileKey(numLevels_ - 1, 0, 0));
+        while (!queue.empty() && visible->size() < budget) {
+            const uint64_t key = queue.front();
+            queue.pop_front();
+            if (tileOffset(key) == 0) {
+                continue;
+            }
+
+            const int level = keyLevel(key);
+            const float tileUv = 1.0f / tilesPerSide(level);
+            const float u0 = keyX(key) * tileUv, v0 = keyY(key) * tileUv;
+            const glm::vec4 corners[4] = {
+                uvToClip * glm::vec4(u0, v0, 0.0f, 1.0f),
+                uvToClip * glm::vec4(u0 + tileUv, v0, 0.0f, 1.0f),
+                uvToClip * glm::vec4(u0, v0 + tileUv, 0.0f, 1.0f),
+                uvToClip * glm::vec4(u0 + tileUv, v0 + tileUv, 0.0f, 1.0f)
+            };
+
+            // 視錐台のいずれかの平面の外側に4頂点とも出ていれば見えない
+            bool culled = false;
+            for (int axis = 0; axis < 3 && !culled; axis++) {
+                bool allBelow = true, allAbove = true;
+                for (int i = 0; i < 4; i++) {
+                    allBelow = allBelow && corners[i][axis] < -corners[i].w;
+                    allAbove = allAbove && corners[i][axis] > corners[i].w;
+                }
+                culled = allBelow || allAbove;
+            }
+            if (culled) {
+                continue;
+            }
+
+            visible->push_back(key);
+            if (level == 0) {
+                continue;
+            }
+
+            // 画面上でのタイルの辺の長さ (画素数) がタイルの画素数を超えるなら細かいレベルが必要
+            bool refine = false;
+            glm::vec2 screen[4];
+            for (int i = 0; i < 4 && !refine; i++) {
+                if (corners[i].w <= 1.0e-6f) {
+                    refine = true;
+                    break;
+                }
+                screen[i] = glm::vec2(corners[i].x / corners[i].w * 0.5f * viewportWidth,
+                                      corners[i].y / corners[i].w * 0.5f * viewportHeight);
+            }
+
+            if (!refine) {
+                const float edge = std::max(std::max(glm::length(screen[1] - screen[0]), glm::length(screen[2] - screen[0])),
+                                            std::max(glm::length(screen[3] - screen[1]), glm::length(screen[3] - screen[2])));
+                refine = edge > tileSize_;
+            }
+
+            if (refine) {
+                const int cx = keyX(key) * 2, cy = keyY(key) * 2;
+                queue.push_back(tileKey(level - 1, cx, cy));
+                queue.push_back(tileKey(level - 1, cx + 1, cy));
+                queue.push_back(tileKey(level - 1, cx, cy + 1));
+                queue.push_back(tileKey(level - 1, cx + 1, cy + 1));
+            }
+        }
+    }
+
+    // 使われていないスロットか, 最も長く使われていないスロットを返す
+    int allocateSlot() {
+        if (!freeSlots_.empty()) {
+            const int slot = freeSlots_.back();
+            freeSlots_.pop_back();
+            return slot;
+        }
+
+        if (lru_.empty()) {
+            return -1;
+        }
+
+        const int slot = lru_.back();
+        if (slots_[slot].lastUsed == frame_) {
+            // 全てのタイルが今のフレームで使われている
+            return -1;
+        }
+
+        const uint64_t evicted = slots_[slot].key;
+        lru_.pop_back();
+        slots_[slot].inLru = false;
+        slots_[slot].occupied = false;
+        resident_.erase(evicted);
+        refreshSubtree(keyLevel(evicted), keyX(evicted), keyY(evicted));
+        return slot;
+    }
+
+    void touchSlot(int slot) {
+        if (slot == 0) {
+            // 最も粗いタイルは追い出さない
+            return;
+        }
+
+        Slot &s = slots_[slot];
+        s.lastUsed = frame_;
+        if (s.inLru) {
+            lru_.splice(lru_.begin(), lru_, s.lruIt);
+        } else {
+            lru_.push_front(slot);
+            s.lruIt = lru_.begin();
+            s.inLru = true;
+        }
+    }
+
+    void uploadTile(int slot, const unsigned char *pixels) {
+        const int sx = slot % slotsX_;
+        const int sy = slot / slotsX_;
+        glBindTexture(GL_TEXTURE_2D, cacheTextureId_);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, sx * slotSize_, sy * slotSize_, slotSize_, slotSize_,
+                        GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // 指定したタイル以下の全レベルのページテーブルを, 常駐している最も細かいタイルで更新する
+    void refreshSubtree(int level, int tx, int ty) {
+        for (int l = level; l >= 0; l--) {
+            const int scale = 1 << (level - l);
+            const int n = tilesPerSide(l);
+            for (int y = ty * scale; y < (ty + 1) * scale; y++) {
+                for (int x = tx * scale; x < (tx + 1) * scale; x++) {
+                    int slot = 0, found = numLevels_ - 1;
+                    for (int k = l; k < numLevels_; k++) {
+                        std::unordered_map<uint64_t, int>::const_iterator it = resident_.find(tileKey(k, x >> (k - l), y >> (k - l)));
+                        if (it != resident_.end()) {
+                            slot = it->second;
+                            found = k;
+                            break;
+                        }
+                    }
+
+                    unsigned char *entry = &pageTable_[l][((size_t)y * n + x) * 4];
+                    entry[0] = (unsigned char)(slot % slotsX_);
+                    entry[1] = (unsigned char)(slot / slotsX_);
+                    entry[2] = (unsigned char)found;
+                    entry[3] = 255;
+                }
+            }
+
+            DirtyRect &rect = dirty_[l];
+            rect.x0 = std::min(rect.x0, tx * scale);
+            rect.y0 = std::min(rect.y0, ty * scale);
+            rect.x1 = std::max(rect.x1, (tx + 1) * scale);
+            rect.y1 = std::max(rect.y1, (ty + 1) * scale);
+        }
+    }
+
+    // 変更のあった範囲だけページテーブルを転送する
+    void uploadPageTable() {
+        glBindTexture(GL_TEXTURE_2D, pageTableId_);
+        for (int l = 0; l < numLevels_; l++) {
+            DirtyRect &rect = dirty_[l];
+            if (rect.x1 < 0) {
+                continue;
+            }
+
+            const int n = tilesPerSide(l);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, n);
+            glTexSubImage2D(GL_TEXTURE_2D, l, rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0,
+                            GL_RGBA, GL_UNSIGNED_BYTE, &pageTable_[l][((size_t)rect.y0 * n + rect.x0) * 4]);
+            rect = DirtyRect();
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // 読み込み用スレッド. マップしたファイルからの読み出し (ページフォルト) を描画スレッドから切り離す
+    void loaderLoop() {
+        const size_t tileBytes = (size_t)slotSize_ * slotSize_ * 4;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cond_.wait(lock, [this]() { return stop_ || !requests_.empty(); });
+            if (stop_) {
+                break;
+            }
+
+            LoadedTile tile;
+            tile.key = requests_.front();
+            requests_.pop_front();
+            lock.unlock();
+
+            const unsigned char *src = tilePixels(tile.key);
+            tile.pixels.assign(src, src + tileBytes);
+
+            lock.lock();
+            completed_.push_back(std::move(tile));
+        }
+    }
+
+    MappedFile file_;
+    const uint64_t *offsets_;
+    int numLevels_, tileSize_, border_, slotSize_;
+    int slotsX_, slotsY_;
+    int width_, height_;
+    uint64_t frame_;
+    int maxRequestsPerFrame_;
+    int maxUploadsPerFrame_;
+    int uploadsLastFrame_;
+
+    GLuint pageTableId_;
+    GLuint cacheTextureId_;
+    std::vector<std::vector<unsigned char>> pageTable_;
+    std::vector<DirtyRect> dirty_;
+
+    std::vector<Slot> slots_;
+    std::vector<int> freeSlots_;
+    std::list<int> lru_;
+    std::unordered_map<uint64_t, int> resident_;
+    std::unordered_set<uint64_t> requested_;
+
+    std::thread loader_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<uint64_t> requests_;
+    std::vector<LoadedTile> completed_;
+    bool stop_;
+};
+
+#endif  // _VIRTUAL_TEXTURE_H_
@@ -4,6 +4,10 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 #define GLAD_GL_IMPLEMENTATION
 #include <glad/gl.h>
@@ -21,6 +25,11 @@
 
 #include "common.h"
 #include "wave_equation.h"
+#include <glutils/shader_builder.h>
+#include <glutils/stream_buffer.h>
+#include <glutils/fixed_timestep.h>
+#include <glutils/triple_buffer.h>
+#include <glutils/job_system.h>
 
 static int WIN_WIDTH   = 500;                       // ウィンドウの幅
 static int WIN_HEIGHT  = 500;                       // ウィンドウの高さ
@@ -36,14 +45,18 @@ GLuint vaoId;
 GLuint vboId;
 GLuint iboId;
 
+// 毎フレーム書き換える高さを流し込むバッファ
+StreamBuffer heightStream;
+
 // シェーダを参照する番号
-GLuint vertShaderId;
-GLuint fragShaderId;
 GLuint programId;
 
 // テクスチャ
 GLuint textureId;
 
+// 波動方程式の計算を行ごとに分けて並列に進めるワーカスレッド
+JobSystem jobs;
+
 // 波動方程式の計算に使うパラメータ
 WaveEquation waveEqn;
 static const int xCells = 100;
@@ -52,8 +65,60 @@ static const double speed = 0.5;
 static const double dx = 0.05;
 static const double dt = 0.05;
 
-// 頂点のデータ
-std::vector<glm::vec3> positions;
+// 頂点のデータ (xy座標は変わらないので, 高さだけを毎フレーム転送する)
+std::vector<glm::vec2> positions;
+
+// シミュレーションは描画の速さによらず, 1秒に60ステップの一定の間隔で進める
+FixedTimestep timestep(1.0 / 60.0);
+
+// 直前のステップと現在のステップの高さ (描画ではこの間を補間する)
+std::vector<float> prevHeights;
+std::vector<float> currHeights;
+
+// シミュレーション用のスレッドから描画用のスレッドに渡す高さ
+struct HeightSnapshot {
+    HeightSnapshot()
+        : time(0.0) {
+    }
+
+    std::vector<float> prevHeights;
+    std::vector<float> currHeights;
+    double time;    // currHeightsを計算し終えた時刻
+};
+
+// 起動時に --sim-thread を付けると, シミュレーションを別のスレッドで進める
+// (重いステップがあっても描画が止まらない). 結果は三重バッファの受け渡し口で描画側に渡す
+bool useSimulationThread = false;
+TripleBuffer<HeightSnapshot> heightMailbox;
+std::atomic<bool> quitSimulation(false);
+
+// 現在の波の高さを取り出す
+void readHeights(std::vector<float> *heights) {
+    heights->resize(xCells * yCells);
+    for (int y = 0; y < yCells; y++) {
+        for (int x = 0; x < xCells; x++) {
+            (*heights)[y * xCells + x] = (float)waveEqn.get(x, y);
+        }
+    }
+}
+
+// 補間した高さをこのフレームのセグメントに書き込み, 頂点属性の参照先を付け替える
+void uploadHeights(const std::vector<float> &prev, const std::vector<float> &curr, float alpha) {
+    heightStream.beginFrame();
+
+    GLintptr offset;
+    float *heights = (float*)heightStream.allocate(sizeof(float) * positions.size(), sizeof(float), &offset);
+    for (size_t i = 0; i < curr.size(); i++) {
+        heights[i] = prev[i] + (curr[i] - prev[i]) * alpha;
+    }
+    heightStream.flush();
+
+    glBindVertexArray(vaoId);
+    glBindBuffer(GL_ARRAY_BUFFER, heightStream.id());
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)offset);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
 // OpenGLの初期化関数
 void initializeGL() {
@@ -71,7 +136,7 @@ void initializeGL() {
         for (int x = 0; x < xCells; x++) {
             double vx = (x - xCells / 2) * dx;
             double vy = (y - yCells / 2) * dx;
-            positions.push_back(glm::vec3(vx, vy, 0.0));
+            positions.push_back(glm::vec2(vx, vy));
 
             waveEqn.set(x, y, 2.0 * exp(-5.0 * (vx * vx + vy * vy)));
         }
@@ -85,12 +150,15 @@ void initializeGL() {
 
     glGenBuffers(1, &vboId);
     glBindBuffer(GL_ARRAY_BUFFER, vboId);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * positions.size(),
-                 &positions[0], GL_DYNAMIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * positions.size(),
+                 &positions[0], GL_STATIC_DRAW);
 
     glEnableVertexAttribArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, vboId);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), 0);
+
+    // 高さはストリーム用のバッファから読む (参照先はフレームごとに uploadHeights で設定する)
+    glEnableVertexAttribArray(1);
 
     std::vector<unsigned int> indices;
     for (int y = 0; y < yCells - 1; y++) {
@@ -117,6 +185,11 @@ void initializeGL() {
 
     glBindVertexArray(0);
 
+    // 高さの転送用バッファ (1フレームで全頂点の高さを書き込む)
+    heightStream.create(sizeof(float) * positions.size());
+    readHeights(&currHeights);
+    prevHeights = currHeights;
+
     // テクスチャの用意
     int texWidth, texHeight, channels;
     unsigned char *bytes = stbi_load(TEX_FILE.c_str(), &texWidth, &texHeight, &channels, STBI_rgb_alpha);
@@ -139,100 +212,7 @@ void initializeGL() {
     stbi_image_free(bytes);
 
     // シェーダの用意
-    vertShaderId = glCreateShader(GL_VERTEX_SHADER);
-    fragShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-
-    // ファイルの読み込み
-    std::ifstream vertShaderFile(VERT_SHADER_FILE.c_str(), std::ios::in);
-    if (!vertShaderFile.is_open()) {
-        fprintf(stderr, "Failed to load vertex shader: %s\n", VERT_SHADER_FILE.c_str());
-        exit(1);
-    }
-
-    std::string line;
-
-    std::string vertShaderBuffer;
-    while (!vertShaderFile.eof()) {
-        std::getline(vertShaderFile, line);
-        vertShaderBuffer += line + "\r\n";
-    }
-    const char *vertShaderCode = vertShaderBuffer.c_str();
-    
-    std::ifstream fragShaderFile(FRAG_SHADER_FILE.c_str(), std::ios::in);
-    if (!fragShaderFile.is_open()) {
-        fprintf(stderr, "Failed to load fragment shader: %s\n", FRAG_SHADER_FILE.c_str());
-        exit(1);
-    }
-
-    std::string fragShaderBuffer;
-    while (!fragShaderFile.eof()) {
-        std::getline(fragShaderFile, line);
-        fragShaderBuffer += line + "\n";
-    }
-    const char *fragShaderCode = fragShaderBuffer.c_str();
-
-    // シェーダのコンパイル
-    GLint compileStatus;
-    glShaderSource(vertShaderId, 1, &vertShaderCode, NULL);
-    glCompileShader(vertShaderId);
-    glGetShaderiv(vertShaderId, GL_COMPILE_STATUS, &compileStatus);
-    if (compileStatus == GL_FALSE) {
-        fprintf(stderr, "Failed to compile vertex shader!\n");
-        
-        GLint logLength;
-        glGetShaderiv(vertShaderId, GL_INFO_LOG_LENGTH, &logLength);
-        if (logLength > 0) {
-            GLsizei length;
-            char *errmsg = new char[logLength + 1];
-            glGetShaderInfoLog(vertShaderId, logLength, &length, errmsg);
-
-            std::cerr << errmsg << std::endl;
-            fprintf(stderr, "%s", vertShaderCode);
-        }
-    }
-
-    glShaderSource(fragShaderId, 1, &fragShaderCode, NULL);
-    glCompileShader(fragShaderId);
-    glGetShaderiv(fragShaderId, GL_COMPILE_STATUS, &compileStatus);
-    if (compileStatus == GL_FALSE) {
-        fprintf(stderr, "Failed to compile fragment shader!\n");
-
-        GLint logLength;
-        glGetShaderiv(fragShaderId, GL_INFO_LOG_LENGTH, &logLength);
-        if (logLength > 0) {
-            GLsizei length;
-            char *errmsg = new char[logLength + 1];
-            glGetShaderInfoLog(fragShaderId, logLength, &length, errmsg);
-
-            std::cerr << errmsg << std::endl;
-            fprintf(stderr, "%s", vertShaderCode);
-        }
-    }
-
-    // シェーダプログラムの用意
-    programId = glCreateProgram();
-    glAttachShader(programId, vertShaderId);
-    glAttachShader(programId, fragShaderId);
-
-    GLint linkState;
-    glLinkProgram(programId);
-    glGetProgramiv(programId, GL_LINK_STATUS, &linkState);
-    if (linkState == GL_FALSE) {
-        fprintf(stderr, "Failed to compile shader!\n");
-
-        GLint logLength;
-        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &logLength);
-        if (logLength > 0) {
-            GLsizei length;
-            char *errmsg = new char[logLength];
-            glGetProgramInfoLog(programId, logLength, &length, errmsg);
-
-            std::cerr << errmsg << std::endl;
-            delete[] errmsg;
-        }
-
-        exit(1);
-    }
+    programId = buildShaderProgram(VERT_SHADER_FILE, FRAG_SHADER_FILE);
 }
 
 // OpenGLの描画関数
@@ -240,6 +220,17 @@ void paintGL() {
     // 背景色と深度値のクリア
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    // 直前の2ステップの間を補間した高さを転送する
+    if (useSimulationThread) {
+        // 最新の結果を受け取る (まだ届いていなければ前回のまま)
+        heightMailbox.consume();
+        const HeightSnapshot &snapshot = heightMailbox.readBuffer();
+        const double alpha = (glfwGetTime() - snapshot.time) / timestep.stepSeconds();
+        uploadHeights(snapshot.prevHeights, snapshot.currHeights, (float)std::max(0.0, std::min(alpha, 1.0)));
+    } else {
+        uploadHeights(prevHeights, currHeights, (float)timestep.alpha());
+    }
+
     // 座標の変換
     glm::mat4 projMat = glm::perspective(45.0f,
         (float)WIN_WIDTH / (float)WIN_HEIGHT, 0.1f, 1000.0f);
@@ -273,6 +264,9 @@ void paintGL() {
     // VAOの無効化
     glBindVertexArray(0);
 
+    // このフレームの高さのセグメントをGPUが読み終えたかを, 次に書き込む前に確認できるようにする
+    heightStream.endFrame();
+
     // シェーダの無効化
     glUseProgram(0);
 
@@ -297,23 +291,45 @@ void resizeGL(GLFWwindow *window, int width, int height) {
     glViewport(0, 0, renderBufferWidth, renderBufferHeight);
 }
 
-// アニメーションのためのアップデート
+// アニメーションのためのアップデート (1ステップ分)
 void update() {
     // 波動データの更新
-    waveEqn.step();
+    prevHeights.swap(currHeights);
+    waveEqn.step(&jobs);
+    readHeights(&currHeights);
+}
 
-    for (int y = 0; y < yCells; y++) {
-        for (int x = 0; x < xCells; x++) {
-            positions[y * xCells + x].z = waveEqn.get(x, y);
+// シミュレーション用のスレッドの処理
+// 描画とは関係なく一定の間隔でステップを進め, 進めるたびに結果を受け渡し口に置く
+void simulationLoop() {
+    FixedTimestep simTimestep(timestep.stepSeconds());
+    simTimestep.reset(glfwGetTime());
+    while (!quitSimulation.load()) {
+        const int steps = simTimestep.advance(glfwGetTime());
+        for (int i = 0; i < steps; i++) {
+            update();
         }
-    }
 
-    glBindVertexArray(vaoId);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec3) * positions.size(), &positions[0]);
-    glBindVertexArray(0);
+        if (steps > 0) {
+            HeightSnapshot &snapshot = heightMailbox.writeBuffer();
+            snapshot.prevHeights = prevHeights;
+            snapshot.currHeights = currHeights;
+            snapshot.time = glfwGetTime();
+            heightMailbox.publish();
+        } else {
+            // 次のステップの時刻まで休む
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
 }
 
 int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--sim-thread") {
+            useSimulationThread = true;
+        }
+    }
+
     // OpenGLを初期化する
     if (glfwInit() == GL_FALSE) {
         fprintf(stderr, "Initialization failed!\n");
@@ -354,16 +370,38 @@ int main(int argc, char **argv) {
     // OpenGLを初期化
     initializeGL();
 
+    // シミュレーション用のスレッドを始める (以後, 波動データはそのスレッドだけが触る)
+    std::thread simulationThread;
+    if (useSimulationThread) {
+        HeightSnapshot initial;
+        initial.prevHeights = prevHeights;
+        initial.currHeights = currHeights;
+        initial.time = glfwGetTime();
+        heightMailbox.reset(initial);
+        simulationThread = std::thread(simulationLoop);
+    }
+
     // メインループ
+    timestep.reset(glfwGetTime());
     while (glfwWindowShouldClose(window) == GL_FALSE) {
+        // アニメーション (経過時間に応じて0回以上進める)
+        if (!useSimulationThread) {
+            const int steps = timestep.advance(glfwGetTime());
+            for (int i = 0; i < steps; i++) {
+                update();
+            }
+        }
+
         // 描画
         paintGL();
 
-        // アニメーション
-        update();
-
         // 描画用バッファの切り替え
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
+
+    if (useSimulationThread) {
+        quitSimulation.store(true);
+        simulationThread.join();
+    }
 }
@@ -1,12 +1,13 @@
 #version 330
 
-layout(location = 0) in vec3 inPosition;
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in float inHeight;
 
 out float fragHeight;
 
 uniform mat4 u_mvpMat;
 
 void main() {
-    gl_Position = u_mvpMat * vec4(inPosition, 1.0);
-    fragHeight = inPosition.z;
+    gl_Position = u_mvpMat * vec4(inPosition, inHeight, 1.0);
+    fragHeight = inHeight;
 }
@@ -4,6 +4,8 @@
 #include <cstdio>
 #include <cstring>
 
+#include <glutils/job_system.h>
+
 class WaveEquation {
 public:
     WaveEquation()
@@ -103,28 +105,14 @@ public:
         std::memcpy(uprev_, ucurr_, sizeof(double) * xCells_ * yCells_);
     }
 
-    void step() {
-        static const int NN = 4;
-        static const int dx[] = { -1, 1, 0, 0 };
-        static const int dy[] = { 0, 0, -1, 1 };
-
-        for (int y = 1; y < yCells_ - 1; y++) {
-            for (int x = 1; x < xCells_ - 1; x++) {
-                double sum = 0.0;
-                for (int i = 0; i < NN; i++) {
-                    const int nx = x + dx[i];
-                    const int ny = y + dy[i];
-                    if (x < 0 || y < 0 || x >= xCells_ || y >= yCells_) {
-                        continue;
-                    }
-
-                    sum += ucurr_[ny * xCells_ + nx] - ucurr_[y * xCells_ + x];
-                }
-
-                unext_[y * xCells_ + x] = ucurr_[y * xCells_ + x]
-                                          + (1.0 - loss_) * (ucurr_[y * xCells_ + x] - uprev_[y * xCells_ + x]
-                                                             + (speed_ * speed_ * dt_ * dt_ * sum / (dx_ * dx_)));
-            }
+    // jobsを渡すと内側の行をいくつかずつに分けて並列に計算する (各行は前のステップの値しか読まない)
+    void step(JobSystem *jobs = NULL) {
+        if (jobs != NULL) {
+            jobs->parallelFor(yCells_ - 2, 16, [this](int begin, int end) {
+                stepRows(begin + 1, end + 1);
+            });
+        } else {
+            stepRows(1, yCells_ - 1);
         }
 
         // Neumann border condition.
@@ -155,6 +143,32 @@ public:
     }
 
 private:
+    // 内側のセルのうち [yBegin, yEnd) 行の次の値を計算する
+    void stepRows(int yBegin, int yEnd) {
+        static const int NN = 4;
+        static const int dx[] = { -1, 1, 0, 0 };
+        static const int dy[] = { 0, 0, -1, 1 };
+
+        for (int y = yBegin; y < yEnd; y++) {
+            for (int x = 1; x < xCells_ - 1; x++) {
+                double sum = 0.0;
+                for (int i = 0; i < NN; i++) {
+                    const int nx = x + dx[i];
+                    const int ny = y + dy[i];
+                    if (x < 0 || y < 0 || x >= xCells_ || y >= yCells_) {
+                        continue;
+                    }
+
+                    sum += ucurr_[ny * xCells_ + nx] - ucurr_[y * xCells_ + x];
+                }
+
+                unext_[y * xCells_ + x] = ucurr_[y * xCells_ + x]
+                                          + (1.0 - loss_) * (ucurr_[y * xCells_ + x] - uprev_[y * xCells_ + x]
+                                                             + (speed_ * speed_ * dt_ * dt_ * sum / (dx_ * dx_)));
+            }
+        }
+    }
+
     void allocateMemory() {
         delete[] ucurr_;
         delete[] unext_;
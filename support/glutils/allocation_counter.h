@@ -0,0 +1,108 @@
+#ifndef _GLUTILS_ALLOCATION_COUNTER_H_
+#define _GLUTILS_ALLOCATION_COUNTER_H_
+
+#include <atomic>
+#include <cstddef>
+
+// operator new の呼ばれた回数 (ヒープからの確保の回数) を数える
+//
+// 数えるには, どれか1つの .cpp で GLUTILS_ALLOCATION_COUNTER_IMPLEMENTATION を定義してから
+// このヘッダをインクルードする (プログラム全体の operator new / delete を置き換える).
+// 定義しなければ installed() は false のままで, 回数も数えない.
+// malloc を直接呼ぶもの (OpenGLのドライバやGLFWなど) の確保は数えない.
+//
+// 使い方:
+//   const size_t before = AllocationCounter::count();
+//   ... 1フレーム分の処理 ...
+//   const size_t allocations = AllocationCounter::count() - before;
+class AllocationCounter {
+public:
+    // これまでの確保の回数 (すべてのスレッドの合計)
+    static size_t count() {
+        return counter().load(std::memory_order_relaxed);
+    }
+
+    // operator new を置き換えて数えているかどうか
+    static bool installed() {
+        return installedFlag().load(std::memory_order_relaxed);
+    }
+
+    // 以下は置き換えた operator new から呼ぶ
+    static void increment() {
+        counter().fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void install() {
+        installedFlag().store(true, std::memory_order_relaxed);
+    }
+
+private:
+    // 静的な初期化の順序によらず使えるように, 関数内の静的変数にする
+    static std::atomic<size_t> &counter() {
+        static std::atomic<size_t> value(0);
+        return value;
+    }
+
+    static std::atomic<bool> &installedFlag() {
+        static std::atomic<bool> value(false);
+        return value;
+    }
+};
+
+#ifdef GLUTILS_ALLOCATION_COUNTER_IMPLEMENTATION
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+struct AllocationCounterInstaller {
+    AllocationCounterInstaller() {
+        AllocationCounter::install();
+    }
+} allocationCounterInstaller;
+
+}  // namespace
+
+void *operator new(std::size_t size) {
+    AllocationCounter::increment();
+    void *ptr = std::malloc(size != 0 ? size : 1);
+    if (ptr == NULL) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    AllocationCounter::increment();
+    return std::malloc(size != 0 ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    AllocationCounter::increment();
+    return std::malloc(size != 0 ? size : 1);
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+    std::free(ptr);
+}
+
+#endif  // GLUTILS_ALLOCATION_COUNTER_IMPLEMENTATION
+
+#endif  // _GLUTILS_ALLOCATION_COUNTER_H_
@@ -0,0 +1,237 @@
+#ifndef _GLUTILS_ENTITY_POOL_H_
+#define _GLUTILS_ENTITY_POOL_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+// 実体 (弾や風船など) を指すハンドル
+// 実体が消えると世代が進むので, 古いハンドルは EntityPool::isValid() で無効と分かる
+struct EntityHandle {
+    EntityHandle()
+        : slot(0xffffffffu)
+        , generation(0u) {
+    }
+
+    uint32_t slot;
+    uint32_t generation;
+};
+
+// 位置, 速度, 生存フラグを別々の連続した配列 (SoA) で持つ実体の入れ物
+//
+// 生きている実体は配列の先頭から隙間なく並ぶので, 更新は配列を頭から順に舐めるだけで済む.
+// 削除は末尾の実体を空いた場所に移して縮める (swap-and-pop) ので O(1) だが, 並び順は変わる.
+// 描画の補間のために, 直前のステップの位置 (savePrevious() で保存したもの) も持つ.
+// 外から実体を指し続けるにはハンドルを使う. ハンドルはスロットを介して配列上の位置を引くので,
+// 実体が移動しても無効にならない. 空いたスロットはフリーリストで使い回す.
+class EntityPool {
+public:
+    EntityPool() {
+    }
+
+    void clear() {
+        // 配っていたハンドルはすべて無効にする
+        for (size_t i = 0; i < denseToSlot_.size(); i++) {
+            releaseSlot(denseToSlot_[i]);
+        }
+        positions_.clear();
+        previousPositions_.clear();
+        velocities_.clear();
+        alive_.clear();
+        denseToSlot_.clear();
+    }
+
+    void reserve(size_t n) {
+        positions_.reserve(n);
+        previousPositions_.reserve(n);
+        velocities_.reserve(n);
+        alive_.reserve(n);
+        denseToSlot_.reserve(n);
+        slots_.reserve(n);
+        freeSlots_.reserve(n);
+    }
+
+    EntityHandle create(const glm::vec3 &position, const glm::vec3 &velocity = glm::vec3(0.0f)) {
+        uint32_t slot;
+        if (!freeSlots_.empty()) {
+            slot = freeSlots_.back();
+            freeSlots_.pop_back();
+        } else {
+            slot = (uint32_t)slots_.size();
+            slots_.push_back(Slot());
+        }
+
+        slots_[slot].dense = (uint32_t)positions_.size();
+        positions_.push_back(position);
+        previousPositions_.push_back(position);
+        velocities_.push_back(velocity);
+        alive_.push_back(1);
+        denseToSlot_.push_back(slot);
+
+        EntityHandle handle;
+        handle.slot = slot;
+        handle.generation = slots_[slot].generation;
+        return handle;
+    }
+
+    bool isValid(const EntityHandle &handle) const {
+        return handle.slot < slots_.size() && slots_[handle.slot].generation == handle.generation &&
+               slots_[handle.slot].dense != INVALID_INDEX;
+    }
+
+    // ハンドルが指す実体の配列上の位置
+    int indexOf(const EntityHandle &handle) const {
+        if (!isValid(handle)) {
+            fprintf(stderr, "Invalid entity handle: slot=%u, generation=%u\n", handle.slot, handle.generation);
+            exit(1);
+        }
+        return (int)slots_[handle.slot].dense;
+    }
+
+    // ただちに取り除く (末尾の実体がindexに移る)
+    void destroy(int index) {
+        const uint32_t last = (uint32_t)positions_.size() - 1;
+        const uint32_t slot = denseToSlot_[index];
+        if ((uint32_t)index != last) {
+            positions_[index] = positions_[last];
+            previousPositions_[index] = previousPositions_[last];
+            velocities_[index] = velocities_[last];
+            alive_[index] = alive_[last];
+            denseToSlot_[index] = denseToSlot_[last];
+            slots_[denseToSlot_[index]].dense = (uint32_t)index;
+        }
+
+        positions_.pop_back();
+        previousPositions_.pop_back();
+        velocities_.pop_back();
+        alive_.pop_back();
+        denseToSlot_.pop_back();
+        releaseSlot(slot);
+    }
+
+    void destroy(const EntityHandle &handle) {
+        destroy(indexOf(handle));
+    }
+
+    // 削除の印を付けるだけで, 並びは変えない (走査中でも安全). removeDead() でまとめて取り除く
+    void kill(int index) {
+        alive_[index] = 0;
+    }
+
+    // 印の付いた実体を末尾から順に取り除き, 取り除いた数を返す
+    int removeDead() {
+        int removed = 0;
+        for (int i = size() - 1; i >= 0; i--) {
+            if (!alive_[i]) {
+                destroy(i);
+                removed++;
+            }
+        }
+        return removed;
+    }
+
+    // すべての実体を速度に沿って動かす
+    // (glm::vec3 は float 3つが詰めて並ぶので, 1本の float の配列として扱うとコンパイラがベクトル化しやすい)
+    void integrate(float dt) {
+        if (positions_.empty()) {
+            return;
+        }
+
+        float *p = &positions_[0].x;
+        const float *v = &velocities_[0].x;
+        const size_t n = positions_.size() * 3;
+        for (size_t i = 0; i < n; i++) {
+            p[i] += v[i] * dt;
+        }
+    }
+
+    // 現在の位置を直前のステップの位置として保存する (ステップを進める前に呼ぶ)
+    void savePrevious() {
+        previousPositions_ = positions_;
+    }
+
+    // 直前のステップの位置から現在の位置へ alpha (0〜1) の割合だけ進めた位置を書き出す
+    void interpolatePositions(float alpha, std::vector<glm::vec3> *interpolated) const {
+        interpolated->resize(positions_.size());
+        for (size_t i = 0; i < positions_.size(); i++) {
+            (*interpolated)[i] = previousPositions_[i] + (positions_[i] - previousPositions_[i]) * alpha;
+        }
+    }
+
+    int size() const {
+        return (int)positions_.size();
+    }
+
+    bool empty() const {
+        return positions_.empty();
+    }
+
+    bool isAlive(int index) const {
+        return alive_[index] != 0;
+    }
+
+    glm::vec3 &position(int index) {
+        return positions_[index];
+    }
+
+    const glm::vec3 &position(int index) const {
+        return positions_[index];
+    }
+
+    // 直前のステップの位置 (savePrevious() を呼んだ時点の位置. その後に作られた実体は作ったときの位置)
+    const glm::vec3 &previousPosition(int index) const {
+        return previousPositions_[index];
+    }
+
+    glm::vec3 &velocity(int index) {
+        return velocities_[index];
+    }
+
+    const std::vector<glm::vec3> &positions() const {
+        return positions_;
+    }
+
+    // 直前のステップの位置 (savePrevious() したときのもの. 並びは positions() と同じ)
+    const std::vector<glm::vec3> &previousPositions() const {
+        return previousPositions_;
+    }
+
+    const std::vector<glm::vec3> &velocities() const {
+        return velocities_;
+    }
+
+private:
+    static const uint32_t INVALID_INDEX = 0xffffffffu;
+
+    struct Slot {
+        Slot()
+            : dense(INVALID_INDEX)
+            , generation(0u) {
+        }
+
+        uint32_t dense;        // 配列上の位置 (使われていなければINVALID_INDEX)
+        uint32_t generation;
+    };
+
+    void releaseSlot(uint32_t slot) {
+        slots_[slot].dense = INVALID_INDEX;
+        slots_[slot].generation++;
+        freeSlots_.push_back(slot);
+    }
+
+    // 実体ごとの配列 (添字は共通)
+    std::vector<glm::vec3> positions_;
+    std::vector<glm::vec3> previousPositions_;
+    std::vector<glm::vec3> velocities_;
+    std::vector<char> alive_;
+    std::vector<uint32_t> denseToSlot_;
+
+    std::vector<Slot> slots_;
+    std::vector<uint32_t> freeSlots_;
+};
+
+#endif  // _GLUTILS_ENTITY_POOL_H_
@@ -0,0 +1,92 @@
+#ifndef _GLUTILS_FIXED_TIMESTEP_H_
+#define _GLUTILS_FIXED_TIMESTEP_H_
+
+#include <cmath>
+#include <algorithm>
+
+// シミュレーションを描画とは独立に一定の時間間隔で進めるための時計
+//
+// 描画1回ごとに経過時間を貯めておき, 貯まった分だけ決まった幅のステップを進める.
+// 描画が遅くなるとステップが詰まって溜まり続けるので, 1回の描画で進めるステップ数には上限を設け,
+// それを超えた分は捨てる (シミュレーションが遅れるだけで, 処理が追いつかなくなることはない).
+// 描画では alpha() を使って直前のステップの状態と現在の状態の間を補間する.
+//
+// メインループの使い方:
+//   timestep.reset(glfwGetTime());
+//   while (...) {
+//       const int steps = timestep.advance(glfwGetTime());
+//       for (int i = 0; i < steps; i++) { 前の状態を保存して1ステップ進める }
+//       描画 (前の状態と現在の状態を lerp() や alpha() で補間する)
+//   }
+class FixedTimestep {
+public:
+    // stepSecondsはステップの幅 (秒), maxStepsは1回の描画で進める最大のステップ数
+    explicit FixedTimestep(double stepSeconds = 1.0 / 60.0, int maxSteps = 5)
+        : stepSeconds_(stepSeconds)
+        , maxSteps_(maxSteps)
+        , prevTime_(0.0)
+        , accumulator_(0.0)
+        , started_(false)
+        , droppedSteps_(0) {
+    }
+
+    // 時刻nowから数え直す
+    void reset(double now) {
+        prevTime_ = now;
+        accumulator_ = 0.0;
+        started_ = true;
+        droppedSteps_ = 0;
+    }
+
+    // 時刻nowまでに進めるべきステップ数を返す
+    int advance(double now) {
+        if (!started_) {
+            reset(now);
+            return 0;
+        }
+
+        // 時刻が戻った場合 (タイマの巻き戻しなど) は経過時間を0とみなす
+        accumulator_ += std::max(0.0, now - prevTime_);
+        prevTime_ = now;
+
+        int steps = (int)std::floor(accumulator_ / stepSeconds_);
+        if (steps > maxSteps_) {
+            droppedSteps_ += steps - maxSteps_;
+            steps = maxSteps_;
+            accumulator_ = 0.0;
+        } else {
+            accumulator_ -= steps * stepSeconds_;
+        }
+        return steps;
+    }
+
+    // 最後のステップから次のステップまでのどこにいるか ([0, 1))
+    double alpha() const {
+        return std::min(accumulator_ / stepSeconds_, 1.0);
+    }
+
+    // 直前のステップの値 prev と現在の値 curr の間を alpha() の割合だけ補間する
+    template <typename T>
+    T lerp(const T &prev, const T &curr) const {
+        return prev + (curr - prev) * (float)alpha();
+    }
+
+    double stepSeconds() const {
+        return stepSeconds_;
+    }
+
+    // 上限を超えたために捨てたステップの数
+    int droppedSteps() const {
+        return droppedSteps_;
+    }
+
+private:
+    double stepSeconds_;
+    int maxSteps_;
+    double prevTime_;
+    double accumulator_;
+    bool started_;
+    int droppedSteps_;
+};
+
+#endif  // _GLUTILS_FIXED_TIMESTEP_H_
@@ -0,0 +1,161 @@
+#ifndef _GLUTILS_FRAME_ARENA_H_
+#define _GLUTILS_FRAME_ARENA_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <algorithm>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+// 1フレームの間だけ使う一時的なデータを置く領域 (線形アロケータ)
+//
+// 最初に2フレーム分のセグメントを確保しておき, allocate() は現在のセグメントの先頭から順に切り出すだけで,
+// 個別に解放はしない. endFrame() で次のセグメントに切り替え, その中身をまとめて捨てる.
+// セグメントが2つあるので, あるフレームで確保したデータは次のフレームの終わりまで残る
+// (描画側が1つ前のフレームの結果を読んでいる間に, 次のフレームの結果を書き込める).
+//
+// 1つのスレッドから使うこと. create<T>() で作ったオブジェクトのデストラクタは呼ばれない.
+//
+// 使い方:
+//   FrameVector<int> list((FrameAllocator<int>(arena)));   // 要素はこのフレームのセグメントに置かれる
+//   Foo *foo = arena.create<Foo>(...);
+//   ...
+//   arena.endFrame();
+class FrameArena {
+public:
+    static const int NUM_SEGMENTS = 2;
+
+    FrameArena()
+        : segmentSize_(0)
+        , segment_(0)
+        , used_(0)
+        , peak_(0)
+        , lastUsed_(0) {
+    }
+
+    // 1フレームで使う最大のバイト数を指定して確保する (確保済みのデータはすべて捨てる)
+    void create(size_t segmentSize) {
+        segmentSize_ = segmentSize;
+        storage_.assign(segmentSize * NUM_SEGMENTS, 0);
+        segment_ = 0;
+        used_ = 0;
+        peak_ = 0;
+        lastUsed_ = 0;
+    }
+
+    // 現在のセグメントから size バイトを確保する (先頭は alignment の倍数にそろえる)
+    void *allocate(size_t size, size_t alignment) {
+        if (storage_.empty()) {
+            fprintf(stderr, "FrameArena::create() is not called yet!\n");
+            exit(1);
+        }
+
+        unsigned char *base = &storage_[0] + segmentSize_ * segment_;
+        const uintptr_t address = (uintptr_t)(base + used_);
+        const size_t start = used_ + (size_t)((alignment - address % alignment) % alignment);
+        if (start + size > segmentSize_) {
+            fprintf(stderr, "Frame arena overflow: %ld bytes requested, %ld bytes left\n",
+                    (long)size, (long)(segmentSize_ - used_));
+            exit(1);
+        }
+
+        used_ = start + size;
+        return base + start;
+    }
+
+    // 現在のセグメントにTのオブジェクトを作る
+    template <typename T, typename... Args>
+    T *create(Args&&... args) {
+        return new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // フレームの終わりに呼ぶ. 2つ前のフレームのデータを捨てて, そのセグメントを次のフレームに使う
+    void endFrame() {
+        lastUsed_ = used_;
+        peak_ = std::max(peak_, used_);
+        segment_ = (segment_ + 1) % NUM_SEGMENTS;
+        used_ = 0;
+    }
+
+    // 現在のフレームで使ったバイト数
+    size_t used() const {
+        return used_;
+    }
+
+    // 直前のフレームで使ったバイト数
+    size_t lastUsed() const {
+        return lastUsed_;
+    }
+
+    // これまでの1フレームあたりの最大のバイト数
+    size_t peak() const {
+        return peak_;
+    }
+
+    size_t segmentSize() const {
+        return segmentSize_;
+    }
+
+private:
+    FrameArena(const FrameArena &);
+    FrameArena &operator=(const FrameArena &);
+
+    size_t segmentSize_;
+    int segment_;
+    size_t used_;
+    size_t peak_;
+    size_t lastUsed_;
+    std::vector<unsigned char> storage_;
+};
+
+// FrameArena から確保するSTLのアロケータ
+// deallocate() は何もしないので, 大きさが変わるコンテナは先に reserve() しておくとよい
+// (伸ばすたびに古い領域はそのフレームの終わりまで残る)
+template <typename T>
+class FrameAllocator {
+public:
+    typedef T value_type;
+
+    explicit FrameAllocator(FrameArena &arena)
+        : arena_(&arena) {
+    }
+
+    template <typename U>
+    FrameAllocator(const FrameAllocator<U> &other)
+        : arena_(other.arena()) {
+    }
+
+    T *allocate(size_t n) {
+        return (T*)arena_->allocate(sizeof(T) * n, alignof(T));
+    }
+
+    void deallocate(T *, size_t) {
+    }
+
+    FrameArena *arena() const {
+        return arena_;
+    }
+
+private:
+    FrameArena *arena_;
+};
+
+template <typename T, typename U>
+bool operator==(const FrameAllocator<T> &a, const FrameAllocator<U> &b) {
+    return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const FrameAllocator<T> &a, const FrameAllocator<U> &b) {
+    return a.arena() != b.arena();
+}
+
+// 要素を FrameArena に置く配列
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T> >;
+
+#endif  // _GLUTILS_FRAME_ARENA_H_
@@ -0,0 +1,262 @@
+#ifndef _GLUTILS_FRUSTUM_CULLING_H_
+#define _GLUTILS_FRUSTUM_CULLING_H_
+
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_CULLING_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+// 軸にそろった直方体 (AABB)
+struct BoundingBox {
+    BoundingBox()
+        : min(FLT_MAX)
+        , max(-FLT_MAX) {
+    }
+
+    void expand(const glm::vec3 &p) {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+
+    bool empty() const {
+        return min.x > max.x;
+    }
+
+    glm::vec3 center() const {
+        return (min + max) * 0.5f;
+    }
+
+    glm::vec3 extent() const {
+        return (max - min) * 0.5f;
+    }
+
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+// 境界球
+struct BoundingSphere {
+    BoundingSphere()
+        : center(0.0f)
+        , radius(0.0f) {
+    }
+
+    BoundingSphere(const glm::vec3 &center_, float radius_)
+        : center(center_)
+        , radius(radius_) {
+    }
+
+    // 変換後の境界球 (拡大率は最も大きい軸のものを使う)
+    BoundingSphere transformed(const glm::mat4 &m) const {
+        const float sx = glm::length(glm::vec3(m[0]));
+        const float sy = glm::length(glm::vec3(m[1]));
+        const float sz = glm::length(glm::vec3(m[2]));
+        const glm::vec4 c = m * glm::vec4(center, 1.0f);
+        return BoundingSphere(glm::vec3(c), radius * std::max(sx, std::max(sy, sz)));
+    }
+
+    glm::vec3 center;
+    float radius;
+};
+
+// 頂点の並びからAABBと境界球を求める (球の中心はAABBの中心とし, 半径は最も遠い頂点まで)
+inline void computeBounds(const std::vector<glm::vec3> &positions, BoundingBox *box, BoundingSphere *sphere) {
+    BoundingBox b;
+    for (size_t i = 0; i < positions.size(); i++) {
+        b.expand(positions[i]);
+    }
+
+    BoundingSphere s;
+    if (!b.empty()) {
+        s.center = b.center();
+        float radius2 = 0.0f;
+        for (size_t i = 0; i < positions.size(); i++) {
+            const glm::vec3 d = positions[i] - s.center;
+            radius2 = std::max(radius2, glm::dot(d, d));
+        }
+        s.radius = std::sqrt(radius2);
+    }
+
+    *box = b;
+    *sphere = s;
+}
+
+// 視錐台の6つの平面 (法線は内向き, 正規化済み)
+struct Frustum {
+    enum {
+        PLANE_LEFT = 0,
+        PLANE_RIGHT,
+        PLANE_BOTTOM,
+        PLANE_TOP,
+        PLANE_NEAR,
+        PLANE_FAR,
+        NUM_PLANES
+    };
+
+    Frustum() {
+    }
+
+    // projMat * viewMat から平面を取り出す (Gribb-Hartmannの方法)
+    explicit Frustum(const glm::mat4 &viewProjMat) {
+        const glm::mat4 m = glm::transpose(viewProjMat);
+        planes[PLANE_LEFT]   = m[3] + m[0];
+        planes[PLANE_RIGHT]  = m[3] - m[0];
+        planes[PLANE_BOTTOM] = m[3] + m[1];
+        planes[PLANE_TOP]    = m[3] - m[1];
+        planes[PLANE_NEAR]   = m[3] + m[2];
+        planes[PLANE_FAR]    = m[3] - m[2];
+
+        for (int i = 0; i < NUM_PLANES; i++) {
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+        }
+    }
+
+    // 球が視錐台と交わるか (どれか1つの平面の完全に外側なら見えない)
+    bool intersects(const BoundingSphere &sphere) const {
+        for (int i = 0; i < NUM_PLANES; i++) {
+            const float d = glm::dot(glm::vec3(planes[i]), sphere.center) + planes[i].w;
+            if (d < -sphere.radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    glm::vec4 planes[NUM_PLANES];
+};
+
+// 多数の境界球を成分ごとの配列 (SoA) で持ち, まとめて視錐台と判定するクラス
+// SSEが使える場合は4つの球を同時に判定する
+class SphereCullingSet {
+public:
+    void clear() {
+        x_.clear();
+        y_.clear();
+        z_.clear();
+        r_.clear();
+    }
+
+    void reserve(size_t n) {
+        x_.reserve(n + 3);
+        y_.reserve(n + 3);
+        z_.reserve(n + 3);
+        r_.reserve(n + 3);
+    }
+
+    // 球を追加して番号を返す
+    int add(const glm::vec3 &center, float radius) {
+        x_.push_back(center.x);
+        y_.push_back(center.y);
+        z_.push_back(center.z);
+        r_.push_back(radius);
+        return (int)x_.size() - 1;
+    }
+
+    int size() const {
+        return (int)x_.size();
+    }
+
+    // 見える球の番号をvisibleに書き出し, その数を返す
+    int cull(const Frustum &frustum, std::vector<int> *visible) {
+        visible->clear();
+        const int n = size();
+        if (n == 0) {
+            return 0;
+        }
+
+#ifdef FRUSTUM_CULLING_USE_SSE
+        // 4の倍数になるまで, どの平面でも必ず外側になる球で埋める
+        const int padded = (n + 3) & ~3;
+        for (int i = n; i < padded; i++) {
+            add(glm::vec3(0.0f), -FLT_MAX);
+        }
+
+        __m128 px[Frustum::NUM_PLANES], py[Frustum::NUM_PLANES], pz[Frustum::NUM_PLANES], pw[Frustum::NUM_PLANES];
+        for (int p = 0; p < Frustum::NUM_PLANES; p++) {
+            px[p] = _mm_set1_ps(frustum.planes[p].x);
+            py[p] = _mm_set1_ps(frustum.planes[p].y);
+            pz[p] = _mm_set1_ps(frustum.planes[p].z);
+            pw[p] = _mm_set1_ps(frustum.planes[p].w);
+        }
+
+        for (int i = 0; i < padded; i += 4) {
+            const __m128 x = _mm_loadu_ps(&x_[i]);
+            const __m128 y = _mm_loadu_ps(&y_[i]);
+            const __m128 z = _mm_loadu_ps(&z_[i]);
+            const __m128 negR = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&r_[i]));
+
+            // d < -r となる平面が1つでもあれば外側
+            __m128 outside = _mm_setzero_ps();
+            for (int p = 0; p < Frustum::NUM_PLANES; p++) {
+                __m128 d = _mm_add_ps(_mm_mul_ps(x, px[p]), pw[p]);
+                d = _mm_add_ps(d, _mm_mul_ps(y, py[p]));
+                d = _mm_add_ps(d, _mm_mul_ps(z, pz[p]));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(d, negR));
+            }
+
+            int mask = ~_mm_movemask_ps(outside) & 0xf;
+            while (mask != 0) {
+                const int lane = lowestBit(mask);
+                visible->push_back(i + lane);
+                mask &= mask - 1;
+            }
+        }
+
+        x_.resize(n);
+        y_.resize(n);
+        z_.resize(n);
+        r_.resize(n);
+        return (int)visible->size();
+#else
+        return cullScalar(frustum, visible);
+#endif
+    }
+
+    // SIMDを使わない版 (結果の確認と速度の比較用)
+    int cullScalar(const Frustum &frustum, std::vector<int> *visible) const {
+        visible->clear();
+        const int n = size();
+        for (int i = 0; i < n; i++) {
+            bool inside = true;
+            for (int p = 0; p < Frustum::NUM_PLANES && inside; p++) {
+                const glm::vec4 &plane = frustum.planes[p];
+                // SIMD版と同じ順に足して, 境界上の球の判定をそろえる
+                const float d = plane.x * x_[i] + plane.w + plane.y * y_[i] + plane.z * z_[i];
+                inside = d >= -r_[i];
+            }
+
+            if (inside) {
+                visible->push_back(i);
+            }
+        }
+        return (int)visible->size();
+    }
+
+    static bool isSimd() {
+#ifdef FRUSTUM_CULLING_USE_SSE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+private:
+    static int lowestBit(int mask) {
+        int bit = 0;
+        while ((mask & (1 << bit)) == 0) {
+            bit++;
+        }
+        return bit;
+    }
+
+    std::vector<float> x_, y_, z_, r_;
+};
+
+#endif  // _GLUTILS_FRUSTUM_CULLING_H_
@@ -0,0 +1,407 @@
+#ifndef _GLUTILS_JOB_SYSTEM_H_
+#define _GLUTILS_JOB_SYSTEM_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+class JobCounter;
+
+// ジョブシステムに積まれる1つの仕事
+struct Job {
+    Job(const std::function<void()> &func, JobCounter *counter)
+        : func(func)
+        , counter(counter) {
+    }
+
+    std::function<void()> func;
+    JobCounter *counter;        // 終わったときに1減らすカウンタ (NULLならなし)
+};
+
+// まだ終わっていないジョブの数
+// JobSystem::run() に渡すと1増え, そのジョブが終わると1減る. 0になるのを JobSystem::wait() で待つ.
+// 別のジョブの依存先として渡すと, そのジョブは0になってから始まる.
+// (依存先として使う前に, 数えるジョブはすべて run() しておくこと. 壊すのは wait() が戻ってから)
+class JobCounter {
+public:
+    JobCounter()
+        : count_(0) {
+    }
+
+    bool done() const {
+        return count_.load(std::memory_order_acquire) == 0;
+    }
+
+private:
+    friend class JobSystem;
+
+    JobCounter(const JobCounter &);
+    JobCounter &operator=(const JobCounter &);
+
+    std::atomic<int> count_;
+    std::mutex mutex_;
+    std::vector<Job*> waiting_;   // このカウンタが0になるのを待っているジョブ
+};
+
+// Chase-Levのワークスティーリング両端キュー (容量は固定)
+// 持ち主のスレッドだけが末尾に push() / pop() し, ほかのスレッドは先頭から steal() する.
+// 持ち主は新しいものから, ほかのスレッドは古いものから取るので, 両者がぶつかるのは残りが1つのときだけ.
+class WorkStealingDeque {
+public:
+    // 容量は2のべき乗にすること
+    explicit WorkStealingDeque(int capacity = 4096)
+        : top_(0)
+        , bottom_(0)
+        , mask_(capacity - 1)
+        , buffer_(capacity) {
+    }
+
+    // 満杯なら false を返す (持ち主のスレッドだけが呼ぶ)
+    bool push(Job *job) {
+        const int64_t b = bottom_.load(std::memory_order_relaxed);
+        const int64_t t = top_.load(std::memory_order_acquire);
+        if (b - t > mask_) {
+            return false;
+        }
+
+        buffer_[b & mask_].store(job, std::memory_order_relaxed);
+        bottom_.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 最後に積んだものを取り出す. 空なら NULL (持ち主のスレッドだけが呼ぶ)
+    Job *pop() {
+        const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        Job *job = NULL;
+        if (t <= b) {
+            job = buffer_[b & mask_].load(std::memory_order_relaxed);
+            if (t == b) {
+                // 最後の1つはほかのスレッドと取り合いになるので, 先頭を進められた方が取る
+                if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    job = NULL;
+                }
+                bottom_.store(b + 1, std::memory_order_relaxed);
+            }
+        } else {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    // 最も古いものを盗む. 空か, ほかのスレッドに先を越されたら NULL (どのスレッドからでも呼べる)
+    Job *steal() {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return NULL;
+        }
+
+        Job *job = buffer_[t & mask_].load(std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return NULL;
+        }
+        return job;
+    }
+
+private:
+    std::atomic<int64_t> top_;
+    std::atomic<int64_t> bottom_;
+    const int64_t mask_;
+    std::vector<std::atomic<Job*> > buffer_;
+};
+
+// 固定数のワーカスレッドでジョブを実行する仕組み
+//
+// 各ワーカスレッドと, ジョブシステムを作ったスレッド (メインスレッド) はそれぞれ自分のキューを持ち,
+// 自分で積んだジョブを新しい順に実行する. 自分のキューが空になると, ほかのキューから古いジョブを盗む.
+// それ以外のスレッドが積んだジョブは共有のキューに入る. 仕事がないワーカスレッドは眠って待つ.
+//
+// wait() は待っている間もジョブを実行するので, ジョブの中からジョブを積んで待ってもよい.
+// 終わったジョブは捨てずに次の run() で使い回すので, 毎フレーム同じように積むならヒープからの確保は起きない.
+// デモの各所 (カリング, あたり判定, 粒子, シミュレーション, 画像の読み込みなど) は
+// それぞれスレッドを作らずに, 1つのジョブシステムを共有して使う.
+//
+// 使い方:
+//   JobCounter counter;
+//   jobs.run([]() { ... }, &counter);
+//   jobs.run([]() { ... }, NULL, &counter);   // counterが0になってから始まる
+//   jobs.wait(counter);
+//   jobs.parallelFor(n, 256, [](int begin, int end) { ... });
+class JobSystem {
+public:
+    // numWorkersは呼び出し元のスレッド以外のワーカスレッドの数 (負ならCPUのコア数から決める)
+    explicit JobSystem(int numWorkers = -1)
+        : pending_(0)
+        , sleepers_(0)
+        , quit_(false) {
+        if (numWorkers < 0) {
+            numWorkers = std::max(0, (int)std::thread::hardware_concurrency() - 1);
+        }
+
+        // 0番はこのスレッドのキュー
+        for (int i = 0; i < numWorkers + 1; i++) {
+            queues_.push_back(new WorkStealingDeque());
+        }
+        context().system = this;
+        context().index = 0;
+
+        for (int i = 1; i <= numWorkers; i++) {
+            workers_.push_back(std::thread(&JobSystem::workerLoop, this, i));
+        }
+    }
+
+    // 積んだジョブはすべて待ってから壊すこと
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            quit_ = true;
+        }
+        wakeCond_.notify_all();
+        for (size_t i = 0; i < workers_.size(); i++) {
+            workers_[i].join();
+        }
+
+        for (size_t i = 0; i < queues_.size(); i++) {
+            delete queues_[i];
+        }
+        for (size_t i = 0; i < freeJobs_.size(); i++) {
+            delete freeJobs_[i];
+        }
+        if (context().system == this) {
+            context().system = NULL;
+        }
+    }
+
+    // ジョブを積む. counterは終わったときに1減らすカウンタ, dependencyは始める前に0になるのを待つカウンタ
+    void run(const std::function<void()> &func, JobCounter *counter = NULL, JobCounter *dependency = NULL) {
+        Job *job = allocateJob(func, counter);
+        if (counter != NULL) {
+            counter->count_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (dependency != NULL) {
+            // 依存先が終わっていなければ預けておき, 終わったときに積んでもらう
+            std::lock_guard<std::mutex> lock(dependency->mutex_);
+            if (dependency->count_.load(std::memory_order_acquire) > 0) {
+                dependency->waiting_.push_back(job);
+                return;
+            }
+        }
+        submit(job);
+    }
+
+    // counterが0になるまで, ほかのジョブを実行しながら待つ
+    void wait(JobCounter &counter) {
+        while (counter.count_.load(std::memory_order_acquire) > 0) {
+            Job *job = findJob();
+            if (job != NULL) {
+                execute(job);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+
+        // 最後のジョブを終えたスレッドがカウンタのロックを外すまで待つ (戻った後はカウンタを壊してよい)
+        std::lock_guard<std::mutex> lock(counter.mutex_);
+    }
+
+    // [0, n) を grain 個ずつに分けて func(begin, end) を並列に呼び, すべて終わるまで待つ
+    template <typename Func>
+    void parallelFor(int n, int grain, const Func &func) {
+        grain = std::max(1, grain);
+        if (workers_.empty() || n <= grain) {
+            if (n > 0) {
+                func(0, n);
+            }
+            return;
+        }
+
+        // 最初の範囲は自分で処理する
+        JobCounter counter;
+        for (int begin = grain; begin < n; begin += grain) {
+            const int end = std::min(n, begin + grain);
+            run([&func, begin, end]() { func(begin, end); }, &counter);
+        }
+        func(0, grain);
+        wait(counter);
+    }
+
+    // 呼び出し元を含めたスレッドの数
+    int numThreads() const {
+        return (int)workers_.size() + 1;
+    }
+
+private:
+    struct ThreadContext {
+        JobSystem *system;
+        int index;
+    };
+
+    // このスレッドがどのジョブシステムの何番のキューを持っているか
+    static ThreadContext &context() {
+        static thread_local ThreadContext ctx = { NULL, -1 };
+        return ctx;
+    }
+
+    // 使い終わったジョブがあればそれを使い, なければ新しく作る
+    Job *allocateJob(const std::function<void()> &func, JobCounter *counter) {
+        {
+            std::lock_guard<std::mutex> lock(poolMutex_);
+            if (!freeJobs_.empty()) {
+                Job *job = freeJobs_.back();
+                freeJobs_.pop_back();
+                job->func = func;
+                job->counter = counter;
+                return job;
+            }
+        }
+        return new Job(func, counter);
+    }
+
+    void releaseJob(Job *job) {
+        // 関数が持っているものはここで手放す
+        job->func = nullptr;
+        std::lock_guard<std::mutex> lock(poolMutex_);
+        freeJobs_.push_back(job);
+    }
+
+    void submit(Job *job) {
+        // 眠っているワーカスレッドが見落とさないように, 積む前に数を増やす
+        pending_.fetch_add(1);
+
+        const ThreadContext &ctx = context();
+        if (ctx.system != this || !queues_[ctx.index]->push(job)) {
+            std::lock_guard<std::mutex> lock(sharedMutex_);
+            shared_.push_back(job);
+        }
+
+        if (sleepers_.load() > 0) {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            wakeCond_.notify_one();
+        }
+    }
+
+    // 自分のキュー, 共有のキュー, ほかのスレッドのキューの順に探す
+    Job *findJob() {
+        const ThreadContext &ctx = context();
+        const bool owner = ctx.system == this;
+        if (owner) {
+            Job *job = queues_[ctx.index]->pop();
+            if (job != NULL) {
+                return job;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(sharedMutex_);
+            if (!shared_.empty()) {
+                Job *job = shared_.front();
+                shared_.pop_front();
+                return job;
+            }
+        }
+
+        const int n = (int)queues_.size();
+        const int start = owner ? ctx.index + 1 : 0;
+        for (int k = 0; k < n; k++) {
+            const int victim = (start + k) % n;
+            if (owner && victim == ctx.index) {
+                continue;
+            }
+
+            Job *job = queues_[victim]->steal();
+            if (job != NULL) {
+                return job;
+            }
+        }
+        return NULL;
+    }
+
+    void execute(Job *job) {
+        pending_.fetch_sub(1);
+        job->func();
+        finish(job->counter);
+        releaseJob(job);
+    }
+
+    void finish(JobCounter *counter) {
+        if (counter == NULL) {
+            return;
+        }
+
+        // 0になったら, このカウンタを待っていたジョブを積む
+        // 0になった後はカウンタが壊されるかもしれないので, 減らすのと待っていたジョブを受け取るのは
+        // ロックの中で行い, ロックを外した後はカウンタに触らない (wait() はロックが外れるまで戻らない)
+        std::vector<Job*> ready;
+        {
+            std::lock_guard<std::mutex> lock(counter->mutex_);
+            if (counter->count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                ready.swap(counter->waiting_);
+            }
+        }
+        for (size_t i = 0; i < ready.size(); i++) {
+            submit(ready[i]);
+        }
+    }
+
+    void workerLoop(int index) {
+        context().system = this;
+        context().index = index;
+
+        for (;;) {
+            // すぐに次のジョブが積まれることが多いので, 少しの間は眠らずに探す
+            Job *job = NULL;
+            for (int spin = 0; spin < 64 && job == NULL; spin++) {
+                job = findJob();
+                if (job == NULL) {
+                    std::this_thread::yield();
+                }
+            }
+
+            if (job != NULL) {
+                execute(job);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            if (quit_) {
+                break;
+            }
+            sleepers_.fetch_add(1);
+            wakeCond_.wait(lock, [this]() { return quit_ || pending_.load() > 0; });
+            sleepers_.fetch_sub(1);
+        }
+    }
+
+    std::vector<WorkStealingDeque*> queues_;
+    std::vector<std::thread> workers_;
+
+    // ほかのスレッドから積まれたジョブ
+    std::mutex sharedMutex_;
+    std::deque<Job*> shared_;
+
+    // 使い終わったジョブ
+    std::mutex poolMutex_;
+    std::vector<Job*> freeJobs_;
+
+    // 積まれてまだ取り出されていないジョブの数と, 眠っているワーカスレッドの数
+    std::atomic<int> pending_;
+    std::atomic<int> sleepers_;
+    std::mutex sleepMutex_;
+    std::condition_variable wakeCond_;
+    bool quit_;
+};
+
+#endif  // _GLUTILS_JOB_SYSTEM_H_
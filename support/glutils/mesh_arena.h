@@ -0,0 +1,274 @@
+#ifndef _GLUTILS_MESH_ARENA_H_
+#define _GLUTILS_MESH_ARENA_H_
+
+// このヘッダは OpenGLの関数を使うので, <glad/gl.h> の後にインクルードすること
+// (gladの実装部はインクルードガードで守られていないため, ここではインクルードしない)
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+
+#include <glutils/shader_builder.h>
+
+// glDrawElementsIndirect / glMultiDrawElementsIndirect の命令 (並びは仕様で決まっている)
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// アリーナ内の1つのメッシュの範囲
+struct MeshRange {
+    GLuint firstIndex;   // 頂点番号バッファ内の先頭
+    GLuint indexCount;
+    GLint baseVertex;    // 頂点番号に足される頂点バッファ内の先頭
+};
+
+// 頂点の形式が同じメッシュを, 1組の大きな頂点バッファと頂点番号バッファに詰めて持つクラス
+// すべてのメッシュが1つのVAOで描けるので, 物体の数によらずVAOの切り替えが1回で済む
+// add() ですべてのメッシュを登録してから upload() で転送し, vertexAttrib() で頂点の形式を設定する
+template <typename V>
+class MeshArena {
+public:
+    MeshArena()
+        : vaoId_(0u)
+        , vboId_(0u)
+        , iboId_(0u) {
+    }
+
+    // メッシュを追加して番号を返す (頂点番号はメッシュ内の番号のままでよい)
+    int add(const std::vector<V> &vertices, const std::vector<unsigned int> &indices) {
+        if (vaoId_ != 0u) {
+            fprintf(stderr, "MeshArena::add() is called after upload()!\n");
+            exit(1);
+        }
+
+        MeshRange range;
+        range.firstIndex = (GLuint)indices_.size();
+        range.indexCount = (GLuint)indices.size();
+        range.baseVertex = (GLint)vertices_.size();
+        ranges_.push_back(range);
+
+        vertices_.insert(vertices_.end(), vertices.begin(), vertices.end());
+        indices_.insert(indices_.end(), indices.begin(), indices.end());
+        return (int)ranges_.size() - 1;
+    }
+
+    // 登録したメッシュをまとめてGPUに転送する (CPU側のコピーは捨てる)
+    void upload() {
+        glGenVertexArrays(1, &vaoId_);
+        glBindVertexArray(vaoId_);
+
+        glGenBuffers(1, &vboId_);
+        glBindBuffer(GL_ARRAY_BUFFER, vboId_);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(V) * vertices_.size(), vertices_.data(), GL_STATIC_DRAW);
+
+        glGenBuffers(1, &iboId_);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId_);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices_.size(),
+                     indices_.data(), GL_STATIC_DRAW);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        std::vector<V>().swap(vertices_);
+        std::vector<unsigned int>().swap(indices_);
+    }
+
+    // 頂点属性 (浮動小数点数) の設定. offsetは offsetof(V, member) を渡す
+    void vertexAttrib(GLuint index, GLint size, GLenum type, size_t offset) {
+        glBindVertexArray(vaoId_);
+        glBindBuffer(GL_ARRAY_BUFFER, vboId_);
+        glEnableVertexAttribArray(index);
+        glVertexAttribPointer(index, size, type, GL_FALSE, sizeof(V), (void*)offset);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void release() {
+        if (vaoId_ != 0u) {
+            glDeleteVertexArrays(1, &vaoId_);
+            glDeleteBuffers(1, &vboId_);
+            glDeleteBuffers(1, &iboId_);
+            vaoId_ = vboId_ = iboId_ = 0u;
+        }
+    }
+
+    const MeshRange &mesh(int index) const {
+        return ranges_[index];
+    }
+
+    int numMeshes() const {
+        return (int)ranges_.size();
+    }
+
+    GLuint vaoId() const {
+        return vaoId_;
+    }
+
+private:
+    GLuint vaoId_;
+    GLuint vboId_;
+    GLuint iboId_;
+    std::vector<MeshRange> ranges_;
+    std::vector<V> vertices_;
+    std::vector<unsigned int> indices_;
+};
+
+// 描画ごとのデータ (変換行列や材質の番号など) を並べたテクスチャバッファ
+// シェーダからは samplerBuffer として, 描画番号 * texelsPerItem() 番目から texelFetch で読む
+// Tの大きさは vec4 (16バイト) の倍数にすること
+template <typename T>
+class DrawDataBuffer {
+public:
+    DrawDataBuffer()
+        : bufferId_(0u)
+        , textureId_(0u)
+        , capacity_(0) {
+    }
+
+    void update(const std::vector<T> &items) {
+        static_assert(sizeof(T) % 16 == 0, "DrawDataBuffer item must be a multiple of vec4");
+
+        if (bufferId_ == 0u) {
+            glGenBuffers(1, &bufferId_);
+            glGenTextures(1, &textureId_);
+            glBindTexture(GL_TEXTURE_BUFFER, textureId_);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, bufferId_);
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+        }
+
+        if (items.empty()) {
+            return;
+        }
+
+        glBindBuffer(GL_TEXTURE_BUFFER, bufferId_);
+        if ((int)items.size() > capacity_) {
+            capacity_ = std::max((int)items.size(), capacity_ * 2);
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(T) * capacity_, NULL, GL_DYNAMIC_DRAW);
+        }
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(T) * items.size(), items.data());
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void bind(int unit) const {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, textureId_);
+    }
+
+    static int texelsPerItem() {
+        return (int)(sizeof(T) / 16);
+    }
+
+private:
+    GLuint bufferId_;
+    GLuint textureId_;
+    int capacity_;
+};
+
+// 1つのパスで描くメッシュの並び
+// 使える場合は glMultiDrawElementsIndirect の1回の呼び出しですべてを描き, シェーダは gl_DrawIDARB で
+// 描画ごとのデータを引く. 使えない場合 (OpenGL 4.3未満のmacOSなど) は1つずつ描き, 描画番号をUniform変数で渡す
+// シェーダには次のように書いておき, 前者ではビルド時に shaderHeader() を差し込む
+//
+// #ifdef USE_MULTI_DRAW
+// #extension GL_ARB_shader_draw_parameters : require
+// #define DRAW_ID gl_DrawIDARB
+// #else
+// uniform int u_drawId;
+// #define DRAW_ID u_drawId
+// #endif
+class MultiDrawList {
+public:
+    // 間接描画と gl_DrawIDARB の両方が使えるかどうか
+    static bool supported() {
+        return GLAD_GL_VERSION_4_3 && hasGLExtension("GL_ARB_shader_draw_parameters");
+    }
+
+    // 間接描画を使う場合にシェーダへ差し込む定義
+    static const char *shaderHeader() {
+        return "#define USE_MULTI_DRAW\n";
+    }
+
+    explicit MultiDrawList(bool multiDraw = false)
+        : multiDraw_(multiDraw)
+        , indirectBufferId_(0u)
+        , capacity_(0)
+        , dirty_(true) {
+    }
+
+    void clear() {
+        commands_.clear();
+        dirty_ = true;
+    }
+
+    // メッシュを追加し, 描画番号 (= 描画ごとのデータの番号) を返す
+    int add(const MeshRange &mesh, GLuint instanceCount = 1) {
+        DrawElementsIndirectCommand command;
+        command.count = mesh.indexCount;
+        command.instanceCount = instanceCount;
+        command.firstIndex = mesh.firstIndex;
+        command.baseVertex = mesh.baseVertex;
+        command.baseInstance = 0u;
+        commands_.push_back(command);
+        dirty_ = true;
+        return (int)commands_.size() - 1;
+    }
+
+    // すべて描画する. VAOとプログラムは有効にしておくこと
+    // drawIdLocationは1つずつ描く場合に描画番号を渡すUniform変数の位置
+    void draw(GLint drawIdLocation) {
+        if (commands_.empty()) {
+            return;
+        }
+
+        if (multiDraw_) {
+            if (indirectBufferId_ == 0u) {
+                glGenBuffers(1, &indirectBufferId_);
+            }
+
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBufferId_);
+            if (dirty_) {
+                if ((int)commands_.size() > capacity_) {
+                    capacity_ = std::max((int)commands_.size(), capacity_ * 2);
+                    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawElementsIndirectCommand) * capacity_,
+                                 NULL, GL_DYNAMIC_DRAW);
+                }
+                glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(DrawElementsIndirectCommand) * commands_.size(),
+                                commands_.data());
+                dirty_ = false;
+            }
+
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, (GLsizei)commands_.size(), 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        } else {
+            for (size_t i = 0; i < commands_.size(); i++) {
+                const DrawElementsIndirectCommand &command = commands_[i];
+                glUniform1i(drawIdLocation, (GLint)i);
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+                                                  (void*)(sizeof(unsigned int) * command.firstIndex),
+                                                  command.instanceCount, command.baseVertex);
+            }
+        }
+    }
+
+    bool isMultiDraw() const {
+        return multiDraw_;
+    }
+
+    int size() const {
+        return (int)commands_.size();
+    }
+
+private:
+    bool multiDraw_;
+    GLuint indirectBufferId_;
+    int capacity_;
+    bool dirty_;
+    std::vector<DrawElementsIndirectCommand> commands_;
+};
+
+#endif  // _GLUTILS_MESH_ARENA_H_
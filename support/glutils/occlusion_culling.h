@@ -0,0 +1,351 @@
+#ifndef _GLUTILS_OCCLUSION_CULLING_H_
+#define _GLUTILS_OCCLUSION_CULLING_H_
+
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <glutils/frustum_culling.h>
+#include <glutils/job_system.h>
+
+// CPUの低解像度の深度バッファによる遮蔽カリング
+//
+// 手前にある大きな物体 (遮蔽物) の三角形をCPUで深度バッファに描き, 深度の最大値をとる
+// 階層 (Hi-Z ピラミッド) を作っておく. 各物体は画面上の外接矩形と最も手前の深度を求め,
+// 矩形が覆う Hi-Z の値よりも奥にあれば隠れているとして描画命令を積まない.
+// GPUから結果を読み戻さないので, 判定が1フレーム遅れることはない.
+//
+// 深度バッファは画面を横長の帯に分け, 帯ごとにジョブシステムのジョブとして描く (帯どうしは書き込み先が重ならない).
+//
+// 1フレームの使い方:
+//   beginFrame(projMat * viewMat) -> addOccluder() (何回でも) -> rasterize() -> isVisible() (何回でも)
+class OcclusionCuller {
+public:
+    // 幅は4の倍数, 幅と高さは2のべき乗にすること
+    // jobsを渡すと帯に分けて並列に描く (NULLなら呼び出し元のスレッドだけで描く)
+    explicit OcclusionCuller(int width = 256, int height = 128, JobSystem *jobs = NULL)
+        : width_(width)
+        , height_(height)
+        , numBands_(1)
+        , jobs_(jobs)
+        , numTested_(0)
+        , numOccluded_(0) {
+
+        // 解像度ごとのHi-Zの段を用意する
+        int w = width_, h = height_;
+        for (;;) {
+            levels_.push_back(Level(w, h));
+            if (w == 1 && h == 1) {
+                break;
+            }
+            w = std::max(1, w / 2);
+            h = std::max(1, h / 2);
+        }
+
+        // 空いたスレッドが残りの帯を盗めるように, スレッドの数より細かく分ける (1つの帯は8行以上)
+        if (jobs_ != NULL) {
+            numBands_ = std::max(1, std::min(jobs_->numThreads() * 2, height_ / 8));
+        }
+    }
+
+    // 深度バッファを最も奥の値で埋め, 遮蔽物を空にする
+    void beginFrame(const glm::mat4 &viewProjMat) {
+        viewProjMat_ = viewProjMat;
+        triangles_.clear();
+        std::fill(levels_[0].depth.begin(), levels_[0].depth.end(), 1.0f);
+        numTested_ = 0;
+        numOccluded_ = 0;
+    }
+
+    // 遮蔽物を追加する. positionsは3つずつで1つの三角形を表す (モデル座標系)
+    // 遮蔽物は実際の形より大きくしてはいけないので, 境界ではなくメッシュそのものを渡す
+    void addOccluder(const std::vector<glm::vec3> &positions, const glm::mat4 &modelMat) {
+        const glm::mat4 mvpMat = viewProjMat_ * modelMat;
+        for (size_t i = 0; i + 2 < positions.size(); i += 3) {
+            glm::vec3 v[3];
+            bool clipped = false;
+            for (int k = 0; k < 3; k++) {
+                const glm::vec4 clip = mvpMat * glm::vec4(positions[i + k], 1.0f);
+                // 近くの平面をまたぐ三角形は切り取らずに捨てる (遮蔽物が減るだけなので安全側)
+                if (clip.w <= FLT_EPSILON || clip.z < -clip.w) {
+                    clipped = true;
+                    break;
+                }
+                v[k] = toScreen(clip);
+            }
+
+            if (!clipped) {
+                setupTriangle(v);
+            }
+        }
+    }
+
+    // 遮蔽物を深度バッファに描き, Hi-Zピラミッドを作る
+    void rasterize() {
+        if (jobs_ != NULL) {
+            jobs_->parallelFor(numBands_, 1, [this](int begin, int end) {
+                for (int band = begin; band < end; band++) {
+                    rasterizeBand(band);
+                }
+            });
+        } else {
+            rasterizeBand(0);
+        }
+
+        buildPyramid();
+    }
+
+    // モデル座標系のAABBを持つ物体が見えるかどうか (隠れていると確定できない場合はtrue)
+    bool isVisible(const BoundingBox &box, const glm::mat4 &modelMat) {
+        numTested_++;
+
+        const glm::mat4 mvpMat = viewProjMat_ * modelMat;
+        float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+        for (int i = 0; i < 8; i++) {
+            const glm::vec3 corner((i & 1) ? box.max.x : box.min.x,
+                                   (i & 2) ? box.max.y : box.min.y,
+                                   (i & 4) ? box.max.z : box.min.z);
+            const glm::vec4 clip = mvpMat * glm::vec4(corner, 1.0f);
+            if (clip.w <= FLT_EPSILON || clip.z < -clip.w) {
+                return true;
+            }
+
+            const glm::vec3 p = toScreen(clip);
+            minX = std::min(minX, p.x);
+            minY = std::min(minY, p.y);
+            maxX = std::max(maxX, p.x);
+            maxY = std::max(maxY, p.y);
+            minZ = std::min(minZ, p.z);
+        }
+
+        // 画面外の判定は視錐台カリングに任せる
+        if (maxX < 0.0f || maxY < 0.0f || minX >= width_ || minY >= height_) {
+            return true;
+        }
+
+        // 整数に直す前に画面内に収める (wが小さい点は座標が非常に大きくなる)
+        int x0 = (int)std::max(0.0f, minX);
+        int y0 = (int)std::max(0.0f, minY);
+        int x1 = (int)std::min((float)(width_ - 1), maxX);
+        int y1 = (int)std::min((float)(height_ - 1), maxY);
+
+        // 矩形が2x2テクセル以内に収まる段を選ぶ
+        int level = 0;
+        while (level + 1 < (int)levels_.size() && ((x1 - x0) > 1 || (y1 - y0) > 1)) {
+            x0 >>= 1;
+            y0 >>= 1;
+            x1 >>= 1;
+            y1 >>= 1;
+            level++;
+        }
+
+        const Level &hiz = levels_[level];
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                if (minZ <= hiz.depth[y * hiz.width + x]) {
+                    return true;
+                }
+            }
+        }
+
+        numOccluded_++;
+        return false;
+    }
+
+    int numOccluderTriangles() const {
+        return (int)triangles_.size();
+    }
+
+    int numTested() const {
+        return numTested_;
+    }
+
+    int numOccluded() const {
+        return numOccluded_;
+    }
+
+    int numBands() const {
+        return numBands_;
+    }
+
+    static bool isSimd() {
+#ifdef FRUSTUM_CULLING_USE_SSE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+private:
+    // 画面上の三角形. 辺の関数 a * x + b * y + c が3つとも0以上の画素を塗り,
+    // 深度は平面 dzdx * x + dzdy * y + z0 で求める
+    struct ScreenTriangle {
+        float a[3], b[3], c[3];
+        float dzdx, dzdy, z0;
+        int minX, maxX, minY, maxY;
+    };
+
+    struct Level {
+        Level(int w, int h)
+            : width(w)
+            , height(h)
+            , depth(w * h, 1.0f) {
+        }
+
+        int width;
+        int height;
+        std::vector<float> depth;
+    };
+
+    // クリップ座標から画素単位の座標と [0, 1] の深度に変換する
+    glm::vec3 toScreen(const glm::vec4 &clip) const {
+        const float invW = 1.0f / clip.w;
+        return glm::vec3((clip.x * invW * 0.5f + 0.5f) * width_,
+                         (clip.y * invW * 0.5f + 0.5f) * height_,
+                         std::min(1.0f, clip.z * invW * 0.5f + 0.5f));
+    }
+
+    void setupTriangle(const glm::vec3 *v) {
+        ScreenTriangle t;
+        const float minX = std::min(v[0].x, std::min(v[1].x, v[2].x));
+        const float maxX = std::max(v[0].x, std::max(v[1].x, v[2].x));
+        const float minY = std::min(v[0].y, std::min(v[1].y, v[2].y));
+        const float maxY = std::max(v[0].y, std::max(v[1].y, v[2].y));
+        if (maxX < 0.0f || maxY < 0.0f || minX >= width_ || minY >= height_) {
+            return;
+        }
+
+        t.minX = (int)std::max(0.0f, std::floor(minX));
+        t.maxX = (int)std::min((float)(width_ - 1), std::ceil(maxX));
+        t.minY = (int)std::max(0.0f, std::floor(minY));
+        t.maxY = (int)std::min((float)(height_ - 1), std::ceil(maxY));
+        if (t.minX > t.maxX || t.minY > t.maxY) {
+            return;
+        }
+
+        // 辺 k は頂点 k+1 から k+2 へ向かう (頂点 k の向かいの辺)
+        for (int k = 0; k < 3; k++) {
+            const glm::vec3 &p = v[(k + 1) % 3];
+            const glm::vec3 &q = v[(k + 2) % 3];
+            t.a[k] = p.y - q.y;
+            t.b[k] = q.x - p.x;
+            t.c[k] = p.x * q.y - p.y * q.x;
+        }
+
+        // 表裏どちらも塗るので, 面積が正になるように辺の向きをそろえる
+        float area = t.c[0] + t.c[1] + t.c[2];
+        if (std::abs(area) < 1.0e-6f) {
+            return;
+        }
+
+        if (area < 0.0f) {
+            for (int k = 0; k < 3; k++) {
+                t.a[k] = -t.a[k];
+                t.b[k] = -t.b[k];
+                t.c[k] = -t.c[k];
+            }
+            area = -area;
+        }
+
+        // 重心座標 (辺の関数 / 面積) で頂点の深度を補間する
+        const float invArea = 1.0f / area;
+        t.dzdx = (t.a[0] * v[0].z + t.a[1] * v[1].z + t.a[2] * v[2].z) * invArea;
+        t.dzdy = (t.b[0] * v[0].z + t.b[1] * v[1].z + t.b[2] * v[2].z) * invArea;
+        t.z0 = (t.c[0] * v[0].z + t.c[1] * v[1].z + t.c[2] * v[2].z) * invArea;
+        triangles_.push_back(t);
+    }
+
+    // band番目の帯 (全体を帯の数で等分した行) に全ての三角形を描く
+    void rasterizeBand(int band) {
+        const int rowsPerBand = (height_ + numBands_ - 1) / numBands_;
+        const int bandMinY = band * rowsPerBand;
+        const int bandMaxY = std::min(height_, bandMinY + rowsPerBand) - 1;
+
+        float *depth = levels_[0].depth.data();
+        for (size_t i = 0; i < triangles_.size(); i++) {
+            const ScreenTriangle &t = triangles_[i];
+            const int minY = std::max(t.minY, bandMinY);
+            const int maxY = std::min(t.maxY, bandMaxY);
+            // 4画素ずつ処理するので, 開始位置を4の倍数にそろえる
+            const int minX = t.minX & ~3;
+
+            for (int y = minY; y <= maxY; y++) {
+                const float py = y + 0.5f;
+                float *row = depth + y * width_;
+#ifdef FRUSTUM_CULLING_USE_SSE
+                const __m128 zero = _mm_setzero_ps();
+                const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+                __m128 a[3], rowValue[3];
+                for (int k = 0; k < 3; k++) {
+                    a[k] = _mm_set1_ps(t.a[k]);
+                    rowValue[k] = _mm_set1_ps(t.b[k] * py + t.c[k]);
+                }
+                const __m128 dzdx = _mm_set1_ps(t.dzdx);
+                const __m128 rowZ = _mm_set1_ps(t.dzdy * py + t.z0);
+
+                for (int x = minX; x <= t.maxX; x += 4) {
+                    const __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+                    __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[0], px), rowValue[0]), zero);
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[1], px), rowValue[1]), zero));
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[2], px), rowValue[2]), zero));
+                    if (_mm_movemask_ps(inside) == 0) {
+                        continue;
+                    }
+
+                    // 内側の画素だけ手前の深度に置き換える
+                    const __m128 z = _mm_add_ps(_mm_mul_ps(dzdx, px), rowZ);
+                    const __m128 old = _mm_loadu_ps(row + x);
+                    const __m128 nearer = _mm_min_ps(old, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+                }
+#else
+                for (int x = minX; x <= t.maxX; x++) {
+                    const float px = x + 0.5f;
+                    if (t.a[0] * px + t.b[0] * py + t.c[0] >= 0.0f &&
+                        t.a[1] * px + t.b[1] * py + t.c[1] >= 0.0f &&
+                        t.a[2] * px + t.b[2] * py + t.c[2] >= 0.0f) {
+                        const float z = t.dzdx * px + t.dzdy * py + t.z0;
+                        row[x] = std::min(row[x], z);
+                    }
+                }
+#endif
+            }
+        }
+    }
+
+    // 各段は1つ上の段の2x2テクセルのうち最も奥の深度を持つ
+    void buildPyramid() {
+        for (size_t l = 1; l < levels_.size(); l++) {
+            const Level &src = levels_[l - 1];
+            Level &dst = levels_[l];
+            for (int y = 0; y < dst.height; y++) {
+                const int sy0 = std::min(2 * y, src.height - 1);
+                const int sy1 = std::min(2 * y + 1, src.height - 1);
+                for (int x = 0; x < dst.width; x++) {
+                    const int sx0 = std::min(2 * x, src.width - 1);
+                    const int sx1 = std::min(2 * x + 1, src.width - 1);
+                    const float d0 = std::max(src.depth[sy0 * src.width + sx0], src.depth[sy0 * src.width + sx1]);
+                    const float d1 = std::max(src.depth[sy1 * src.width + sx0], src.depth[sy1 * src.width + sx1]);
+                    dst.depth[y * dst.width + x] = std::max(d0, d1);
+                }
+            }
+        }
+    }
+
+    int width_;
+    int height_;
+    int numBands_;
+    glm::mat4 viewProjMat_;
+    std::vector<ScreenTriangle> triangles_;
+    std::vector<Level> levels_;
+
+    JobSystem *jobs_;
+
+    int numTested_;
+    int numOccluded_;
+};
+
+#endif  // _GLUTILS_OCCLUSION_CULLING_H_
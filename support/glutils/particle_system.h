@@ -0,0 +1,223 @@
+#ifndef _GLUTILS_PARTICLE_SYSTEM_H_
+#define _GLUTILS_PARTICLE_SYSTEM_H_
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <glutils/job_system.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PARTICLE_SYSTEM_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+// 爆発の破片などの大量の粒子を扱う入れ物
+//
+// 位置, 速度, 経過時間, 寿命を成分ごとの配列 (SoA) で持ち, 最大数の分を最初に確保しておく
+// (粒子が増えても確保し直さない). 生きている粒子は配列の先頭から隙間なく並び,
+// 寿命が尽きた粒子は末尾の粒子と入れ替えて取り除く.
+// SSEが使える場合は update() で4つの粒子を同時に動かす. ジョブシステムを渡せば範囲に分けて並列に動かす.
+// 描画用には, 位置と残りの寿命の割合を float 4つずつ詰めて書き出す (インスタンス属性にそのまま使える).
+//
+// 乱数はこのクラスが持つ種から作るので, 同じ種から始めれば同じように飛び散る.
+class ParticleSystem {
+public:
+    // 描画用に書き出すときの1粒子あたりのfloatの数 (x, y, z, 残りの寿命の割合)
+    static const int FLOATS_PER_INSTANCE = 4;
+
+    ParticleSystem()
+        : count_(0)
+        , capacity_(0)
+        , seed_(1u) {
+    }
+
+    // 最大数を決めて確保し, 粒子をすべて消す
+    void reserve(int capacity) {
+        capacity_ = capacity;
+
+        // SIMDで4つずつ処理するので, 端数の分も確保しておく
+        const size_t padded = (size_t)((capacity + 3) & ~3);
+        px_.assign(padded, 0.0f);
+        py_.assign(padded, 0.0f);
+        pz_.assign(padded, 0.0f);
+        vx_.assign(padded, 0.0f);
+        vy_.assign(padded, 0.0f);
+        vz_.assign(padded, 0.0f);
+        age_.assign(padded, 0.0f);
+        life_.assign(padded, 1.0f);
+        count_ = 0;
+    }
+
+    void clear() {
+        count_ = 0;
+    }
+
+    // 乱数の種を設定する (0は使えないので1にする)
+    void setSeed(unsigned int seed) {
+        seed_ = seed != 0u ? seed : 1u;
+    }
+
+    // centerから四方に count 個の粒子を飛ばし, 実際に出した数を返す (最大数を超える分は出さない)
+    // 速さは speed の 0.3〜1倍, 寿命は lifetime の 0.5〜1倍でばらつかせる
+    int emitBurst(const glm::vec3 &center, int count, float speed, float lifetime) {
+        const int n = std::min(count, capacity_ - count_);
+        for (int k = 0; k < n; k++) {
+            // 球面上に一様な向き
+            const float z = 2.0f * random() - 1.0f;
+            const float phi = 6.28318531f * random();
+            const float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+            const float s = speed * (0.3f + 0.7f * random());
+
+            const int i = count_++;
+            px_[i] = center.x;
+            py_[i] = center.y;
+            pz_[i] = center.z;
+            vx_[i] = r * std::cos(phi) * s;
+            vy_[i] = r * std::sin(phi) * s;
+            vz_[i] = z * s;
+            age_[i] = 0.0f;
+            life_[i] = lifetime * (0.5f + 0.5f * random());
+        }
+        return n;
+    }
+
+    // すべての粒子を dt 秒だけ動かし (gravityは加速度), 寿命が尽きたものを取り除く
+    // jobsを渡すと動かす部分を範囲に分けて並列に行う (取り除く部分は並びが変わるので1つのスレッドで行う)
+    void update(float dt, const glm::vec3 &gravity, JobSystem *jobs = NULL) {
+        if (jobs != NULL) {
+            // 範囲の先頭がSIMDの4つ組の境目になるように, 4つ組の単位で分ける
+            jobs->parallelFor((count_ + 3) / 4, PARALLEL_GRAIN / 4, [&](int begin, int end) {
+                integrate(begin * 4, std::min(end * 4, count_), dt, gravity);
+            });
+        } else {
+            integrate(0, count_, dt, gravity);
+        }
+
+        // 末尾から見ていけば, 入れ替えで移ってくる粒子はすでに調べたものになる
+        for (int j = count_ - 1; j >= 0; j--) {
+            if (age_[j] >= life_[j]) {
+                const int last = --count_;
+                px_[j] = px_[last];
+                py_[j] = py_[last];
+                pz_[j] = pz_[last];
+                vx_[j] = vx_[last];
+                vy_[j] = vy_[last];
+                vz_[j] = vz_[last];
+                age_[j] = age_[last];
+                life_[j] = life_[last];
+            }
+        }
+    }
+
+    // 位置と残りの寿命の割合を dst に FLOATS_PER_INSTANCE 個ずつ書き出し, 粒子の数を返す
+    // (dstには size() * FLOATS_PER_INSTANCE 個のfloatの領域が要る)
+    int writeInstances(float *dst) const {
+        int i = 0;
+#ifdef PARTICLE_SYSTEM_USE_SSE
+        // 成分ごとの4粒子分を転置して, 粒子ごとの4成分に並べ替える
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (; i + 4 <= count_; i += 4) {
+            __m128 x = _mm_loadu_ps(&px_[i]);
+            __m128 y = _mm_loadu_ps(&py_[i]);
+            __m128 z = _mm_loadu_ps(&pz_[i]);
+            __m128 w = _mm_sub_ps(one, _mm_div_ps(_mm_loadu_ps(&age_[i]), _mm_loadu_ps(&life_[i])));
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+            _mm_storeu_ps(dst + (i + 0) * FLOATS_PER_INSTANCE, x);
+            _mm_storeu_ps(dst + (i + 1) * FLOATS_PER_INSTANCE, y);
+            _mm_storeu_ps(dst + (i + 2) * FLOATS_PER_INSTANCE, z);
+            _mm_storeu_ps(dst + (i + 3) * FLOATS_PER_INSTANCE, w);
+        }
+#endif
+        for (; i < count_; i++) {
+            float *p = dst + i * FLOATS_PER_INSTANCE;
+            p[0] = px_[i];
+            p[1] = py_[i];
+            p[2] = pz_[i];
+            p[3] = 1.0f - age_[i] / life_[i];
+        }
+        return count_;
+    }
+
+    int size() const {
+        return count_;
+    }
+
+    int capacity() const {
+        return capacity_;
+    }
+
+    bool empty() const {
+        return count_ == 0;
+    }
+
+    glm::vec3 position(int index) const {
+        return glm::vec3(px_[index], py_[index], pz_[index]);
+    }
+
+    static bool isSimd() {
+#ifdef PARTICLE_SYSTEM_USE_SSE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+private:
+    // 並列に動かすときに1つのジョブが受け持つ粒子の数
+    static const int PARALLEL_GRAIN = 16384;
+
+    // [begin, end) の粒子を動かす
+    void integrate(int begin, int end, float dt, const glm::vec3 &gravity) {
+        int i = begin;
+#ifdef PARTICLE_SYSTEM_USE_SSE
+        const __m128 t = _mm_set1_ps(dt);
+        const __m128 gx = _mm_set1_ps(gravity.x * dt);
+        const __m128 gy = _mm_set1_ps(gravity.y * dt);
+        const __m128 gz = _mm_set1_ps(gravity.z * dt);
+        for (; i + 4 <= end; i += 4) {
+            const __m128 vx = _mm_add_ps(_mm_loadu_ps(&vx_[i]), gx);
+            const __m128 vy = _mm_add_ps(_mm_loadu_ps(&vy_[i]), gy);
+            const __m128 vz = _mm_add_ps(_mm_loadu_ps(&vz_[i]), gz);
+            _mm_storeu_ps(&vx_[i], vx);
+            _mm_storeu_ps(&vy_[i], vy);
+            _mm_storeu_ps(&vz_[i], vz);
+            _mm_storeu_ps(&px_[i], _mm_add_ps(_mm_loadu_ps(&px_[i]), _mm_mul_ps(vx, t)));
+            _mm_storeu_ps(&py_[i], _mm_add_ps(_mm_loadu_ps(&py_[i]), _mm_mul_ps(vy, t)));
+            _mm_storeu_ps(&pz_[i], _mm_add_ps(_mm_loadu_ps(&pz_[i]), _mm_mul_ps(vz, t)));
+            _mm_storeu_ps(&age_[i], _mm_add_ps(_mm_loadu_ps(&age_[i]), t));
+        }
+#endif
+        for (; i < end; i++) {
+            vx_[i] += gravity.x * dt;
+            vy_[i] += gravity.y * dt;
+            vz_[i] += gravity.z * dt;
+            px_[i] += vx_[i] * dt;
+            py_[i] += vy_[i] * dt;
+            pz_[i] += vz_[i] * dt;
+            age_[i] += dt;
+        }
+    }
+
+    // [0, 1) の一様乱数 (xorshift32)
+    float random() {
+        seed_ ^= seed_ << 13;
+        seed_ ^= seed_ >> 17;
+        seed_ ^= seed_ << 5;
+        return (seed_ >> 8) * (1.0f / 16777216.0f);
+    }
+
+    int count_;
+    int capacity_;
+    unsigned int seed_;
+
+    // 粒子ごとの配列 (添字は共通, 長さは最大数を4の倍数に切り上げたもの)
+    std::vector<float> px_, py_, pz_;
+    std::vector<float> vx_, vy_, vz_;
+    std::vector<float> age_;
+    std::vector<float> life_;
+};
+
+#endif  // _GLUTILS_PARTICLE_SYSTEM_H_
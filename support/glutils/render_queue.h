@@ -0,0 +1,340 @@
+#ifndef _GLUTILS_RENDER_QUEUE_H_
+#define _GLUTILS_RENDER_QUEUE_H_
+
+// このヘッダは OpenGLの関数を使うので, <glad/gl.h> の後にインクルードすること
+// (gladの実装部はインクルードガードで守られていないため, ここではインクルードしない)
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <stdint.h>
+
+// 1フレーム分の描画と状態変更の回数
+struct RenderStats {
+    RenderStats()
+        : draws(0)
+        , stateChanges(0)
+        , skippedCalls(0) {
+    }
+
+    int draws;          // 描画命令の回数
+    int stateChanges;   // 実際に発行した状態変更の回数
+    int skippedCalls;   // 現在の状態と同じだったので省いた呼び出しの回数
+};
+
+// OpenGLの状態を覚えておき, すでに設定済みの値を設定し直す呼び出しを省くクラス
+// このクラスを通さずに状態を変えた場合は invalidate() を呼ぶこと
+class GLStateCache {
+public:
+    static const int MAX_TEXTURE_UNITS = 16;
+
+    GLStateCache() {
+        invalidate();
+    }
+
+    // 覚えている状態をすべて捨てる (次の設定は必ず発行される)
+    void invalidate() {
+        depthTest_ = Cached<bool>();
+        blend_ = Cached<bool>();
+        cullFace_ = Cached<bool>();
+        depthMask_ = Cached<bool>();
+        blendFunc_ = Cached<std::pair<GLenum, GLenum> >();
+        program_ = Cached<GLuint>();
+        vertexArray_ = Cached<GLuint>();
+        activeTexture_ = Cached<int>();
+        for (int i = 0; i < MAX_TEXTURE_UNITS; i++) {
+            texture2D_[i] = Cached<GLuint>();
+            textureCube_[i] = Cached<GLuint>();
+        }
+    }
+
+    // GL_DEPTH_TEST, GL_BLEND, GL_CULL_FACE の切り替え (それ以外はそのまま発行する)
+    void setEnabled(GLenum cap, bool enabled) {
+        Cached<bool> *cached = capability(cap);
+        if (cached == NULL || changed(*cached, enabled)) {
+            if (cached == NULL) {
+                stats_.stateChanges++;
+            }
+
+            if (enabled) {
+                glEnable(cap);
+            } else {
+                glDisable(cap);
+            }
+        }
+    }
+
+    void enable(GLenum cap) {
+        setEnabled(cap, true);
+    }
+
+    void disable(GLenum cap) {
+        setEnabled(cap, false);
+    }
+
+    void depthMask(bool write) {
+        if (changed(depthMask_, write)) {
+            glDepthMask(write ? GL_TRUE : GL_FALSE);
+        }
+    }
+
+    void blendFunc(GLenum src, GLenum dst) {
+        if (changed(blendFunc_, std::make_pair(src, dst))) {
+            glBlendFunc(src, dst);
+        }
+    }
+
+    void useProgram(GLuint programId) {
+        if (changed(program_, programId)) {
+            glUseProgram(programId);
+        }
+    }
+
+    void bindVertexArray(GLuint vaoId) {
+        if (changed(vertexArray_, vaoId)) {
+            glBindVertexArray(vaoId);
+        }
+    }
+
+    // テクスチャユニットを選んでテクスチャを割り当てる (ユニットの切り替えも必要なときだけ行う)
+    void bindTexture(int unit, GLenum target, GLuint textureId) {
+        Cached<GLuint> *cached = NULL;
+        if (unit >= 0 && unit < MAX_TEXTURE_UNITS) {
+            if (target == GL_TEXTURE_2D) {
+                cached = &texture2D_[unit];
+            } else if (target == GL_TEXTURE_CUBE_MAP) {
+                cached = &textureCube_[unit];
+            }
+        }
+
+        if (cached != NULL && !changed(*cached, textureId)) {
+            return;
+        }
+
+        if (changed(activeTexture_, unit)) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+        }
+
+        if (cached == NULL) {
+            stats_.stateChanges++;
+        }
+        glBindTexture(target, textureId);
+    }
+
+    void countDraw() {
+        stats_.draws++;
+    }
+
+    const RenderStats &stats() const {
+        return stats_;
+    }
+
+    void resetStats() {
+        stats_ = RenderStats();
+    }
+
+private:
+    template <typename T>
+    struct Cached {
+        Cached()
+            : value()
+            , valid(false) {
+        }
+
+        T value;
+        bool valid;
+    };
+
+    // 値が変わっていれば覚えてtrueを返す. 同じなら省いた回数を数える
+    template <typename T>
+    bool changed(Cached<T> &cached, const T &value) {
+        if (cached.valid && cached.value == value) {
+            stats_.skippedCalls++;
+            return false;
+        }
+
+        cached.value = value;
+        cached.valid = true;
+        stats_.stateChanges++;
+        return true;
+    }
+
+    Cached<bool> *capability(GLenum cap) {
+        switch (cap) {
+        case GL_DEPTH_TEST:
+            return &depthTest_;
+        case GL_BLEND:
+            return &blend_;
+        case GL_CULL_FACE:
+            return &cullFace_;
+        default:
+            return NULL;
+        }
+    }
+
+    Cached<bool> depthTest_;
+    Cached<bool> blend_;
+    Cached<bool> cullFace_;
+    Cached<bool> depthMask_;
+    Cached<std::pair<GLenum, GLenum> > blendFunc_;
+    Cached<GLuint> program_;
+    Cached<GLuint> vertexArray_;
+    Cached<int> activeTexture_;
+    Cached<GLuint> texture2D_[MAX_TEXTURE_UNITS];
+    Cached<GLuint> textureCube_[MAX_TEXTURE_UNITS];
+    RenderStats stats_;
+};
+
+// 1回分の描画命令
+struct DrawItem {
+    DrawItem()
+        : key(0)
+        , programId(0u)
+        , vaoId(0u)
+        , textureId(0u)
+        , depthTest(true)
+        , blend(false)
+        , mode(GL_TRIANGLES)
+        , count(0)
+        , instanceCount(1) {
+    }
+
+    uint64_t key;             // 並べ替えのキー (RenderQueue::makeKey で作る)
+    GLuint programId;
+    GLuint vaoId;
+    GLuint textureId;         // 0ならテクスチャは割り当てない (ユニット0, GL_TEXTURE_2D)
+    bool depthTest;
+    bool blend;
+    GLenum mode;
+    GLsizei count;            // 頂点番号の数 (GL_UNSIGNED_INT)
+    GLsizei instanceCount;    // 2以上ならインスタンス描画
+
+    // Uniform変数の設定など. プログラムとVAOを有効にした後, 描画の直前に呼ばれる
+    std::function<void()> prepare;
+};
+
+// 描画命令を1フレーム分ためておき, キーで並べ替えてから状態変更を省きつつ描画するクラス
+// キーの上位ビットから順に比較されるので, 切り替えの重い状態ほど上位に置く
+class RenderQueue {
+public:
+    // 不透明な物体用のキー (上位から): パス 4 | プログラム 12 | 材質 12 | テクスチャ 12 | 深度 24
+    // 状態の切り替えを減らすことを優先し, 同じ状態の中では手前から描く
+    static uint64_t makeKey(unsigned int pass, unsigned int program, unsigned int material,
+                            unsigned int texture, unsigned int depth) {
+        return ((uint64_t)(pass & 0xfu) << 60) |
+               ((uint64_t)(program & 0xfffu) << 48) |
+               ((uint64_t)(material & 0xfffu) << 36) |
+               ((uint64_t)(texture & 0xfffu) << 24) |
+               ((uint64_t)(depth & 0xffffffu));
+    }
+
+    // 半透明の物体用のキー (上位から): パス 4 | 深度 24 | プログラム 12 | 材質 12 | テクスチャ 12
+    // 重なりの順序を守るため, 深度を状態より優先する
+    static uint64_t makeDepthFirstKey(unsigned int pass, unsigned int depth, unsigned int program,
+                                      unsigned int material, unsigned int texture) {
+        return ((uint64_t)(pass & 0xfu) << 60) |
+               ((uint64_t)(depth & 0xffffffu) << 36) |
+               ((uint64_t)(program & 0xfffu) << 24) |
+               ((uint64_t)(material & 0xfffu) << 12) |
+               ((uint64_t)(texture & 0xfffu));
+    }
+
+    // カメラからの距離を [nearZ, farZ] で24ビットに量子化する (backToFrontなら奥ほど小さくする)
+    static unsigned int quantizeDepth(float depth, float nearZ, float farZ, bool backToFront = false) {
+        float t = (depth - nearZ) / (farZ - nearZ);
+        t = std::max(0.0f, std::min(t, 1.0f));
+        const unsigned int bits = (unsigned int)(t * 0xffffff);
+        return backToFront ? 0xffffffu - bits : bits;
+    }
+
+    void clear() {
+        items_.clear();
+    }
+
+    void submit(const DrawItem &item) {
+        items_.push_back(item);
+    }
+
+    int size() const {
+        return (int)items_.size();
+    }
+
+    // キーで安定に並べ替える (8ビットずつの基数ソート. 全要素で同じ桁は飛ばす)
+    void sort() {
+        const size_t n = items_.size();
+        entries_.resize(n);
+        temp_.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            entries_[i].key = items_[i].key;
+            entries_[i].index = (uint32_t)i;
+        }
+
+        if (n < 2) {
+            return;
+        }
+
+        for (int shift = 0; shift < 64; shift += 8) {
+            size_t counts[256] = { 0 };
+            for (size_t i = 0; i < n; i++) {
+                counts[(entries_[i].key >> shift) & 0xff]++;
+            }
+
+            if (counts[(entries_[0].key >> shift) & 0xff] == n) {
+                continue;
+            }
+
+            size_t offset = 0;
+            for (int b = 0; b < 256; b++) {
+                const size_t c = counts[b];
+                counts[b] = offset;
+                offset += c;
+            }
+
+            for (size_t i = 0; i < n; i++) {
+                temp_[counts[(entries_[i].key >> shift) & 0xff]++] = entries_[i];
+            }
+            entries_.swap(temp_);
+        }
+    }
+
+    // 並べ替えてから描画する. 状態の設定はすべて state を通すので, 変わらない設定は発行されない
+    void execute(GLStateCache &state) {
+        sort();
+
+        for (size_t i = 0; i < entries_.size(); i++) {
+            const DrawItem &item = items_[entries_[i].index];
+
+            state.setEnabled(GL_DEPTH_TEST, item.depthTest);
+            state.setEnabled(GL_BLEND, item.blend);
+            state.useProgram(item.programId);
+            state.bindVertexArray(item.vaoId);
+            if (item.textureId != 0u) {
+                state.bindTexture(0, GL_TEXTURE_2D, item.textureId);
+            }
+
+            if (item.prepare) {
+                item.prepare();
+            }
+
+            if (item.instanceCount > 1) {
+                glDrawElementsInstanced(item.mode, item.count, GL_UNSIGNED_INT, 0, item.instanceCount);
+            } else {
+                glDrawElements(item.mode, item.count, GL_UNSIGNED_INT, 0);
+            }
+            state.countDraw();
+        }
+    }
+
+private:
+    struct SortEntry {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    std::vector<DrawItem> items_;
+    std::vector<SortEntry> entries_;
+    std::vector<SortEntry> temp_;
+};
+
+#endif  // _GLUTILS_RENDER_QUEUE_H_
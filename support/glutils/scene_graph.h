@@ -0,0 +1,138 @@
+#ifndef _GLUTILS_SCENE_GRAPH_H_
+#define _GLUTILS_SCENE_GRAPH_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// 物体の親子関係と変換行列を管理するシーングラフ
+//
+// ノードは木ではなく, ローカル行列, ワールド行列, 法線の変換行列をそれぞれ1本の配列に並べて持つ.
+// 子は必ず親より後に追加する (親の番号 < 子の番号) ので, update() は配列を先頭から1回なめるだけで,
+// 親のワールド行列は子を計算するときには必ず更新済みになっている.
+//
+// setLocal() でローカル行列が変わったノードに印を付け, update() では印の付いたノードと
+// その子孫だけワールド行列を計算し直す. 法線の変換行列 (ワールド行列の左上3x3の逆転置) も
+// そのときだけ計算し直すので, 動かない物体では毎フレームの逆行列の計算が要らない.
+//
+// 使い方:
+//   int body = scene.addNode();
+//   int wing = scene.addNode(body, glm::translate(...));
+//   scene.setLocal(body, glm::translate(position));
+//   scene.update();
+//   scene.world(wing), scene.normalMatrix(wing) ...
+class SceneGraph {
+public:
+    // 親がないことを表す番号
+    static const int NO_PARENT = -1;
+
+    SceneGraph()
+        : numUpdated_(0) {
+    }
+
+    void clear() {
+        parents_.clear();
+        locals_.clear();
+        worlds_.clear();
+        normals_.clear();
+        dirty_.clear();
+        changed_.clear();
+        numUpdated_ = 0;
+    }
+
+    void reserve(size_t n) {
+        parents_.reserve(n);
+        locals_.reserve(n);
+        worlds_.reserve(n);
+        normals_.reserve(n);
+        dirty_.reserve(n);
+        changed_.reserve(n);
+    }
+
+    // ノードを追加して番号を返す (parentはすでにあるノードの番号か NO_PARENT)
+    int addNode(int parent = NO_PARENT, const glm::mat4 &local = glm::mat4(1.0f)) {
+        // 親が後ろにあると update() の1回の走査では親より先に子を計算してしまう
+        if (parent != NO_PARENT && (parent < 0 || parent >= size())) {
+            fprintf(stderr, "Invalid parent node: %d (%d nodes)\n", parent, size());
+            exit(1);
+        }
+
+        parents_.push_back(parent);
+        locals_.push_back(local);
+        worlds_.push_back(local);
+        normals_.push_back(glm::mat3(1.0f));
+        dirty_.push_back(1);
+        changed_.push_back(0);
+        return (int)parents_.size() - 1;
+    }
+
+    // ローカル行列 (親の座標系での変換) を設定する. 前と同じなら印を付けない
+    void setLocal(int node, const glm::mat4 &local) {
+        if (locals_[node] != local) {
+            locals_[node] = local;
+            dirty_[node] = 1;
+        }
+    }
+
+    // 印の付いたノードとその子孫のワールド行列と法線の変換行列を計算し直す
+    void update() {
+        numUpdated_ = 0;
+        for (size_t i = 0; i < parents_.size(); i++) {
+            const int parent = parents_[i];
+            changed_[i] = dirty_[i] || (parent != NO_PARENT && changed_[parent]);
+            if (!changed_[i]) {
+                continue;
+            }
+
+            worlds_[i] = parent != NO_PARENT ? worlds_[parent] * locals_[i] : locals_[i];
+            normals_[i] = glm::transpose(glm::inverse(glm::mat3(worlds_[i])));
+            dirty_[i] = 0;
+            numUpdated_++;
+        }
+    }
+
+    const glm::mat4 &local(int node) const {
+        return locals_[node];
+    }
+
+    // ワールド行列 (最後に update() したときのもの)
+    const glm::mat4 &world(int node) const {
+        return worlds_[node];
+    }
+
+    // ワールド空間での法線の変換行列 (最後に update() したときのもの)
+    const glm::mat3 &normalMatrix(int node) const {
+        return normals_[node];
+    }
+
+    int parent(int node) const {
+        return parents_[node];
+    }
+
+    // 最後の update() でワールド行列が変わったかどうか
+    bool changed(int node) const {
+        return changed_[node] != 0;
+    }
+
+    int size() const {
+        return (int)parents_.size();
+    }
+
+    // 最後の update() で計算し直したノードの数
+    int numUpdated() const {
+        return numUpdated_;
+    }
+
+private:
+    std::vector<int> parents_;
+    std::vector<glm::mat4> locals_;
+    std::vector<glm::mat4> worlds_;
+    std::vector<glm::mat3> normals_;
+    std::vector<char> dirty_;     // ローカル行列が変わってまだ update() していない
+    std::vector<char> changed_;   // 最後の update() でワールド行列が変わった
+    int numUpdated_;
+};
+
+#endif  // _GLUTILS_SCENE_GRAPH_H_
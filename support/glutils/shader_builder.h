@@ -0,0 +1,509 @@
+#ifndef _GLUTILS_SHADER_BUILDER_H_
+#define _GLUTILS_SHADER_BUILDER_H_
+
+// このヘッダは OpenGLの関数を使うので, <glad/gl.h> の後にインクルードすること
+// (gladの実装部はインクルードガードで守られていないため, ここではインクルードしない)
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+// シェーダファイルの読み込み (読めなかった場合はエラーを出して終了)
+inline std::string loadShaderSource(const std::string &filename) {
+    std::ifstream reader(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!reader.is_open()) {
+        fprintf(stderr, "Failed to load shader: %s\n", filename.c_str());
+        exit(1);
+    }
+
+    std::string code;
+    reader.seekg(0, std::ios::end);
+    code.resize((size_t)reader.tellg());
+    reader.seekg(0);
+    reader.read(&code[0], code.size());
+    return code;
+}
+
+// 拡張機能が使えるかどうか
+inline bool hasGLExtension(const char *name) {
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (GLint i = 0; i < numExtensions; i++) {
+        const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+        if (ext != NULL && std::string(ext) == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// "#version" の行の直後にマクロの定義などを差し込む (同じファイルから機能の異なるシェーダを作るため)
+inline std::string insertShaderHeader(const std::string &code, const std::string &header) {
+    if (header.empty()) {
+        return code;
+    }
+
+    size_t pos = 0;
+    std::string result;
+    if (code.compare(0, 8, "#version") == 0) {
+        pos = code.find('\n');
+        pos = pos == std::string::npos ? code.size() : pos + 1;
+        result = code.substr(0, pos);
+        if (result[result.size() - 1] != '\n') {
+            result += '\n';
+        }
+    }
+
+    result += header;
+    if (header[header.size() - 1] != '\n') {
+        result += '\n';
+    }
+    result += code.substr(pos);
+    return result;
+}
+
+// コンパイル結果の確認 (失敗した場合はエラーメッセージとソースコードを表示して終了)
+inline void checkShaderCompiled(GLuint shaderId, const std::string &filename, const std::string &code) {
+    GLint compileStatus;
+    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
+    if (compileStatus == GL_FALSE) {
+        fprintf(stderr, "Failed to compile shader: %s\n", filename.c_str());
+
+        GLint logLength;
+        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &logLength);
+        if (logLength > 0) {
+            GLsizei length;
+            std::string errMsg;
+            errMsg.resize(logLength);
+            glGetShaderInfoLog(shaderId, logLength, &length, &errMsg[0]);
+
+            fprintf(stderr, "[ ERROR ] %s\n", errMsg.c_str());
+            fprintf(stderr, "%s\n", code.c_str());
+        }
+        exit(1);
+    }
+}
+
+// リンク結果の確認 (失敗した場合はエラーメッセージを表示して終了)
+inline void checkProgramLinked(GLuint programId) {
+    GLint linkState;
+    glGetProgramiv(programId, GL_LINK_STATUS, &linkState);
+    if (linkState == GL_FALSE) {
+        fprintf(stderr, "Failed to link shaders!\n");
+
+        GLint logLength;
+        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &logLength);
+        if (logLength > 0) {
+            GLsizei length;
+            std::string errMsg;
+            errMsg.resize(logLength);
+            glGetProgramInfoLog(programId, logLength, &length, &errMsg[0]);
+
+            fprintf(stderr, "[ ERROR ] %s\n", errMsg.c_str());
+        }
+        exit(1);
+    }
+}
+
+// リンク済みプログラムのバイナリをファイルに保存し, 次回の起動でコンパイルを省くためのクラス
+// キャッシュはシェーダのソースとドライバ (ベンダ, レンダラ, バージョン) のハッシュで区別し,
+// 一致しない場合や読み込みに失敗した場合にはソースからビルドし直す
+class ProgramBinaryCache {
+public:
+    // キャッシュのファイル名 (頂点シェーダと同じ場所に置く)
+    // 同じファイルから差し込むheaderを変えて作ったプログラムが互いに上書きしないように,
+    // headerがある場合はそのハッシュを名前に含める
+    static std::string cacheFile(const std::string &vShaderFile, const std::string &fShaderFile,
+                                 const std::string &header = "") {
+        const size_t slash = fShaderFile.find_last_of("/\\");
+        const std::string fName = slash == std::string::npos ? fShaderFile : fShaderFile.substr(slash + 1);
+        std::string name = vShaderFile + "+" + fName;
+        if (!header.empty()) {
+            char hash[32];
+            snprintf(hash, sizeof(hash), ".%016llx",
+                     (unsigned long long)fnv1a(14695981039346656037ULL, header.data(), header.size()));
+            name += hash;
+        }
+        return name + ".progbin";
+    }
+
+    // ソースとドライバの情報から作るキャッシュのキー (FNV-1a)
+    static uint64_t cacheKey(const std::vector<std::string> &sources) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < sources.size(); i++) {
+            hash = fnv1a(hash, sources[i].data(), sources[i].size());
+        }
+
+        const GLenum names[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+        for (int i = 0; i < 3; i++) {
+            const char *str = (const char *)glGetString(names[i]);
+            if (str != NULL) {
+                hash = fnv1a(hash, str, std::char_traits<char>::length(str));
+            }
+        }
+        return hash;
+    }
+
+    // プログラムバイナリが使えるか (GL 4.1以上で, 形式が1つ以上あること)
+    static bool supported() {
+        if (!GLAD_GL_VERSION_4_1) {
+            return false;
+        }
+
+        GLint numFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        return numFormats > 0;
+    }
+
+    // キャッシュからプログラムを作る. 失敗したら0を返す
+    static GLuint load(const std::string &filename, uint64_t key) {
+        FILE *fp = fopen(filename.c_str(), "rb");
+        if (fp == NULL) {
+            return 0u;
+        }
+
+        Header header;
+        std::vector<char> binary;
+        bool success = fread(&header, sizeof(Header), 1, fp) == 1 &&
+                       header.magic == MAGIC && header.key == key && header.length > 0;
+        if (success) {
+            binary.resize(header.length);
+            success = fread(&binary[0], 1, binary.size(), fp) == binary.size();
+        }
+        fclose(fp);
+
+        if (!success) {
+            return 0u;
+        }
+
+        // ドライバが更新された場合などはリンクに失敗するので, その場合は作り直す
+        GLuint programId = glCreateProgram();
+        glProgramBinary(programId, (GLenum)header.format, &binary[0], (GLsizei)binary.size());
+
+        GLint linkState;
+        glGetProgramiv(programId, GL_LINK_STATUS, &linkState);
+        if (linkState == GL_FALSE) {
+            glDeleteProgram(programId);
+            return 0u;
+        }
+        return programId;
+    }
+
+    // リンク済みのプログラムのバイナリを保存する
+    static bool save(const std::string &filename, uint64_t key, GLuint programId) {
+        GLint length = 0;
+        glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) {
+            return false;
+        }
+
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(programId, length, NULL, &format, &binary[0]);
+
+        FILE *fp = fopen(filename.c_str(), "wb");
+        if (fp == NULL) {
+            return false;
+        }
+
+        Header header;
+        header.magic = MAGIC;
+        header.format = format;
+        header.key = key;
+        header.length = (uint32_t)length;
+        const bool success = fwrite(&header, sizeof(Header), 1, fp) == 1 &&
+                             fwrite(&binary[0], 1, binary.size(), fp) == binary.size();
+        fclose(fp);
+        return success;
+    }
+
+private:
+    static const uint32_t MAGIC = 0x4e494250;  // "PBIN"
+
+    struct Header {
+        uint32_t magic;
+        uint32_t format;
+        uint64_t key;
+        uint32_t length;
+        uint32_t reserved;
+    };
+
+    static uint64_t fnv1a(uint64_t hash, const char *data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            hash ^= (unsigned char)data[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+};
+
+// シェーダのコンパイル
+inline GLuint compileShader(const std::string &filename, GLuint type, const std::string &code) {
+    GLuint shaderId = glCreateShader(type);
+    const char *codeChars = code.c_str();
+    glShaderSource(shaderId, 1, &codeChars, NULL);
+    glCompileShader(shaderId);
+    checkShaderCompiled(shaderId, filename, code);
+    return shaderId;
+}
+
+inline GLuint compileShader(const std::string &filename, GLuint type) {
+    return compileShader(filename, type, loadShaderSource(filename));
+}
+
+// KHR_parallel_shader_compile (gladの生成対象に含まれていないので自前で定義する)
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// 複数のシェーダプログラムをまとめてビルドするクラス
+// すべてのコンパイルとリンクを先に発行し, 結果の確認を後回しにすることで,
+// ドライバがプログラムごとに待たされずに並列でビルドできるようにする
+// KHR_parallel_shader_compileが使える場合は GL_COMPLETION_STATUS_KHR で完了を確認する
+// (使えない場合も確認を後回しにするだけで, 多くのドライバでは並列化される)
+class ShaderProgramBatch {
+public:
+    // loadにはgladLoadGLと同じ関数 (glfwGetProcAddressなど) を渡す. NULLなら拡張機能は使わない
+    explicit ShaderProgramBatch(GLADloadfunc load = NULL)
+        : parallel_(false)
+        , built_(false) {
+        if (load != NULL && hasGLExtension("GL_KHR_parallel_shader_compile")) {
+            MaxShaderCompilerThreadsFunc maxShaderCompilerThreads =
+                (MaxShaderCompilerThreadsFunc)load("glMaxShaderCompilerThreadsKHR");
+            if (maxShaderCompilerThreads != NULL) {
+                // ドライバが決めるスレッド数を使う
+                maxShaderCompilerThreads(0xFFFFFFFFu);
+                parallel_ = true;
+            }
+        }
+    }
+
+    // ビルドするプログラムを登録し, 結果を受け取るための番号を返す
+    // headerを与えると, 両方のシェーダの "#version" の行の直後に差し込む ("#define ..." など)
+    // 同じファイルとheaderの組がすでに登録されていれば, その番号を返す (同じプログラムは1回だけビルドする)
+    int add(const std::string &vShaderFile, const std::string &fShaderFile, const std::string &header = "") {
+        for (size_t i = 0; i < entries_.size(); i++) {
+            const Entry &e = entries_[i];
+            if (e.vShaderFile == vShaderFile && e.fShaderFile == fShaderFile && e.header == header) {
+                return (int)i;
+            }
+        }
+
+        Entry entry;
+        entry.vShaderFile = vShaderFile;
+        entry.fShaderFile = fShaderFile;
+        entry.header = header;
+        entries_.push_back(entry);
+        return (int)entries_.size() - 1;
+    }
+
+    // 登録されたすべてのプログラムをビルドし, 終わるまで待つ
+    void build() {
+        const Clock::time_point start = Clock::now();
+        const bool useCache = ProgramBinaryCache::supported();
+
+        // 1. キャッシュから読めるものは読む (読み込みにかかった時間はプログラムごとに測る)
+        for (size_t i = 0; i < entries_.size(); i++) {
+            Entry &e = entries_[i];
+            const Clock::time_point cacheStart = Clock::now();
+            e.vCode = insertShaderHeader(loadShaderSource(e.vShaderFile), e.header);
+            e.fCode = insertShaderHeader(loadShaderSource(e.fShaderFile), e.header);
+            e.cacheFile = ProgramBinaryCache::cacheFile(e.vShaderFile, e.fShaderFile, e.header);
+
+            if (useCache) {
+                std::vector<std::string> sources(2);
+                sources[0] = e.vCode;
+                sources[1] = e.fCode;
+                e.key = ProgramBinaryCache::cacheKey(sources);
+                e.programId = ProgramBinaryCache::load(e.cacheFile, e.key);
+                e.cacheHit = e.programId != 0u;
+                e.done = e.cacheHit;
+            }
+            e.cacheMs = millisecondsSince(cacheStart);
+        }
+
+        // 2. 残りのコンパイルをすべて発行する (結果はまだ確認しない)
+        for (size_t i = 0; i < entries_.size(); i++) {
+            Entry &e = entries_[i];
+            if (e.done) {
+                continue;
+            }
+            e.submitTime = Clock::now();
+            e.vertShaderId = submitShader(GL_VERTEX_SHADER, e.vCode);
+            e.fragShaderId = submitShader(GL_FRAGMENT_SHADER, e.fCode);
+        }
+
+        // 3. リンクもすべて発行する
+        for (size_t i = 0; i < entries_.size(); i++) {
+            Entry &e = entries_[i];
+            if (e.done) {
+                continue;
+            }
+            e.programId = glCreateProgram();
+            glAttachShader(e.programId, e.vertShaderId);
+            glAttachShader(e.programId, e.fragShaderId);
+            if (useCache) {
+                glProgramParameteri(e.programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+            }
+            glLinkProgram(e.programId);
+        }
+
+        // 4. 終わったものから結果を確認する
+        int remaining = 0;
+        for (size_t i = 0; i < entries_.size(); i++) {
+            remaining += entries_[i].done ? 0 : 1;
+        }
+
+        while (remaining > 0) {
+            for (size_t i = 0; i < entries_.size(); i++) {
+                Entry &e = entries_[i];
+                if (e.done || !isCompleted(e.programId)) {
+                    continue;
+                }
+
+                finish(e, useCache);
+                remaining--;
+            }
+
+            if (remaining > 0) {
+                std::this_thread::yield();
+            }
+        }
+
+        // コンパイルした場合とキャッシュから読んだ場合の時間を比べられるように, プログラムごとに出力する
+        // (コンパイルした場合は, 発行してからリンクの完了を確認するまでの時間. 並列にビルドしたものは重なる)
+        const double elapsed = millisecondsSince(start);
+        for (size_t i = 0; i < entries_.size(); i++) {
+            const Entry &e = entries_[i];
+            if (e.cacheHit) {
+                printf("Build shader program: %s + %s (cache hit, %.2f ms)\n", baseName(e.vShaderFile).c_str(),
+                       baseName(e.fShaderFile).c_str(), e.cacheMs);
+            } else {
+                printf("Build shader program: %s + %s (compiled, %.2f ms, cache lookup %.2f ms)\n",
+                       baseName(e.vShaderFile).c_str(), baseName(e.fShaderFile).c_str(), e.buildMs, e.cacheMs);
+            }
+        }
+
+        if (entries_.size() > 1) {
+            printf("Build %d shader programs: %.2f ms%s\n", (int)entries_.size(), elapsed,
+                   parallel_ ? " (KHR_parallel_shader_compile)" : "");
+        }
+
+        glUseProgram(0);
+        built_ = true;
+    }
+
+    GLuint program(int index) const {
+        if (!built_) {
+            fprintf(stderr, "ShaderProgramBatch::build() is not called yet!\n");
+            exit(1);
+        }
+        return entries_[index].programId;
+    }
+
+    // 登録されたプログラムの数 (番号は 0〜size()-1)
+    int size() const {
+        return (int)entries_.size();
+    }
+
+    bool isParallel() const {
+        return parallel_;
+    }
+
+private:
+    typedef void (GLAD_API_PTR *MaxShaderCompilerThreadsFunc)(GLuint count);
+    typedef std::chrono::high_resolution_clock Clock;
+
+    struct Entry {
+        Entry()
+            : key(0)
+            , vertShaderId(0u)
+            , fragShaderId(0u)
+            , programId(0u)
+            , cacheHit(false)
+            , done(false)
+            , cacheMs(0.0)
+            , buildMs(0.0) {
+        }
+
+        std::string vShaderFile, fShaderFile;
+        std::string header;
+        std::string vCode, fCode;
+        std::string cacheFile;
+        uint64_t key;
+        GLuint vertShaderId, fragShaderId;
+        GLuint programId;
+        bool cacheHit;
+        bool done;
+        Clock::time_point submitTime;   // コンパイルを発行した時刻
+        double cacheMs;                 // キャッシュの読み込みにかかった時間
+        double buildMs;                 // コンパイルを発行してからリンクの完了を確認するまでの時間
+    };
+
+    static double millisecondsSince(const Clock::time_point &start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    static GLuint submitShader(GLenum type, const std::string &code) {
+        GLuint shaderId = glCreateShader(type);
+        const char *codeChars = code.c_str();
+        glShaderSource(shaderId, 1, &codeChars, NULL);
+        glCompileShader(shaderId);
+        return shaderId;
+    }
+
+    static std::string baseName(const std::string &filename) {
+        return filename.substr(filename.find_last_of("/\\") + 1);
+    }
+
+    // 拡張機能がなければ, 状態の問い合わせでドライバに完了まで待ってもらう
+    bool isCompleted(GLuint programId) const {
+        if (!parallel_) {
+            return true;
+        }
+
+        GLint completed = GL_FALSE;
+        glGetProgramiv(programId, GL_COMPLETION_STATUS_KHR, &completed);
+        return completed == GL_TRUE;
+    }
+
+    void finish(Entry &e, bool useCache) {
+        // 失敗した場合はシェーダのエラーを先に表示する
+        checkShaderCompiled(e.vertShaderId, e.vShaderFile, e.vCode);
+        checkShaderCompiled(e.fragShaderId, e.fShaderFile, e.fCode);
+        checkProgramLinked(e.programId);
+        e.buildMs = millisecondsSince(e.submitTime);
+
+        // プログラムの中に残るので, シェーダ自体はもう不要
+        glDetachShader(e.programId, e.vertShaderId);
+        glDetachShader(e.programId, e.fragShaderId);
+        glDeleteShader(e.vertShaderId);
+        glDeleteShader(e.fragShaderId);
+
+        if (useCache && !ProgramBinaryCache::save(e.cacheFile, e.key, e.programId)) {
+            fprintf(stderr, "[WARNING] Failed to save program binary: %s\n", e.cacheFile.c_str());
+        }
+        e.done = true;
+    }
+
+    std::vector<Entry> entries_;
+    bool parallel_;
+    bool built_;
+};
+
+// シェーダプログラムのビルド (1つだけのバッチ)
+// 前回の起動で保存したプログラムバイナリが使えればそれを読み込み, 使えなければソースからビルドして保存する
+inline GLuint buildShaderProgram(const std::string &vShaderFile, const std::string &fShaderFile) {
+    ShaderProgramBatch batch;
+    const int index = batch.add(vShaderFile, fShaderFile);
+    batch.build();
+    return batch.program(index);
+}
+
+#endif  // _GLUTILS_SHADER_BUILDER_H_
@@ -0,0 +1,217 @@
+#ifndef _GLUTILS_SHADER_PROGRAM_H_
+#define _GLUTILS_SHADER_PROGRAM_H_
+
+// このヘッダは OpenGLの関数を使うので, <glad/gl.h> の後にインクルードすること
+// (gladの実装部はインクルードガードで守られていないため, ここではインクルードしない)
+
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// リンク済みのシェーダプログラムのUniform変数を列挙し, 名前から位置を引く表を持つクラス
+// - 毎回の描画で glGetUniformLocation を文字列で呼ばずに済む
+// - 前回と同じ値の転送を省く (値はプログラムごとに保持されるので, キャッシュもプログラムごとに持つ)
+// - よく使う変数は uniformSlot() で番号を取っておけば, 名前のハッシュ計算も省ける
+// 値の設定は glUniform* を使うので, 呼び出し前に use() でプログラムを有効にしておくこと
+class ShaderProgram {
+public:
+    ShaderProgram()
+        : programId_(0u) {
+    }
+
+    explicit ShaderProgram(GLuint programId)
+        : programId_(0u) {
+        reflect(programId);
+    }
+
+    // リンク済みのプログラムのUniform変数を列挙する
+    void reflect(GLuint programId) {
+        programId_ = programId;
+        uniforms_.clear();
+        slots_.clear();
+
+        GLint numUniforms = 0;
+        GLint maxNameLength = 0;
+        glGetProgramiv(programId_, GL_ACTIVE_UNIFORMS, &numUniforms);
+        glGetProgramiv(programId_, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+        std::vector<char> buffer(std::max(maxNameLength, 1));
+        for (GLint i = 0; i < numUniforms; i++) {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(programId_, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, &buffer[0]);
+
+            // Uniformブロック内の変数は位置を持たない
+            std::string name(&buffer[0], length);
+            const GLint location = glGetUniformLocation(programId_, name.c_str());
+            if (location < 0) {
+                continue;
+            }
+
+            Uniform uniform;
+            uniform.location = location;
+            uniform.type = type;
+            uniform.size = size;
+            uniforms_.push_back(uniform);
+
+            // 配列は "name[0]" で返ってくるので "name" でも引けるようにする
+            const int slot = (int)uniforms_.size() - 1;
+            slots_[name] = slot;
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+                slots_[name.substr(0, name.size() - 3)] = slot;
+            }
+        }
+    }
+
+    void use() const {
+        glUseProgram(programId_);
+    }
+
+    GLuint id() const {
+        return programId_;
+    }
+
+    // 変数の番号 (シェーダ内で使われていない場合は-1)
+    int uniformSlot(const std::string &name) const {
+        std::unordered_map<std::string, int>::const_iterator it = slots_.find(name);
+        return it != slots_.end() ? it->second : -1;
+    }
+
+    GLint uniformLocation(const std::string &name) const {
+        const int slot = uniformSlot(name);
+        return slot >= 0 ? uniforms_[slot].location : -1;
+    }
+
+    bool hasUniform(const std::string &name) const {
+        return uniformSlot(name) >= 0;
+    }
+
+    // Uniformブロックを結合点に対応づける (シェーダ内で使われていなければ何もしない)
+    void bindUniformBlock(const std::string &blockName, GLuint binding) const {
+        const GLuint index = glGetUniformBlockIndex(programId_, blockName.c_str());
+        if (index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(programId_, index, binding);
+        }
+    }
+
+    // 型ごとの設定関数 (値が変わったときだけ転送する)
+    void set(int slot, int value) {
+        if (changed(slot, &value, 1)) {
+            glUniform1i(uniforms_[slot].location, value);
+        }
+    }
+
+    void set(int slot, bool value) {
+        set(slot, value ? 1 : 0);
+    }
+
+    void set(int slot, float value) {
+        if (changed(slot, &value, 1)) {
+            glUniform1f(uniforms_[slot].location, value);
+        }
+    }
+
+    void set(int slot, const glm::vec2 &value) {
+        if (changed(slot, &value, 1)) {
+            glUniform2fv(uniforms_[slot].location, 1, glm::value_ptr(value));
+        }
+    }
+
+    void set(int slot, const glm::vec3 &value) {
+        setArray(slot, &value, 1);
+    }
+
+    void set(int slot, const glm::vec4 &value) {
+        setArray(slot, &value, 1);
+    }
+
+    void set(int slot, const glm::mat3 &value) {
+        if (changed(slot, &value, 1)) {
+            glUniformMatrix3fv(uniforms_[slot].location, 1, GL_FALSE, glm::value_ptr(value));
+        }
+    }
+
+    void set(int slot, const glm::mat4 &value) {
+        setArray(slot, &value, 1);
+    }
+
+    void setArray(int slot, const float *values, int count) {
+        if (changed(slot, values, count)) {
+            glUniform1fv(uniforms_[slot].location, count, values);
+        }
+    }
+
+    void setArray(int slot, const glm::vec3 *values, int count) {
+        if (changed(slot, values, count)) {
+            glUniform3fv(uniforms_[slot].location, count, glm::value_ptr(values[0]));
+        }
+    }
+
+    void setArray(int slot, const glm::vec4 *values, int count) {
+        if (changed(slot, values, count)) {
+            glUniform4fv(uniforms_[slot].location, count, glm::value_ptr(values[0]));
+        }
+    }
+
+    void setArray(int slot, const glm::mat4 *values, int count) {
+        if (changed(slot, values, count)) {
+            glUniformMatrix4fv(uniforms_[slot].location, count, GL_FALSE, glm::value_ptr(values[0]));
+        }
+    }
+
+    // 名前で指定する版 (表を引いてから上の関数を呼ぶ)
+    template <typename T>
+    void set(const std::string &name, const T &value) {
+        set(uniformSlot(name), value);
+    }
+
+    template <typename T>
+    void setArray(const std::string &name, const T *values, int count) {
+        setArray(uniformSlot(name), values, count);
+    }
+
+    // キャッシュを捨てて次の設定で必ず転送させる (外部から glUniform* を呼んだ場合など)
+    void invalidate() {
+        for (int i = 0; i < (int)uniforms_.size(); i++) {
+            uniforms_[i].cache.clear();
+        }
+    }
+
+private:
+    struct Uniform {
+        GLint location;
+        GLenum type;
+        GLint size;
+        std::vector<unsigned char> cache;
+    };
+
+    // 前回の値と比べ, 変わっていればキャッシュを更新してtrueを返す
+    template <typename T>
+    bool changed(int slot, const T *values, int count) {
+        if (slot < 0 || slot >= (int)uniforms_.size()) {
+            return false;
+        }
+
+        std::vector<unsigned char> &cache = uniforms_[slot].cache;
+        const size_t bytes = sizeof(T) * count;
+        if (cache.size() == bytes && std::memcmp(&cache[0], values, bytes) == 0) {
+            return false;
+        }
+
+        cache.resize(bytes);
+        std::memcpy(&cache[0], values, bytes);
+        return true;
+    }
+
+    GLuint programId_;
+    std::vector<Uniform> uniforms_;
+    std::unordered_map<std::string, int> slots_;
+};
+
+#endif  // _GLUTILS_SHADER_PROGRAM_H_
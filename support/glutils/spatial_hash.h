@@ -0,0 +1,124 @@
+#ifndef _GLUTILS_SPATIAL_HASH_H_
+#define _GLUTILS_SPATIAL_HASH_H_
+
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// 一様な格子による空間ハッシュ (あたり判定の候補を絞り込むためのもの)
+//
+// 点を格子のセルに振り分け, セル座標のハッシュ値ごとにまとめて並べておく.
+// 問い合わせでは球が重なるセルだけを調べるので, 点の総数によらず近くの点だけが返る.
+// 毎フレーム作り直す使い方を想定しており, build() は計数ソートなので点の数に比例した時間で終わる.
+class SpatialHash {
+public:
+    // セルの一辺は問い合わせる半径の2倍程度にするとよい
+    explicit SpatialHash(float cellSize)
+        : cellSize_(cellSize)
+        , invCellSize_(1.0f / cellSize)
+        , mask_(0u) {
+    }
+
+    // 点の並び [first, last) から作り直す. 問い合わせで返る番号はこの並びでの番号
+    template <typename Iterator>
+    void build(Iterator first, Iterator last) {
+        cells_.clear();
+        for (Iterator it = first; it != last; ++it) {
+            cells_.push_back(cellOf(*it));
+        }
+
+        // バケットの数は点の数の2倍以上の2のべき乗にする
+        const size_t n = cells_.size();
+        size_t numBuckets = 16;
+        while (numBuckets < n * 2) {
+            numBuckets *= 2;
+        }
+        mask_ = (unsigned int)numBuckets - 1u;
+
+        // バケットごとの数を数えて先頭位置を求め, 番号を詰めて並べる
+        bucketStart_.assign(numBuckets + 1, 0);
+        for (size_t i = 0; i < n; i++) {
+            bucketStart_[bucket(cells_[i]) + 1]++;
+        }
+        for (size_t b = 0; b < numBuckets; b++) {
+            bucketStart_[b + 1] += bucketStart_[b];
+        }
+
+        entries_.resize(n);
+        fill_.assign(bucketStart_.begin(), bucketStart_.end() - 1);
+        for (size_t i = 0; i < n; i++) {
+            entries_[fill_[bucket(cells_[i])]++] = (int)i;
+        }
+    }
+
+    // centerから半径radiusの球が重なるセルにある点の番号を callback(int) に渡す
+    // (同じ点が2回渡されることはない. 距離の判定は呼び出し側で行う)
+    template <typename Callback>
+    void query(const glm::vec3 &center, float radius, Callback callback) const {
+        if (entries_.empty()) {
+            return;
+        }
+
+        const Cell lo = cellOf(center - glm::vec3(radius));
+        const Cell hi = cellOf(center + glm::vec3(radius));
+        Cell c;
+        for (c.z = lo.z; c.z <= hi.z; c.z++) {
+            for (c.y = lo.y; c.y <= hi.y; c.y++) {
+                for (c.x = lo.x; c.x <= hi.x; c.x++) {
+                    const unsigned int b = bucket(c);
+                    for (int k = bucketStart_[b]; k < bucketStart_[b + 1]; k++) {
+                        // ハッシュ値が衝突した別のセルの点は飛ばす
+                        const int index = entries_[k];
+                        if (cells_[index] == c) {
+                            callback(index);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    int size() const {
+        return (int)entries_.size();
+    }
+
+    float cellSize() const {
+        return cellSize_;
+    }
+
+private:
+    struct Cell {
+        int x, y, z;
+
+        bool operator==(const Cell &other) const {
+            return x == other.x && y == other.y && z == other.z;
+        }
+    };
+
+    Cell cellOf(const glm::vec3 &p) const {
+        Cell c;
+        c.x = (int)std::floor(p.x * invCellSize_);
+        c.y = (int)std::floor(p.y * invCellSize_);
+        c.z = (int)std::floor(p.z * invCellSize_);
+        return c;
+    }
+
+    // 大きな素数を掛けて混ぜる (Teschnerらのハッシュ関数)
+    unsigned int bucket(const Cell &c) const {
+        const unsigned int h = ((unsigned int)c.x * 73856093u) ^
+                               ((unsigned int)c.y * 19349663u) ^
+                               ((unsigned int)c.z * 83492791u);
+        return h & mask_;
+    }
+
+    float cellSize_;
+    float invCellSize_;
+    unsigned int mask_;
+    std::vector<Cell> cells_;        // 点ごとのセル
+    std::vector<int> bucketStart_;   // バケットごとの entries_ 内の先頭 (末尾に総数)
+    std::vector<int> entries_;       // バケット順に並べた点の番号
+    std::vector<int> fill_;
+};
+
+#endif  // _GLUTILS_SPATIAL_HASH_H_
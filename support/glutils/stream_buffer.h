@@ -0,0 +1,192 @@
+#ifndef _GLUTILS_STREAM_BUFFER_H_
+#define _GLUTILS_STREAM_BUFFER_H_
+
+// このヘッダは OpenGLの関数を使うので, <glad/gl.h> の後にインクルードすること
+// (gladの実装部はインクルードガードで守られていないため, ここではインクルードしない)
+
+#include <cstdio>
+#include <cstdlib>
+
+// フレームごとに書き換えるデータ (頂点, インスタンス, Uniformブロックなど) を流し込むリングバッファ
+//
+// OpenGL 4.4以上では, 3フレーム分のセグメントを持つバッファを glBufferStorage で確保して
+// 永続的にマップしておき, CPUは毎フレーム次のセグメントに直接書き込む.
+// セグメントごとにフェンスを置き, GPUがまだ読んでいるセグメントに書き込む場合だけ待つ.
+// それ以前のバージョンでは, 毎フレーム古い領域を手放して (orphaning) 1セグメント分を確保し直す.
+//
+// 1フレームの使い方:
+//   beginFrame() -> allocate() で領域を確保して書き込む (何回でも)
+//   -> flush() -> 描画 -> endFrame()
+// 描画では, allocate() が返したオフセットを glVertexAttribPointer や glBindBufferRange に渡す
+class StreamBuffer {
+public:
+    static const int NUM_SEGMENTS = 3;
+
+    StreamBuffer()
+        : bufferId_(0u)
+        , segmentSize_(0)
+        , segment_(0)
+        , used_(0)
+        , mapped_(NULL)
+        , persistent_(false)
+        , inFrame_(false) {
+        for (int i = 0; i < NUM_SEGMENTS; i++) {
+            fences_[i] = 0;
+        }
+    }
+
+    // 1フレームで使う最大のバイト数を指定して確保する
+    void create(GLsizeiptr segmentSize) {
+        release();
+
+        segmentSize_ = segmentSize;
+        segment_ = 0;
+        persistent_ = GLAD_GL_VERSION_4_4 != 0;
+
+        glGenBuffers(1, &bufferId_);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, bufferId_);
+        if (persistent_) {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_COPY_WRITE_BUFFER, segmentSize_ * NUM_SEGMENTS, NULL, flags);
+            mapped_ = (char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, segmentSize_ * NUM_SEGMENTS, flags);
+            if (mapped_ == NULL) {
+                fprintf(stderr, "Failed to map stream buffer persistently!\n");
+                exit(1);
+            }
+        } else {
+            glBufferData(GL_COPY_WRITE_BUFFER, segmentSize_, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    void release() {
+        if (bufferId_ == 0u) {
+            return;
+        }
+
+        for (int i = 0; i < NUM_SEGMENTS; i++) {
+            if (fences_[i] != 0) {
+                glDeleteSync(fences_[i]);
+                fences_[i] = 0;
+            }
+        }
+
+        // 永続マップは削除時に自動で解除される
+        glDeleteBuffers(1, &bufferId_);
+        bufferId_ = 0u;
+        mapped_ = NULL;
+        inFrame_ = false;
+    }
+
+    // 次のセグメントを書き込み用に用意する
+    void beginFrame() {
+        if (persistent_) {
+            segment_ = (segment_ + 1) % NUM_SEGMENTS;
+            waitFence(segment_);
+        } else {
+            // 古い領域を手放してから書き込むので, GPUが読み終わるのを待たずに済む
+            glBindBuffer(GL_COPY_WRITE_BUFFER, bufferId_);
+            glBufferData(GL_COPY_WRITE_BUFFER, segmentSize_, NULL, GL_STREAM_DRAW);
+            mapped_ = (char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, segmentSize_,
+                                              GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            if (mapped_ == NULL) {
+                fprintf(stderr, "Failed to map stream buffer!\n");
+                exit(1);
+            }
+        }
+
+        used_ = 0;
+        inFrame_ = true;
+    }
+
+    // 現在のセグメントから size バイトを確保し, 書き込み先を返す
+    // offsetにはバッファの先頭からの位置が入る (alignmentの倍数にそろえる)
+    void *allocate(GLsizeiptr size, GLsizeiptr alignment, GLintptr *offset) {
+        if (!inFrame_) {
+            fprintf(stderr, "StreamBuffer::beginFrame() is not called yet!\n");
+            exit(1);
+        }
+
+        const GLsizeiptr base = segmentBase();
+        GLsizeiptr start = ((base + used_ + alignment - 1) / alignment) * alignment - base;
+        if (start + size > segmentSize_) {
+            fprintf(stderr, "Stream buffer overflow: %ld bytes requested, %ld bytes left\n",
+                    (long)size, (long)(segmentSize_ - used_));
+            exit(1);
+        }
+
+        used_ = start + size;
+        *offset = (GLintptr)(base + start);
+        return persistent_ ? mapped_ + base + start : mapped_ + start;
+    }
+
+    // 書き込んだ内容をGPUに渡す (描画の前に呼ぶ)
+    void flush() {
+        if (!persistent_ && mapped_ != NULL) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, bufferId_);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            mapped_ = NULL;
+        }
+    }
+
+    // このフレームの描画命令をすべて出した後に呼び, セグメントにフェンスを置く
+    void endFrame() {
+        flush();
+        if (persistent_) {
+            if (fences_[segment_] != 0) {
+                glDeleteSync(fences_[segment_]);
+            }
+            fences_[segment_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+        inFrame_ = false;
+    }
+
+    GLuint id() const {
+        return bufferId_;
+    }
+
+    GLsizeiptr segmentSize() const {
+        return segmentSize_;
+    }
+
+    bool isPersistent() const {
+        return persistent_;
+    }
+
+private:
+    GLsizeiptr segmentBase() const {
+        return persistent_ ? segmentSize_ * segment_ : 0;
+    }
+
+    // GPUがセグメントを読み終わるまで待つ (ふつうは2フレーム前のものなので待たずに済む)
+    void waitFence(int segment) {
+        if (fences_[segment] == 0) {
+            return;
+        }
+
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        for (;;) {
+            const GLenum result = glClientWaitSync(fences_[segment], flags, 1000000);
+            if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED) {
+                break;
+            }
+            flags = 0;
+        }
+
+        glDeleteSync(fences_[segment]);
+        fences_[segment] = 0;
+    }
+
+    GLuint bufferId_;
+    GLsizeiptr segmentSize_;
+    int segment_;
+    GLsizeiptr used_;
+    char *mapped_;
+    bool persistent_;
+    bool inFrame_;
+    GLsync fences_[NUM_SEGMENTS];
+};
+
+#endif  // _GLUTILS_STREAM_BUFFER_H_
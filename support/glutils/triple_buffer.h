@@ -0,0 +1,72 @@
+#ifndef _GLUTILS_TRIPLE_BUFFER_H_
+#define _GLUTILS_TRIPLE_BUFFER_H_
+
+#include <atomic>
+
+// 1つのスレッドが書き込み, 別の1つのスレッドが読み出すデータの受け渡し口 (ロックを使わない三重バッファ)
+//
+// 書き込み側, 読み出し側, 受け渡し用の3つの領域を持ち, 受け渡し用の領域の番号だけを
+// アトミックに入れ替える. 書き込み側は読み出しを待たずに次々と publish() でき,
+// 読み出し側は consume() したときに最も新しく publish() されたものを受け取る (間のものは捨てられる).
+// 読み出し中の領域が書き換えられることはないので, 受け取ったデータは次の consume() まで変わらない.
+//
+// 書き込み側: T &data = mailbox.writeBuffer(); (dataを埋める) mailbox.publish();
+// 読み出し側: mailbox.consume(); const T &data = mailbox.readBuffer();
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer()
+        : middle_(1u)
+        , back_(0u)
+        , front_(2u) {
+    }
+
+    // 書き込み側の領域 (書き込み側のスレッドだけが触る)
+    T &writeBuffer() {
+        return buffers_[back_];
+    }
+
+    // 書き込んだ領域を受け渡し用の領域と入れ替えて, 読み出し側に渡す
+    void publish() {
+        const unsigned int prev = middle_.exchange(back_ | NEW_DATA, std::memory_order_acq_rel);
+        back_ = prev & INDEX_MASK;
+    }
+
+    // 新しいデータがあれば受け取って true を返す (なければ前回のデータのまま)
+    bool consume() {
+        if ((middle_.load(std::memory_order_acquire) & NEW_DATA) == 0u) {
+            return false;
+        }
+
+        const unsigned int prev = middle_.exchange(front_, std::memory_order_acq_rel);
+        front_ = prev & INDEX_MASK;
+        return true;
+    }
+
+    // 読み出し側の領域 (読み出し側のスレッドだけが触る)
+    const T &readBuffer() const {
+        return buffers_[front_];
+    }
+
+    // 書き込み側のスレッドを始める前に, すべての領域を同じ値で埋める
+    void reset(const T &value) {
+        for (int i = 0; i < 3; i++) {
+            buffers_[i] = value;
+        }
+        middle_.store(1u, std::memory_order_release);
+        back_ = 0u;
+        front_ = 2u;
+    }
+
+private:
+    // 受け渡し用の領域の番号 (下位2ビット) と, まだ読まれていないことを表すビット
+    static const unsigned int INDEX_MASK = 3u;
+    static const unsigned int NEW_DATA = 4u;
+
+    T buffers_[3];
+    std::atomic<unsigned int> middle_;
+    unsigned int back_;
+    unsigned int front_;
+};
+
+#endif  // _GLUTILS_TRIPLE_BUFFER_H_
@@ -0,0 +1,131 @@
+#ifndef _GLUTILS_UNIFORM_BUFFER_H_
+#define _GLUTILS_UNIFORM_BUFFER_H_
+
+// このヘッダは OpenGLの関数を使うので, <glad/gl.h> の後にインクルードすること
+// (gladの実装部はインクルードガードで守られていないため, ここではインクルードしない)
+
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+// Uniformブロックの結合点
+enum UniformBlockBinding {
+    FRAME_BLOCK_BINDING = 0,
+    MATERIAL_BLOCK_BINDING = 1,
+};
+
+// フレームごとに1回だけ転送するカメラと光源の情報 (std140)
+//
+// layout(std140) uniform FrameBlock {
+//     mat4 u_viewMat;
+//     mat4 u_projMat;
+//     vec4 u_lightPos;   // ワールド座標
+// };
+struct FrameBlock {
+    glm::mat4 viewMat;
+    glm::mat4 projMat;
+    glm::vec4 lightPos;
+};
+
+// 材質ごとの情報 (std140). vec3は16バイト境界に置かれ, 直後のfloatはその隙間に詰められる
+//
+// layout(std140) uniform MaterialBlock {
+//     vec3 u_ambiColor;
+//     vec3 u_diffColor;
+//     vec3 u_specColor;
+//     float u_shininess;
+// };
+struct MaterialBlock {
+    MaterialBlock()
+        : ambiColor(0.0f)
+        , pad0(0.0f)
+        , diffColor(0.0f)
+        , pad1(0.0f)
+        , specColor(0.0f)
+        , shininess(1.0f) {
+    }
+
+    MaterialBlock(const glm::vec3 &ambi, const glm::vec3 &diff, const glm::vec3 &spec, float shininess_)
+        : ambiColor(ambi)
+        , pad0(0.0f)
+        , diffColor(diff)
+        , pad1(0.0f)
+        , specColor(spec)
+        , shininess(shininess_) {
+    }
+
+    glm::vec3 ambiColor;
+    float pad0;
+    glm::vec3 diffColor;
+    float pad1;
+    glm::vec3 specColor;
+    float shininess;
+};
+
+static_assert(sizeof(FrameBlock) == 144, "FrameBlock does not match std140 layout");
+static_assert(offsetof(MaterialBlock, diffColor) == 16 && offsetof(MaterialBlock, specColor) == 32 &&
+              offsetof(MaterialBlock, shininess) == 44 && sizeof(MaterialBlock) == 48,
+              "MaterialBlock does not match std140 layout");
+
+// 同じ型のブロックを複数並べたUniformバッファ
+// 各要素の先頭を GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT にそろえておき,
+// 描画時には glBindBufferRange で要素の範囲だけを結合点に割り当てる
+template <typename T>
+class UniformBuffer {
+public:
+    UniformBuffer()
+        : bufferId_(0u)
+        , stride_(0)
+        , count_(0) {
+    }
+
+    void create(int count = 1) {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        stride_ = ((GLsizeiptr)sizeof(T) + alignment - 1) / alignment * alignment;
+        count_ = count;
+
+        glGenBuffers(1, &bufferId_);
+        glBindBuffer(GL_UNIFORM_BUFFER, bufferId_);
+        glBufferData(GL_UNIFORM_BUFFER, stride_ * count_, NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void release() {
+        if (bufferId_ != 0u) {
+            glDeleteBuffers(1, &bufferId_);
+            bufferId_ = 0u;
+        }
+    }
+
+    // index番目の要素を書き換える
+    void update(const T &data, int index = 0) {
+        glBindBuffer(GL_UNIFORM_BUFFER, bufferId_);
+        glBufferSubData(GL_UNIFORM_BUFFER, offset(index), sizeof(T), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // index番目の要素を結合点に割り当てる
+    void bind(GLuint binding, int index = 0) const {
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, bufferId_, offset(index), sizeof(T));
+    }
+
+    GLintptr offset(int index) const {
+        return (GLintptr)(stride_ * index);
+    }
+
+    GLuint id() const {
+        return bufferId_;
+    }
+
+    int count() const {
+        return count_;
+    }
+
+private:
+    GLuint bufferId_;
+    GLsizeiptr stride_;
+    int count_;
+};
+
+#endif  // _GLUTILS_UNIFORM_BUFFER_H_